@@ -0,0 +1,151 @@
+#!/usr/bin/env bash
+#
+# Measures how much build time and compiler memory constexpr MD5 costs.
+#
+# For every compiler in $CXX_LIST this generates translation units holding
+# N compile-time hashes of strings of a given length, compiles each one and
+# prints a CSV row with the wall time and peak resident memory of the
+# compiler. A TU with zero hashes is compiled first so that the cost of
+# the hashes can be told apart from the cost of the headers.
+#
+# It then searches for the largest 'char unsigned' array that one
+# md5::compute call can hash in a constant expression with the compiler's
+# default limits.
+#
+# Usage:
+#     CXX_LIST="g++ clang++" ./benchmark/compile_time.sh
+#
+# Optional environment variables:
+#     CXX_LIST      compilers to test                  (default: "g++ clang++")
+#     CXXSTD        language standard                  (default: 17)
+#     COUNTS        numbers of hashes per TU           (default: "0 100 1000 5000")
+#     LENGTHS       string lengths                     (default: "8 64 512")
+#     LIMIT_MAX     upper bound for the limit search   (default: 16777216)
+#
+# Peak memory needs GNU time (/usr/bin/time), otherwise it is reported as
+# "n/a". MSVC ('cl') is driven with its own flags, any other compiler is
+# assumed to accept GCC-style flags (g++, clang++, icpx, bcc32c, bcc64).
+
+set -u
+
+HERE="$(cd "$(dirname "$0")" && pwd)"
+ROOT="$(dirname "$HERE")"
+CXX_LIST="${CXX_LIST:-g++ clang++}"
+CXXSTD="${CXXSTD:-17}"
+COUNTS="${COUNTS:-0 100 1000 5000}"
+LENGTHS="${LENGTHS:-8 64 512}"
+LIMIT_MAX="${LIMIT_MAX:-16777216}"
+
+WORK="$(mktemp -d)"
+trap 'rm -rf "$WORK"' EXIT
+
+# Writes a TU with $2 hashes of strings of length $3 to file $1
+generate_hashes()
+{
+    local file="$1" count="$2" length="$3" i
+    {
+        echo '#include "md5.hpp"'
+        for (( i = 0; i < count; ++i ))
+        do
+            # Each string is unique so the compiler can't share evaluations
+            printf 'constexpr md5::Digest d%d = md5::compute("%s");\n' "$i" \
+                "$(printf '%0*d' "$length" "$i" | head -c "$length")"
+        done
+        echo 'int main(void) { return 0; }'
+    } > "$file"
+}
+
+# Writes a TU that hashes a $2 byte array in a constant expression to file $1
+generate_blob()
+{
+    local file="$1" length="$2"
+    {
+        echo '#include "md5.hpp"'
+        echo 'static constexpr char unsigned blob[] = {'
+        head -c "$length" /dev/zero | tr '\0' '\7' | sed 's/./7,/g'
+        echo '};'
+        echo 'constexpr md5::Digest d = md5::compute(blob);'
+        echo 'int main(void) { return d.b[0]; }'
+    } > "$file"
+}
+
+# Compiles file $2 with compiler $1. Prints "seconds,peak_kib" and
+# returns the compiler's exit status.
+compile()
+{
+    local cxx="$1" src="$2" status
+    local -a cmd
+    case "$(basename "$cxx")" in
+        cl|cl.exe) cmd=("$cxx" /nologo /c "/std:c++$CXXSTD" "/I$ROOT" "/Fo$WORK/out.obj" "$src") ;;
+        *)         cmd=("$cxx" -c "-std=c++$CXXSTD" "-I$ROOT" -o "$WORK/out.o" "$src") ;;
+    esac
+
+    if [ -x /usr/bin/time ]
+    then
+        /usr/bin/time -f '%e,%M' -o "$WORK/time.txt" "${cmd[@]}" > /dev/null 2>&1
+        status=$?
+        tr -d '\n' < "$WORK/time.txt"
+    else
+        local start end
+        start=$(date +%s.%N)
+        "${cmd[@]}" > /dev/null 2>&1
+        status=$?
+        end=$(date +%s.%N)
+        awk -v s="$start" -v e="$end" 'BEGIN { printf "%.2f,n/a", e - s }'
+    fi
+    return $status
+}
+
+echo "compiler,hashes,length,seconds,peak_kib,status"
+for cxx in $CXX_LIST
+do
+    command -v "$cxx" > /dev/null 2>&1 || { echo "# skipping '$cxx': not found" >&2; continue; }
+    for count in $COUNTS
+    do
+        for length in $LENGTHS
+        do
+            generate_hashes "$WORK/hashes.cpp" "$count" "$length"
+            result="$(compile "$cxx" "$WORK/hashes.cpp")"
+            status=$?
+            echo "$cxx,$count,$length,$result,$status"
+            [ 0 -eq "$count" ] && break  # length doesn't matter with no hashes
+        done
+    done
+done
+
+echo
+echo "compiler,max_constexpr_bytes"
+for cxx in $CXX_LIST
+do
+    command -v "$cxx" > /dev/null 2>&1 || continue
+
+    # Double the size until it fails, then bisect down to 1 KiB
+    good=0
+    bad=1024
+    while [ "$bad" -le "$LIMIT_MAX" ]
+    do
+        generate_blob "$WORK/blob.cpp" "$bad"
+        compile "$cxx" "$WORK/blob.cpp" > /dev/null || break
+        good=$bad
+        bad=$(( bad * 2 ))
+    done
+
+    if [ "$bad" -gt "$LIMIT_MAX" ]
+    then
+        echo "$cxx,>=$good"
+        continue
+    fi
+
+    while [ $(( bad - good )) -gt 1024 ]
+    do
+        mid=$(( (good + bad) / 2 ))
+        generate_blob "$WORK/blob.cpp" "$mid"
+        if compile "$cxx" "$WORK/blob.cpp" > /dev/null
+        then
+            good=$mid
+        else
+            bad=$mid
+        fi
+    done
+    echo "$cxx,$good"
+done
@@ -0,0 +1,168 @@
+#ifndef HEADER_INCLUSION_GUARD_17450919354061197737862204855153430270388
+#define HEADER_INCLUSION_GUARD_17450919354061197737862204855153430270388
+
+// Hardware performance counters for the benchmarks, read through Linux's
+// perf_event_open. Each counter is opened on its own so that whatever the
+// kernel and CPU allow is still reported when some events are unavailable
+// (e.g. inside a VM, or with a strict kernel.perf_event_paranoid).
+// When there are more events than hardware counters the kernel takes
+// turns among them, so each count is scaled by the share of the time its
+// event was actually counting.
+// RAPL package energy is system-wide, so it normally needs root or
+// CAP_PERFMON, and includes everything else running on the package.
+//
+// On other operating systems every counter reports as unavailable.
+
+#include <cstdint>     // uint64_t
+#include <cstdio>      // fopen, fscanf
+
+#ifdef __linux__
+#   include <linux/perf_event.h>  // perf_event_attr
+#   include <sys/syscall.h>       // __NR_perf_event_open
+#   include <unistd.h>            // syscall, read, close
+#endif
+
+namespace md5_bench {
+
+    class PerfCounters {
+    public:
+
+        enum Event { cycles, instructions, branch_misses, l1d_misses, llc_misses, energy_joules, event_count };
+
+        static char const *name(Event const e) noexcept
+        {
+            static char const *const names[event_count] = {
+                "cycles", "instructions", "branch_misses", "l1d_misses", "llc_misses", "energy_joules"
+            };
+            return names[e];
+        }
+
+        PerfCounters(void) noexcept
+        {
+            for ( auto &fd : fds ) fd = -1;
+            reset();
+#ifdef __linux__
+            open_hardware(cycles       , PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+            open_hardware(instructions , PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+            open_hardware(branch_misses, PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+            open_hardware(l1d_misses   , PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D
+                                                           | (PERF_COUNT_HW_CACHE_OP_READ << 8u)
+                                                           | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16u));
+            open_hardware(llc_misses   , PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+            open_rapl();
+#endif
+        }
+
+        ~PerfCounters(void)
+        {
+#ifdef __linux__
+            for ( int const fd : fds ) if ( -1 != fd ) ::close(fd);
+#endif
+        }
+
+        PerfCounters(PerfCounters const &) = delete;
+        PerfCounters &operator=(PerfCounters const &) = delete;
+
+        bool available(Event const e) const noexcept { return -1 != fds[e]; }
+
+        // Accumulated since the last reset, already scaled to joules for energy
+        double value(Event const e) const noexcept
+        {
+            return (energy_joules == e) ? totals[e] * energy_scale : totals[e];
+        }
+
+        void reset(void) noexcept
+        {
+            for ( auto &t : totals ) t = 0.0;
+        }
+
+        void start(void) noexcept
+        {
+#ifdef __linux__
+            for ( unsigned e = 0u; e < event_count; ++e ) starts[e] = read_fd(fds[e]);
+#endif
+        }
+
+        void stop(void) noexcept
+        {
+#ifdef __linux__
+            for ( unsigned e = 0u; e < event_count; ++e )
+            {
+                Reading const r = read_fd(fds[e]);
+                std::uint64_t const enabled = r.enabled - starts[e].enabled, running = r.running - starts[e].running;
+                double const n = static_cast<double>(r.count - starts[e].count);
+                totals[e] += (0u != running && running < enabled) ? n * enabled / running : n;
+            }
+#endif
+        }
+
+    private:
+
+        // What a counter's file descriptor reads, given the read_format below
+        struct Reading {
+            std::uint64_t count, enabled, running;
+        };
+
+        int fds[event_count];
+        Reading starts[event_count];
+        double totals[event_count];
+        double energy_scale = 0.0;
+
+#ifdef __linux__
+        static int open_event(perf_event_attr &attr, int const pid, int const cpu) noexcept
+        {
+            attr.size = sizeof attr;
+            attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+            return static_cast<int>(::syscall(__NR_perf_event_open, &attr, pid, cpu, -1, PERF_FLAG_FD_CLOEXEC));
+        }
+
+        void open_hardware(Event const e, std::uint32_t const type, std::uint64_t const config) noexcept
+        {
+            perf_event_attr attr{};
+            attr.type = type;
+            attr.config = config;
+            attr.exclude_kernel = 1;  // allowed with perf_event_paranoid <= 2
+            attr.exclude_hv = 1;
+            fds[e] = open_event(attr, 0, -1);  // this thread, any CPU
+        }
+
+        void open_rapl(void) noexcept
+        {
+            unsigned type = 0u, config = 0u;
+            std::FILE *f = std::fopen("/sys/bus/event_source/devices/power/type", "r");
+            if ( nullptr == f ) return;
+            bool ok = (1 == std::fscanf(f, "%u", &type));
+            std::fclose(f);
+
+            if ( !ok ) return;
+
+            f = std::fopen("/sys/bus/event_source/devices/power/events/energy-pkg", "r");
+            if ( nullptr == f ) return;
+            ok = (1 == std::fscanf(f, "event=%x", &config));
+            std::fclose(f);
+            if ( !ok ) return;
+
+            f = std::fopen("/sys/bus/event_source/devices/power/events/energy-pkg.scale", "r");
+            if ( nullptr == f ) return;
+            ok = (1 == std::fscanf(f, "%lf", &energy_scale));
+            std::fclose(f);
+            if ( !ok ) return;
+
+            perf_event_attr attr{};
+            attr.type = type;
+            attr.config = config;
+            fds[energy_joules] = open_event(attr, -1, 0);  // RAPL counts per package, not per thread
+        }
+
+        static Reading read_fd(int const fd) noexcept
+        {
+            Reading r{};
+            if ( -1 != fd && sizeof r != ::read(fd, &r, sizeof r) ) r = Reading{};
+            return r;
+        }
+#endif
+    };
+
+}  // close namespace 'md5_bench'
+
+#endif  // HEADER_INCLUSION_GUARD
@@ -0,0 +1,331 @@
+// Throughput and latency benchmark for the runtime use of md5.hpp
+//
+// Build:
+//     g++ -std=c++14 -O2 -I. -o throughput benchmark/throughput.cpp
+//
+// Usage:
+//     throughput [--quick] [--perf] [--seconds S] [--max-size BYTES] [--json FILE]
+//     throughput --compare OLD.json NEW.json [--threshold PERCENT]
+//
+// Every kernel is run over message sizes from 0 bytes up to --max-size
+// (default 1 GiB). Sizes above the size of the input buffer are streamed
+// through a single Context from that buffer so that a 1 GiB message
+// doesn't need 1 GiB of memory. A human-readable table goes to stderr and
+// one JSON record per kernel and size goes to stdout (or to --json FILE).
+//
+// Calls are timed in groups that take at least 2 us each (a group is a
+// single call for larger messages), so the latency columns, group_p50
+// and group_p99, are percentiles of the mean time per call in a group,
+// not of individual calls.
+//
+// --quick mimics 'openssl speed md5': the block sizes are 16, 64, 256,
+// 1024, 8192 and 16384 bytes, and each is run for 3 seconds.
+//
+// --perf also reads the hardware counters in perf_counters.hpp around the
+// timed loop of every kernel and size, and reports instructions per cycle
+// and branch, L1D and LLC misses and energy per KiB hashed. Counters that
+// can't be opened on this host are reported as -1. Without --perf the
+// counters aren't opened and cost nothing.
+//
+// --compare reads two JSON files written by this program and lists every
+// kernel and size whose throughput dropped by more than the threshold
+// (default 5 percent). The exit status is 1 when a regression is found.
+
+#include <algorithm>   // sort, max, min
+#include <chrono>      // steady_clock
+#include <cstdint>     // uint64_t
+#include <cstdio>      // printf, fprintf, fopen
+#include <cstdlib>     // strtod, strtoull
+#include <cstring>     // strcmp
+#include <memory>      // unique_ptr
+#include <string>      // string
+#include <vector>      // vector
+#include "../md5.hpp"
+#include "perf_counters.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#   include <x86intrin.h>  // __rdtsc
+#   define MD5_BENCH_HAVE_TSC 1
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#   include <intrin.h>     // __rdtsc
+#   define MD5_BENCH_HAVE_TSC 1
+#endif
+
+namespace {
+
+    using Clock = std::chrono::steady_clock;
+
+    constexpr std::size_t buffer_size = 1024u * 1024u;  // larger messages are streamed from this
+    constexpr std::size_t stream_chunk = 4096u;         // chunk size for the 'stream' kernel
+
+    std::uint64_t read_cycles(void) noexcept
+    {
+#ifdef MD5_BENCH_HAVE_TSC
+        return __rdtsc();
+#else
+        return 0u;
+#endif
+    }
+
+    md5::Digest hash_oneshot(char unsigned const *const data, std::size_t const size) noexcept
+    {
+        if ( size <= buffer_size ) return md5::compute(data, size);
+
+        md5::details::Context ctx;
+        for ( std::size_t left = size; 0u != left; )
+        {
+            std::size_t const n = std::min(left, buffer_size);
+            ctx.append(data, n);
+            left -= n;
+        }
+        return ctx.final();
+    }
+
+    md5::Digest hash_stream(char unsigned const *const data, std::size_t const size) noexcept
+    {
+        md5::details::Context ctx;
+        for ( std::size_t done = 0u; done != size; )
+        {
+            std::size_t const n = std::min(size - done, stream_chunk);
+            ctx.append(data + (done % buffer_size), n);
+            done += n;
+        }
+        return ctx.final();
+    }
+
+    struct Kernel {
+        char const *name;
+        md5::Digest (*hash)(char unsigned const *, std::size_t) noexcept;
+    };
+
+    Kernel const kernels[] = {
+        { "compute", hash_oneshot },  // md5::compute on the whole message
+        { "stream" , hash_stream  },  // Context::append in 4 KiB pieces
+    };
+
+    struct Result {
+        std::string kernel;
+        std::uint64_t size;
+        std::uint64_t calls;
+        double gbps;
+        double cycles_per_byte;  // negative when no cycle counter is available
+        double group_p50_ns;  // percentiles of the mean time per call in a timed group
+        double group_p99_ns;
+        bool has_perf;
+        double perf[md5_bench::PerfCounters::event_count];  // per KiB hashed, or -1 when unavailable
+    };
+
+    volatile char unsigned sink;  // stops the compiler from discarding the digests
+
+    Result run(Kernel const &kernel, char unsigned const *const data, std::size_t const size, double const seconds,
+               md5_bench::PerfCounters *const perf)
+    {
+        // Small messages are timed in groups so that the clock's own
+        // overhead doesn't dominate; a group is sized to take ~2 us
+        std::size_t group = 1u;
+        for ( ;; group *= 2u )
+        {
+            auto const start = Clock::now();
+            for ( std::size_t i = 0u; i < group; ++i ) sink = sink ^ kernel.hash(data, size)[0];
+            if ( Clock::now() - start >= std::chrono::microseconds(2) || group >= (1u << 20u) ) break;
+        }
+
+        std::vector<double> samples;  // mean nanoseconds per call, one per group
+        std::uint64_t calls = 0u, cycles = 0u;
+        double total_ns = 0.0;
+        auto const deadline = Clock::now() + std::chrono::duration<double>(seconds);
+        if ( nullptr != perf )
+        {
+            perf->reset();
+            perf->start();
+        }
+        do
+        {
+            std::uint64_t const c0 = read_cycles();
+            auto const t0 = Clock::now();
+            for ( std::size_t i = 0u; i < group; ++i ) sink = sink ^ kernel.hash(data, size)[0];
+            auto const t1 = Clock::now();
+            cycles += read_cycles() - c0;
+
+            double const ns = std::chrono::duration<double, std::nano>(t1 - t0).count();
+            samples.push_back(ns / group);
+            total_ns += ns;
+            calls += group;
+        } while ( Clock::now() < deadline );
+        if ( nullptr != perf ) perf->stop();
+
+        std::sort(samples.begin(), samples.end());
+        auto const percentile = [&samples](double const p) { return samples[static_cast<std::size_t>(p * (samples.size() - 1u))]; };
+
+        double const bytes = static_cast<double>(size) * calls;
+        Result r;
+        r.kernel = kernel.name;
+        r.size = size;
+        r.calls = calls;
+        r.gbps = bytes / total_ns;  // bytes per ns == GB/s
+#ifdef MD5_BENCH_HAVE_TSC
+        r.cycles_per_byte = (0u != size) ? cycles / bytes : 0.0;
+#else
+        r.cycles_per_byte = -1.0;
+#endif
+        r.group_p50_ns = percentile(0.50);
+        r.group_p99_ns = percentile(0.99);
+
+        r.has_perf = (nullptr != perf);
+        for ( unsigned e = 0u; r.has_perf && e < md5_bench::PerfCounters::event_count; ++e )
+        {
+            auto const event = static_cast<md5_bench::PerfCounters::Event>(e);
+            r.perf[e] = (perf->available(event) && 0u != size) ? perf->value(event) * 1024.0 / bytes : -1.0;
+        }
+        return r;
+    }
+
+    void print_json(std::FILE *const f, Result const &r)
+    {
+        std::fprintf(f, "{\"kernel\":\"%s\",\"size\":%llu,\"calls\":%llu,\"gbps\":%.6f,\"cycles_per_byte\":%.4f,\"group_p50_ns\":%.1f,\"group_p99_ns\":%.1f",
+                     r.kernel.c_str(), static_cast<unsigned long long>(r.size), static_cast<unsigned long long>(r.calls),
+                     r.gbps, r.cycles_per_byte, r.group_p50_ns, r.group_p99_ns);
+        for ( unsigned e = 0u; r.has_perf && e < md5_bench::PerfCounters::event_count; ++e )
+        {
+            std::fprintf(f, ",\"%s_per_kib\":%.6g", md5_bench::PerfCounters::name(static_cast<md5_bench::PerfCounters::Event>(e)), r.perf[e]);
+        }
+        std::fprintf(f, "}\n");
+    }
+
+    void print_perf(Result const &r)
+    {
+        using md5_bench::PerfCounters;
+        double const ipc = (r.perf[PerfCounters::cycles] > 0.0 && r.perf[PerfCounters::instructions] >= 0.0)
+                         ? r.perf[PerfCounters::instructions] / r.perf[PerfCounters::cycles] : -1.0;
+        std::fprintf(stderr, "%-10s %12llu %8.2f %14.3g %14.3g %14.3g %14.3g\n", r.kernel.c_str(),
+                     static_cast<unsigned long long>(r.size), ipc, r.perf[PerfCounters::branch_misses],
+                     r.perf[PerfCounters::l1d_misses], r.perf[PerfCounters::llc_misses], r.perf[PerfCounters::energy_joules]);
+    }
+
+    // Only reads back what print_json writes, one record per line (the
+    // optional counter fields at the end of a record are ignored)
+    bool parse_json(char const *const line, Result &r)
+    {
+        char kernel[64];
+        unsigned long long size, calls;
+        if ( 7 != std::sscanf(line, "{\"kernel\":\"%63[^\"]\",\"size\":%llu,\"calls\":%llu,\"gbps\":%lf,\"cycles_per_byte\":%lf,\"group_p50_ns\":%lf,\"group_p99_ns\":%lf}",
+                              kernel, &size, &calls, &r.gbps, &r.cycles_per_byte, &r.group_p50_ns, &r.group_p99_ns) ) return false;
+        r.has_perf = false;
+        r.kernel = kernel;
+        r.size = size;
+        r.calls = calls;
+        return true;
+    }
+
+    bool load(char const *const path, std::vector<Result> &results)
+    {
+        std::FILE *const f = std::fopen(path, "r");
+        if ( nullptr == f ) return false;
+        char line[512];
+        Result r;
+        while ( std::fgets(line, sizeof line, f) ) if ( parse_json(line, r) ) results.push_back(r);
+        std::fclose(f);
+        return true;
+    }
+
+    int compare(char const *const old_path, char const *const new_path, double const threshold)
+    {
+        std::vector<Result> before, after;
+        if ( !load(old_path, before) ) { std::fprintf(stderr, "cannot read '%s'\n", old_path); return 2; }
+        if ( !load(new_path, after ) ) { std::fprintf(stderr, "cannot read '%s'\n", new_path); return 2; }
+
+        int regressions = 0;
+        std::printf("%-10s %12s %10s %10s %8s\n", "kernel", "size", "old GB/s", "new GB/s", "change");
+        for ( Result const &n : after )
+        {
+            auto const o = std::find_if(before.begin(), before.end(),
+                                        [&n](Result const &x) { return x.kernel == n.kernel && x.size == n.size; });
+            if ( before.end() == o || 0u == n.size ) continue;
+
+            double const change = 100.0 * (n.gbps - o->gbps) / o->gbps;
+            bool const regressed = change < -threshold;
+            regressions += regressed;
+            std::printf("%-10s %12llu %10.3f %10.3f %+7.1f%%%s\n", n.kernel.c_str(), static_cast<unsigned long long>(n.size),
+                        o->gbps, n.gbps, change, regressed ? "  REGRESSION" : "");
+        }
+        return (0 != regressions) ? 1 : 0;
+    }
+}
+
+int main(int const argc, char **const argv)
+{
+    bool quick = false, use_perf = false;
+    double seconds = -1.0, threshold = 5.0;
+    std::uint64_t max_size = 1024ull * 1024u * 1024u;
+    char const *json_path = nullptr, *compare_old = nullptr, *compare_new = nullptr;
+
+    for ( int i = 1; i < argc; ++i )
+    {
+        bool const has_value = (i + 1) < argc;
+        if      ( 0 == std::strcmp(argv[i], "--quick") ) quick = true;
+        else if ( 0 == std::strcmp(argv[i], "--perf" ) ) use_perf = true;
+        else if ( 0 == std::strcmp(argv[i], "--seconds"  ) && has_value ) seconds = std::strtod(argv[++i], nullptr);
+        else if ( 0 == std::strcmp(argv[i], "--max-size" ) && has_value ) max_size = std::strtoull(argv[++i], nullptr, 10);
+        else if ( 0 == std::strcmp(argv[i], "--json"     ) && has_value ) json_path = argv[++i];
+        else if ( 0 == std::strcmp(argv[i], "--threshold") && has_value ) threshold = std::strtod(argv[++i], nullptr);
+        else if ( 0 == std::strcmp(argv[i], "--compare"  ) && (i + 2) < argc ) { compare_old = argv[++i]; compare_new = argv[++i]; }
+        else
+        {
+            std::fprintf(stderr, "usage: %s [--quick] [--perf] [--seconds S] [--max-size BYTES] [--json FILE]\n"
+                                 "       %s --compare OLD.json NEW.json [--threshold PERCENT]\n", argv[0], argv[0]);
+            return 2;
+        }
+    }
+
+    if ( nullptr != compare_old ) return compare(compare_old, compare_new, threshold);
+
+    std::vector<std::uint64_t> sizes;
+    if ( quick )
+    {
+        sizes = { 16u, 64u, 256u, 1024u, 8192u, 16384u };
+        if ( seconds < 0.0 ) seconds = 3.0;
+    }
+    else
+    {
+        sizes.push_back(0u);
+        for ( std::uint64_t n = 1u; n <= max_size; n *= 4u ) sizes.push_back(n);
+        if ( seconds < 0.0 ) seconds = 0.25;
+    }
+
+    std::FILE *json = stdout;
+    if ( nullptr != json_path && nullptr == (json = std::fopen(json_path, "w")) )
+    {
+        std::fprintf(stderr, "cannot write '%s'\n", json_path);
+        return 2;
+    }
+
+    std::vector<char unsigned> buffer(buffer_size);
+    for ( std::size_t i = 0u; i < buffer.size(); ++i ) buffer[i] = static_cast<char unsigned>(i * 2654435761u >> 24u);
+
+    std::unique_ptr<md5_bench::PerfCounters> perf;
+    if ( use_perf ) perf.reset(new md5_bench::PerfCounters);
+
+    std::vector<Result> results;
+    std::fprintf(stderr, "%-10s %12s %12s %10s %12s %12s %12s\n", "kernel", "size", "calls", "GB/s", "cycles/byte", "group p50 ns", "group p99 ns");
+    for ( Kernel const &kernel : kernels )
+    {
+        for ( std::uint64_t const size : sizes )
+        {
+            Result const r = run(kernel, buffer.data(), static_cast<std::size_t>(size), seconds, perf.get());
+            results.push_back(r);
+            std::fprintf(stderr, "%-10s %12llu %12llu %10.3f %12.2f %12.1f %12.1f\n", r.kernel.c_str(),
+                         static_cast<unsigned long long>(r.size), static_cast<unsigned long long>(r.calls),
+                         r.gbps, r.cycles_per_byte, r.group_p50_ns, r.group_p99_ns);
+            print_json(json, r);
+        }
+    }
+
+    if ( use_perf )
+    {
+        std::fprintf(stderr, "\n%-10s %12s %8s %14s %14s %14s %14s\n", "kernel", "size", "IPC",
+                     "br-miss/KiB", "L1D-miss/KiB", "LLC-miss/KiB", "joules/KiB");
+        for ( Result const &r : results ) print_perf(r);
+    }
+
+    if ( stdout != json ) std::fclose(json);
+}
@@ -19,6 +19,12 @@ int main(int const argc, char **const argv)
     for ( auto const &b : monkey ) std::cout << std::hex << std::setfill('0') << std::setw(2) << (unsigned)b;
     std::cout << std::endl;
 
+    // 600 MiB of zeros: the message length in bits no longer fits in 32 bits
+    md5::details::Context ctx;
+    ctx.append_zeros(600ull * 1024u * 1024u);
+    for ( auto const &b : ctx.final().b ) std::cout << std::hex << std::setfill('0') << std::setw(2) << (unsigned)b;
+    std::cout << std::endl;
+
     // constexpr auto b = uuid();   This line will fail to compiler
 
     // Be aware though that the following line compiles
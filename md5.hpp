@@ -5,7 +5,7 @@
 
 #include <climits>          // CHAR_BIT, UCHAR_MAX
 #include <cstddef>          // size_t
-#include <cstdint>          // int16_t
+#include <cstdint>          // uint_fast32_t, uint64_t
 #include <cstring>          // strlen
 #include <array>            // array
 #include <random>           // random_device
@@ -15,6 +15,75 @@
 #   include <string_view>  // c++17
 #endif
 
+// Runtime-only code (e.g. metrics) must be skipped when the hash is
+// being computed by the compiler
+#if defined(__cpp_lib_is_constant_evaluated)
+#   define MD5_IS_CONSTANT_EVALUATED() (std::is_constant_evaluated())
+#elif defined(__has_builtin)
+#   if __has_builtin(__builtin_is_constant_evaluated)
+#       define MD5_IS_CONSTANT_EVALUATED() (__builtin_is_constant_evaluated())
+#   endif
+#endif
+
+#ifdef MD5_ENABLE_METRICS
+#   ifndef MD5_IS_CONSTANT_EVALUATED
+#       error "MD5_ENABLE_METRICS needs C++20 or a compiler with __builtin_is_constant_evaluated"
+#   endif
+#   include <atomic>       // atomic
+#   include <cstdint>      // uint64_t
+#   include <new>          // nothrow
+#   include <ostream>      // ostream
+#   define MD5_METRICS_ADD(counter, n) do { if ( !MD5_IS_CONSTANT_EVALUATED() ) ::md5::metrics::add(::md5::metrics::counter, n); } while (false)
+#else
+#   define MD5_METRICS_ADD(counter, n) do { } while (false)
+#endif
+
+// USDT probes for bpftrace, perf, systemtap etc. (provider "md5"):
+//     md5:context_create(ctx)
+//     md5:transform_blocks(ctx, blocks)   whole blocks hashed from the caller's memory
+//     md5:final(ctx, bytes)               total length of the message
+//     md5:file_open(fd, path)             md5::file::open_read, fd is -1 on failure
+//     md5:read_done(fd, offset, bytes)    md5::file::read_at, bytes actually read
+// The notes are emitted in the same format as <sys/sdt.h>, which isn't
+// needed to build. Each probe site is a single NOP until a tracer attaches.
+#ifdef MD5_ENABLE_USDT
+#   ifndef MD5_IS_CONSTANT_EVALUATED
+#       error "MD5_ENABLE_USDT needs C++20 or a compiler with __builtin_is_constant_evaluated"
+#   endif
+#   if defined(__ELF__) && (defined(__x86_64__) || defined(__aarch64__)) && defined(__GNUC__)
+#       define MD5_USDT_NOTE(name, args, ...)                                          \
+            __asm__ __volatile__ (                                                      \
+                "990: nop\n"                                                            \
+                ".pushsection .note.stapsdt,\"?\",\"note\"\n"                            \
+                ".balign 4\n"                                                           \
+                ".4byte 992f-991f, 994f-993f, 3\n"                                      \
+                "991: .asciz \"stapsdt\"\n"                                             \
+                "992: .balign 4\n"                                                      \
+                "993: .8byte 990b\n"                                                    \
+                ".8byte _.stapsdt.base\n"                                               \
+                ".8byte 0\n"                                                            \
+                ".asciz \"md5\"\n"                                                      \
+                ".asciz \"" #name "\"\n"                                                \
+                ".asciz \"" args "\"\n"                                                 \
+                "994: .balign 4\n"                                                      \
+                ".popsection\n"                                                         \
+                ".ifndef _.stapsdt.base\n"                                              \
+                ".pushsection .stapsdt.base,\"aG\",\"progbits\",.stapsdt.base,comdat\n" \
+                ".weak _.stapsdt.base\n"                                                \
+                ".hidden _.stapsdt.base\n"                                              \
+                "_.stapsdt.base: .space 1\n"                                            \
+                ".size _.stapsdt.base, 1\n"                                             \
+                ".popsection\n"                                                         \
+                ".endif\n"                                                              \
+                :: __VA_ARGS__ )
+#   else
+#       define MD5_USDT_NOTE(name, args, ...) do { } while (false)
+#   endif
+#   define MD5_USDT_PROBE(name, ...) do { if ( !MD5_IS_CONSTANT_EVALUATED() ) ::md5::usdt::name(__VA_ARGS__); } while (false)
+#else
+#   define MD5_USDT_PROBE(name, ...) do { } while (false)
+#endif
+
 namespace md5 {
     struct Digest {
         static constexpr unsigned count = (128u / CHAR_BIT) + !!(128u % CHAR_BIT);
@@ -29,6 +98,128 @@ namespace md5 {
         constexpr char unsigned const *end  (void) const noexcept { return b + count; }
     };
 
+#ifdef MD5_ENABLE_METRICS
+    // Counters of runtime hashing work for this process. Every thread gets
+    // its own cache-line padded slot the first time it hashes something, so
+    // that counting never contends with other threads; 'snapshot' adds up
+    // the slots of all threads, past and present. Slots are never freed,
+    // so the totals include work done by threads that have since exited.
+    // None of this exists unless MD5_ENABLE_METRICS is defined, and the
+    // compiler's own constexpr hashing is never counted. There is a single
+    // portable kernel and no multi-buffer lanes, so there are no counters
+    // for the kernel choice, lane occupancy or lane stalls; the time spent
+    // waiting on I/O is counted by the reads in md5_file.hpp.
+    namespace metrics {
+
+        enum Counter { bytes, blocks, digests, io_wait_ns, counter_count };
+
+        struct Snapshot {
+            std::uint64_t bytes;       // bytes passed to Context::append
+            std::uint64_t blocks;      // 64-byte blocks through Context::transform (including padding)
+            std::uint64_t digests;     // calls to Context::final
+            std::uint64_t io_wait_ns;  // time spent in md5::file::read_at
+        };
+
+        struct Slot {
+            std::atomic<std::uint64_t> values[counter_count];
+            Slot *next;
+            char padding[64];  // keeps neighbouring slots out of this cache line without needing aligned new (c++17)
+        };
+
+        inline std::atomic<Slot*> &all_slots(void) noexcept
+        {
+            static std::atomic<Slot*> head{ nullptr };
+            return head;
+        }
+
+        // This thread's slot, or nullptr if it couldn't be allocated (the
+        // work is then left uncounted rather than failing the hashing)
+        inline Slot *this_thread_slot(void) noexcept
+        {
+            thread_local Slot *slot = nullptr;
+            if ( nullptr == slot )
+            {
+                slot = new (std::nothrow) Slot{};
+                if ( nullptr == slot ) return nullptr;
+                slot->next = all_slots().load(std::memory_order_relaxed);
+                while ( !all_slots().compare_exchange_weak(slot->next, slot, std::memory_order_release, std::memory_order_relaxed) ) {}
+            }
+            return slot;
+        }
+
+        inline void add(Counter const c, std::uint64_t const n) noexcept
+        {
+            Slot *const slot = this_thread_slot();
+            if ( nullptr == slot ) return;
+            // Only this thread writes to its slot, so no read-modify-write is needed
+            std::atomic<std::uint64_t> &value = slot->values[c];
+            value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+        }
+
+        inline Snapshot snapshot(void) noexcept
+        {
+            std::uint64_t totals[counter_count] = {};
+            for ( Slot const *p = all_slots().load(std::memory_order_acquire); nullptr != p; p = p->next )
+            {
+                for ( unsigned c = 0u; c < counter_count; ++c ) totals[c] += p->values[c].load(std::memory_order_relaxed);
+            }
+            return Snapshot{ totals[bytes], totals[blocks], totals[digests], totals[io_wait_ns] };
+        }
+
+        // Prometheus text exposition format
+        inline void write_prometheus(std::ostream &os)
+        {
+            Snapshot const s = snapshot();
+            os << "# HELP md5_bytes_total Bytes hashed at runtime.\n"
+                  "# TYPE md5_bytes_total counter\n"
+                  "md5_bytes_total " << s.bytes << "\n"
+                  "# HELP md5_blocks_total 64-byte blocks processed by the compression function.\n"
+                  "# TYPE md5_blocks_total counter\n"
+                  "md5_blocks_total{kernel=\"portable\"} " << s.blocks << "\n"
+                  "# HELP md5_digests_total Digests finalized.\n"
+                  "# TYPE md5_digests_total counter\n"
+                  "md5_digests_total " << s.digests << "\n"
+                  "# HELP md5_io_wait_seconds_total Time spent waiting for file reads.\n"
+                  "# TYPE md5_io_wait_seconds_total counter\n"
+                  "md5_io_wait_seconds_total " << s.io_wait_ns / 1e9 << "\n";
+        }
+
+    }  // close namespace 'metrics'
+#endif  // MD5_ENABLE_METRICS
+
+#ifdef MD5_ENABLE_USDT
+    // These are separate non-constexpr functions because an asm statement
+    // isn't allowed in a constexpr function until C++20
+    namespace usdt {
+
+        inline void context_create(void const *const ctx) noexcept
+        {
+            MD5_USDT_NOTE(context_create, "8@%[a0]", [a0] "nor" (ctx));
+        }
+
+        inline void transform_blocks(void const *const ctx, std::size_t const blocks) noexcept
+        {
+            MD5_USDT_NOTE(transform_blocks, "8@%[a0] 8@%[a1]", [a0] "nor" (ctx), [a1] "nor" (static_cast<unsigned long long>(blocks)));
+        }
+
+        inline void final(void const *const ctx, unsigned long long const bytes) noexcept
+        {
+            MD5_USDT_NOTE(final, "8@%[a0] 8@%[a1]", [a0] "nor" (ctx), [a1] "nor" (bytes));
+        }
+
+        inline void file_open(int const fd, char const *const path) noexcept
+        {
+            MD5_USDT_NOTE(file_open, "-4@%[a0] 8@%[a1]", [a0] "nor" (fd), [a1] "nor" (path));
+        }
+
+        inline void read_done(int const fd, unsigned long long const offset, unsigned long long const bytes) noexcept
+        {
+            MD5_USDT_NOTE(read_done, "-4@%[a0] 8@%[a1] 8@%[a2]", [a0] "nor" (fd), [a1] "nor" (offset), [a2] "nor" (bytes));
+        }
+
+    }  // close namespace 'usdt'
+#endif  // MD5_ENABLE_USDT
+
     namespace details {
 
         using std::array;
@@ -45,19 +236,20 @@ namespace md5 {
         constexpr UIntType constant_c = 64u;
         constexpr UIntType constant_L = constant_c / 4u;
 
-        constexpr size_t const_strlen(char const *str) noexcept
+        constexpr size_t const_strlen(char const *const str) noexcept
         {
 #ifdef __cpp_lib_is_constant_evaluated
-            if constexpr ( false == std::is_constant_evaluated() )
+            if ( false == std::is_constant_evaluated() )
             {
                 // This is just an optimisation for runtime use
                 return std::strlen(str);
             }
-            else
 #endif
-            {
-                return ('\0' == *str) ? 0u : const_strlen(++str) + 1u;
-            }
+            // Iterative rather than recursive so that long strings
+            // don't exhaust the compiler's constexpr depth limit
+            size_t len = 0u;
+            while ( '\0' != str[len] ) ++len;
+            return len;
         }
 
         constexpr Digest make_digest(array<UIntType, 4u> const &input) noexcept
@@ -73,61 +265,7 @@ namespace md5 {
             return digest;
         }
 
-        constexpr UIntType f(UIntType const b, UIntType const c, UIntType const d) noexcept
-        {
-            return (b & c) | (~b & d);
-        }
-
-        constexpr UIntType g(UIntType const b, UIntType const c, UIntType const d) noexcept
-        {
-            return (b & d) | (c & ~d);
-        }
-
-        constexpr UIntType h(UIntType const b, UIntType const c, UIntType const d) noexcept
-        {
-            return b ^ c ^ d;
-        }
-
-        constexpr UIntType i(UIntType const b, UIntType const c, UIntType const d) noexcept
-        {
-            return c ^ (b | ~d);
-        }
-
-        typedef UIntType (*Fn)(UIntType, UIntType, UIntType);
-        constexpr Fn array_of_funcptrs[4u] = { f, g, h, i };
-
-        constexpr UIntType block_G[constant_c] = {
-            0u, 1u,  2u,  3u,  4u,  5u,  6u,  7u,  8u,  9u, 10u, 11u, 12u, 13u, 14u, 15u,
-            1u, 6u, 11u,  0u,  5u, 10u, 15u,  4u,  9u, 14u,  3u,  8u, 13u,  2u,  7u, 12u,
-            5u, 8u, 11u, 14u,  1u,  4u,  7u, 10u, 13u,  0u,  3u,  6u,  9u, 12u, 15u,  2u,
-            0u, 7u, 14u,  5u, 12u, 3u,  10u,  1u,  8u, 15u,  6u, 13u,  4u, 11u,  2u,  9u
-        };
-
-        constexpr UIntType block_K[constant_c] = {
-            0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee,
-            0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
-            0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be,
-            0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
-            0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa,
-            0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
-            0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed,
-            0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
-            0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c,
-            0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
-            0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05,
-            0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
-            0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039,
-            0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
-            0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1,
-            0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391
-        };
-
-        constexpr UIntType block_S[constant_L] = {
-            7u, 12u, 17u, 22u,
-            5u,  9u, 14u, 20u,
-            4u, 11u, 16u, 23u,
-            6u, 10u, 15u, 21u
-        };
+        constexpr char zeros[constant_c] = {};
 
         constexpr char padding[constant_c] = {
       (char)0x80, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // 0x80 = -128 two's complement
@@ -140,24 +278,21 @@ namespace md5 {
             0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
         };
 
-        constexpr UIntType rotate(UIntType x, UIntType const n) noexcept
-        {
-            x &= 0xfffffffful;  // The only change needed for 64-Bit
-            return (x << n) | (x >> (32u - n));
-        }
-
-        constexpr UIntType t(Fn arg_func, UIntType a, UIntType b, UIntType c, UIntType d, UIntType x, UIntType s, UIntType ac) noexcept
+        template <typename Byte>
+        constexpr char unsigned to_byte(Byte const c) noexcept
         {
-            return b + rotate(a + arg_func(b, c, d) + x + ac, s);
+            static_assert( 1u == sizeof(Byte), "Input must be a sequence of bytes" );
+            return static_cast<char unsigned>(c);  // well-defined modulo conversion for plain char
         }
 
-        constexpr UIntType array_to_long_unsigned(char unsigned const *const data) noexcept
+        template <typename Byte>
+        constexpr UIntType array_to_long_unsigned(Byte const *const data) noexcept
         {
             return
-                (static_cast<UIntType>(data[3] & 0xFF) << 24u) |
-                (static_cast<UIntType>(data[2] & 0xFF) << 16u) |
-                (static_cast<UIntType>(data[1] & 0xFF) << 8u ) |
-                (static_cast<UIntType>(data[0] & 0xFF) << 0u );
+                (static_cast<UIntType>(to_byte(data[3]) & 0xFF) << 24u) |
+                (static_cast<UIntType>(to_byte(data[2]) & 0xFF) << 16u) |
+                (static_cast<UIntType>(to_byte(data[1]) & 0xFF) << 8u ) |
+                (static_cast<UIntType>(to_byte(data[0]) & 0xFF) << 0u );
         }
 
         struct Context {
@@ -170,29 +305,79 @@ namespace md5 {
                 , state{ 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476 }
                 , nl(0u)
                 , nh(0u)
-            {}
+            {
+                MD5_USDT_PROBE(context_create, this);
+            }
 
-            constexpr void append(char const *const data, size_t const len) noexcept
+            template <typename Byte>
+            constexpr void append(Byte const *const data, size_t const len) noexcept
             {
-                UIntType input[constant_L]{};
-                UIntType k = (nl >> 3u) & 0x3f;
-                UIntType const length = static_cast<UIntType>(len);
-                nl += length << 3u;
-                if ( nl < (length << 3u) ) ++nh;
-                nh += length >> 29u;
-                for ( char const *ptr = data; ptr != (data + len); ++ptr )
+                MD5_METRICS_ADD(bytes, len);
+                absorb(data, len);
+            }
+
+            // As 'append' but not counted in the metrics, used for the padding
+            //
+            // Whole 64-byte blocks are fed to 'transform' straight from the
+            // caller's memory, and only a trailing partial block is copied
+            // into 'buffer'. Together with the unrolled 'transform' this
+            // keeps the constexpr operation count per block low enough to
+            // hash large embedded resources at compile time (roughly half
+            // a megabyte within g++'s default -fconstexpr-ops-limit).
+            template <typename Byte>
+            constexpr void absorb(Byte const *data, size_t len) noexcept
+            {
+                size_t k = (nl >> 3u) & 0x3f;
+                count(len);
+
+                if ( 0u != k )
                 {
-                    buffer[k++] = static_cast<char unsigned>(static_cast<int16_t>(*ptr) + UCHAR_MAX + 1);
-                    if ( 0x40 != k ) continue;
-                    int j = 0;
-                    for ( int i = 0; i < constant_L; ++i )
-                    {
-                        input[i] = array_to_long_unsigned(&buffer[j]);
-                        j += 4;
-                    }
-                    transform(input);
-                    k = 0;
+                    size_t const room = constant_c - k;
+                    size_t const n = (len < room) ? len : room;
+                    for ( size_t i = 0u; i < n; ++i ) buffer[k++] = to_byte(data[i]);
+                    if ( constant_c != k ) return;
+                    transform_block(buffer);
+                    data += n;
+                    len  -= n;
                 }
+
+                if ( len >= constant_c ) MD5_USDT_PROBE(transform_blocks, this, len / constant_c);
+                for ( ; len >= constant_c; data += constant_c, len -= constant_c ) transform_block(data);
+
+                for ( size_t i = 0u; i < len; ++i ) buffer[i] = to_byte(data[i]);
+            }
+
+            // Adds 'len' bytes to the message length, kept in bits as two
+            // 32-bit halves whatever the width of UIntType
+            constexpr void count(std::uint64_t const len) noexcept
+            {
+                UIntType const low = static_cast<UIntType>((len << 3u) & 0xfffffffful);
+                nl = (nl + low) & 0xfffffffful;
+                if ( nl < low ) ++nh;
+                nh = (nh + static_cast<UIntType>((len >> 29u) & 0xfffffffful)) & 0xfffffffful;
+            }
+
+            // As 'append' with 'len' zero bytes, e.g. for the holes of a sparse
+            // file. Whole blocks go through 'transform' with a message known to
+            // be zero, so no memory is read and the message words drop out of
+            // every step.
+            constexpr void append_zeros(std::uint64_t len) noexcept
+            {
+                MD5_METRICS_ADD(bytes, len);
+                size_t const k = (nl >> 3u) & 0x3f;
+                if ( 0u != k )
+                {
+                    size_t const n = (len < constant_c - k) ? static_cast<size_t>(len) : constant_c - k;
+                    absorb(zeros, n);
+                    len -= n;
+                }
+
+                std::uint64_t const blocks = len / constant_c;
+                count(blocks * constant_c);
+                if ( 0u != blocks ) MD5_USDT_PROBE(transform_blocks, this, static_cast<size_t>(blocks));
+                for ( std::uint64_t i = 0u; i < blocks; ++i ) transform(ZeroWords{});
+
+                absorb(zeros, static_cast<size_t>(len % constant_c));
             }
 
             template <size_t N>
@@ -208,6 +393,23 @@ namespace md5 {
                 return *this;
             }
 
+            // Raw byte arrays (e.g. from #embed) have no null terminator,
+            // so every element is hashed
+            template <size_t N>
+            constexpr Context &operator<<( char unsigned const (&data)[N] ) noexcept
+            {
+                this->append( data, N );
+                return *this;
+            }
+
+            template <size_t N>
+            constexpr Context &operator<<( array<char unsigned, N> const &data ) noexcept
+            {
+                // array::data() isn't constexpr until C++17
+                this->append( (0u != N) ? &data[0u] : static_cast<char unsigned const*>(nullptr), N );
+                return *this;
+            }
+
 #ifdef __cpp_lib_string_view
             constexpr Context &operator<<(std::string_view const s) noexcept
             {
@@ -216,24 +418,118 @@ namespace md5 {
             }
 #endif
 
-            constexpr void transform(UIntType const (&input)[constant_L]) noexcept
+            template <typename Byte>
+            constexpr void transform_block(Byte const *block) noexcept
             {
-                UIntType a = std::get<0u>(state), b = std::get<1u>(state), c = std::get<2u>(state), d = std::get<3u>(state);
-                for ( unsigned r = 0u; r < 4u; ++r )
+                UIntType input[constant_L]{};
+                for ( unsigned i = 0u; i < constant_L; ++i, block += 4u )
                 {
-                    UIntType const *const pG = block_G + r * constant_L;
-                    UIntType const *const pS = block_S + r * 4u;
-                    UIntType const *const pK = block_K + r * constant_L;
-
-                    for ( unsigned i = 0; i < constant_L; ++i )
-                    {
-                        auto const new_b = t(array_of_funcptrs[r], a, b, c, d, input[pG[i]], pS[i % 4u], pK[i]);
-                        a = d;
-                        d = c;
-                        c = b;
-                        b = new_b;
-                    }
+                    input[i] =  static_cast<UIntType>(static_cast<char unsigned>(block[0]))
+                             | (static_cast<UIntType>(static_cast<char unsigned>(block[1])) <<  8u)
+                             | (static_cast<UIntType>(static_cast<char unsigned>(block[2])) << 16u)
+                             | (static_cast<UIntType>(static_cast<char unsigned>(block[3])) << 24u);
                 }
+                transform(input);
+            }
+
+            // Indexed like the message words of an all-zero block
+            struct ZeroWords {
+                constexpr UIntType operator[](size_t) const noexcept { return 0u; }
+            };
+
+            // 'x' is an array of the 16 message words, or ZeroWords
+            template <typename Words>
+            constexpr void transform(Words const &x) noexcept
+            {
+                MD5_METRICS_ADD(blocks, 1u);
+
+                UIntType a = std::get<0u>(state), b = std::get<1u>(state), c = std::get<2u>(state), d = std::get<3u>(state);
+
+                // The 64 steps are written out in full rather than looping over
+                // tables of function pointers, as each loop iteration and each
+                // indirect call counts against the constexpr evaluation limits
+#define MD5_CONSTEXPR_STEP(fn, a, b, c, d, xk, s, ac)             \
+                a = (a + fn(b, c, d) + (xk) + (ac)) & 0xfffffffful;   \
+                a = b + ((a << s) | (a >> (32u - s)))
+#define MD5_CONSTEXPR_F(b, c, d) ((d) ^ ((b) & ((c) ^ (d))))
+#define MD5_CONSTEXPR_G(b, c, d) ((c) ^ ((d) & ((b) ^ (c))))
+#define MD5_CONSTEXPR_H(b, c, d) ((b) ^ (c) ^ (d))
+#define MD5_CONSTEXPR_I(b, c, d) ((c) ^ ((b) | ~(d)))
+
+                MD5_CONSTEXPR_STEP(MD5_CONSTEXPR_F, a, b, c, d, x[ 0], 7u, 0xd76aa478);
+                MD5_CONSTEXPR_STEP(MD5_CONSTEXPR_F, d, a, b, c, x[ 1],12u, 0xe8c7b756);
+                MD5_CONSTEXPR_STEP(MD5_CONSTEXPR_F, c, d, a, b, x[ 2],17u, 0x242070db);
+                MD5_CONSTEXPR_STEP(MD5_CONSTEXPR_F, b, c, d, a, x[ 3],22u, 0xc1bdceee);
+                MD5_CONSTEXPR_STEP(MD5_CONSTEXPR_F, a, b, c, d, x[ 4], 7u, 0xf57c0faf);
+                MD5_CONSTEXPR_STEP(MD5_CONSTEXPR_F, d, a, b, c, x[ 5],12u, 0x4787c62a);
+                MD5_CONSTEXPR_STEP(MD5_CONSTEXPR_F, c, d, a, b, x[ 6],17u, 0xa8304613);
+                MD5_CONSTEXPR_STEP(MD5_CONSTEXPR_F, b, c, d, a, x[ 7],22u, 0xfd469501);
+                MD5_CONSTEXPR_STEP(MD5_CONSTEXPR_F, a, b, c, d, x[ 8], 7u, 0x698098d8);
+                MD5_CONSTEXPR_STEP(MD5_CONSTEXPR_F, d, a, b, c, x[ 9],12u, 0x8b44f7af);
+                MD5_CONSTEXPR_STEP(MD5_CONSTEXPR_F, c, d, a, b, x[10],17u, 0xffff5bb1);
+                MD5_CONSTEXPR_STEP(MD5_CONSTEXPR_F, b, c, d, a, x[11],22u, 0x895cd7be);
+                MD5_CONSTEXPR_STEP(MD5_CONSTEXPR_F, a, b, c, d, x[12], 7u, 0x6b901122);
+                MD5_CONSTEXPR_STEP(MD5_CONSTEXPR_F, d, a, b, c, x[13],12u, 0xfd987193);
+                MD5_CONSTEXPR_STEP(MD5_CONSTEXPR_F, c, d, a, b, x[14],17u, 0xa679438e);
+                MD5_CONSTEXPR_STEP(MD5_CONSTEXPR_F, b, c, d, a, x[15],22u, 0x49b40821);
+
+                MD5_CONSTEXPR_STEP(MD5_CONSTEXPR_G, a, b, c, d, x[ 1], 5u, 0xf61e2562);
+                MD5_CONSTEXPR_STEP(MD5_CONSTEXPR_G, d, a, b, c, x[ 6], 9u, 0xc040b340);
+                MD5_CONSTEXPR_STEP(MD5_CONSTEXPR_G, c, d, a, b, x[11],14u, 0x265e5a51);
+                MD5_CONSTEXPR_STEP(MD5_CONSTEXPR_G, b, c, d, a, x[ 0],20u, 0xe9b6c7aa);
+                MD5_CONSTEXPR_STEP(MD5_CONSTEXPR_G, a, b, c, d, x[ 5], 5u, 0xd62f105d);
+                MD5_CONSTEXPR_STEP(MD5_CONSTEXPR_G, d, a, b, c, x[10], 9u, 0x02441453);
+                MD5_CONSTEXPR_STEP(MD5_CONSTEXPR_G, c, d, a, b, x[15],14u, 0xd8a1e681);
+                MD5_CONSTEXPR_STEP(MD5_CONSTEXPR_G, b, c, d, a, x[ 4],20u, 0xe7d3fbc8);
+                MD5_CONSTEXPR_STEP(MD5_CONSTEXPR_G, a, b, c, d, x[ 9], 5u, 0x21e1cde6);
+                MD5_CONSTEXPR_STEP(MD5_CONSTEXPR_G, d, a, b, c, x[14], 9u, 0xc33707d6);
+                MD5_CONSTEXPR_STEP(MD5_CONSTEXPR_G, c, d, a, b, x[ 3],14u, 0xf4d50d87);
+                MD5_CONSTEXPR_STEP(MD5_CONSTEXPR_G, b, c, d, a, x[ 8],20u, 0x455a14ed);
+                MD5_CONSTEXPR_STEP(MD5_CONSTEXPR_G, a, b, c, d, x[13], 5u, 0xa9e3e905);
+                MD5_CONSTEXPR_STEP(MD5_CONSTEXPR_G, d, a, b, c, x[ 2], 9u, 0xfcefa3f8);
+                MD5_CONSTEXPR_STEP(MD5_CONSTEXPR_G, c, d, a, b, x[ 7],14u, 0x676f02d9);
+                MD5_CONSTEXPR_STEP(MD5_CONSTEXPR_G, b, c, d, a, x[12],20u, 0x8d2a4c8a);
+
+                MD5_CONSTEXPR_STEP(MD5_CONSTEXPR_H, a, b, c, d, x[ 5], 4u, 0xfffa3942);
+                MD5_CONSTEXPR_STEP(MD5_CONSTEXPR_H, d, a, b, c, x[ 8],11u, 0x8771f681);
+                MD5_CONSTEXPR_STEP(MD5_CONSTEXPR_H, c, d, a, b, x[11],16u, 0x6d9d6122);
+                MD5_CONSTEXPR_STEP(MD5_CONSTEXPR_H, b, c, d, a, x[14],23u, 0xfde5380c);
+                MD5_CONSTEXPR_STEP(MD5_CONSTEXPR_H, a, b, c, d, x[ 1], 4u, 0xa4beea44);
+                MD5_CONSTEXPR_STEP(MD5_CONSTEXPR_H, d, a, b, c, x[ 4],11u, 0x4bdecfa9);
+                MD5_CONSTEXPR_STEP(MD5_CONSTEXPR_H, c, d, a, b, x[ 7],16u, 0xf6bb4b60);
+                MD5_CONSTEXPR_STEP(MD5_CONSTEXPR_H, b, c, d, a, x[10],23u, 0xbebfbc70);
+                MD5_CONSTEXPR_STEP(MD5_CONSTEXPR_H, a, b, c, d, x[13], 4u, 0x289b7ec6);
+                MD5_CONSTEXPR_STEP(MD5_CONSTEXPR_H, d, a, b, c, x[ 0],11u, 0xeaa127fa);
+                MD5_CONSTEXPR_STEP(MD5_CONSTEXPR_H, c, d, a, b, x[ 3],16u, 0xd4ef3085);
+                MD5_CONSTEXPR_STEP(MD5_CONSTEXPR_H, b, c, d, a, x[ 6],23u, 0x04881d05);
+                MD5_CONSTEXPR_STEP(MD5_CONSTEXPR_H, a, b, c, d, x[ 9], 4u, 0xd9d4d039);
+                MD5_CONSTEXPR_STEP(MD5_CONSTEXPR_H, d, a, b, c, x[12],11u, 0xe6db99e5);
+                MD5_CONSTEXPR_STEP(MD5_CONSTEXPR_H, c, d, a, b, x[15],16u, 0x1fa27cf8);
+                MD5_CONSTEXPR_STEP(MD5_CONSTEXPR_H, b, c, d, a, x[ 2],23u, 0xc4ac5665);
+
+                MD5_CONSTEXPR_STEP(MD5_CONSTEXPR_I, a, b, c, d, x[ 0], 6u, 0xf4292244);
+                MD5_CONSTEXPR_STEP(MD5_CONSTEXPR_I, d, a, b, c, x[ 7],10u, 0x432aff97);
+                MD5_CONSTEXPR_STEP(MD5_CONSTEXPR_I, c, d, a, b, x[14],15u, 0xab9423a7);
+                MD5_CONSTEXPR_STEP(MD5_CONSTEXPR_I, b, c, d, a, x[ 5],21u, 0xfc93a039);
+                MD5_CONSTEXPR_STEP(MD5_CONSTEXPR_I, a, b, c, d, x[12], 6u, 0x655b59c3);
+                MD5_CONSTEXPR_STEP(MD5_CONSTEXPR_I, d, a, b, c, x[ 3],10u, 0x8f0ccc92);
+                MD5_CONSTEXPR_STEP(MD5_CONSTEXPR_I, c, d, a, b, x[10],15u, 0xffeff47d);
+                MD5_CONSTEXPR_STEP(MD5_CONSTEXPR_I, b, c, d, a, x[ 1],21u, 0x85845dd1);
+                MD5_CONSTEXPR_STEP(MD5_CONSTEXPR_I, a, b, c, d, x[ 8], 6u, 0x6fa87e4f);
+                MD5_CONSTEXPR_STEP(MD5_CONSTEXPR_I, d, a, b, c, x[15],10u, 0xfe2ce6e0);
+                MD5_CONSTEXPR_STEP(MD5_CONSTEXPR_I, c, d, a, b, x[ 6],15u, 0xa3014314);
+                MD5_CONSTEXPR_STEP(MD5_CONSTEXPR_I, b, c, d, a, x[13],21u, 0x4e0811a1);
+                MD5_CONSTEXPR_STEP(MD5_CONSTEXPR_I, a, b, c, d, x[ 4], 6u, 0xf7537e82);
+                MD5_CONSTEXPR_STEP(MD5_CONSTEXPR_I, d, a, b, c, x[11],10u, 0xbd3af235);
+                MD5_CONSTEXPR_STEP(MD5_CONSTEXPR_I, c, d, a, b, x[ 2],15u, 0x2ad7d2bb);
+                MD5_CONSTEXPR_STEP(MD5_CONSTEXPR_I, b, c, d, a, x[ 9],21u, 0xeb86d391);
+
+#undef MD5_CONSTEXPR_STEP
+#undef MD5_CONSTEXPR_F
+#undef MD5_CONSTEXPR_G
+#undef MD5_CONSTEXPR_H
+#undef MD5_CONSTEXPR_I
+
                 std::get<0u>(state) += a;
                 std::get<1u>(state) += b;
                 std::get<2u>(state) += c;
@@ -246,8 +542,9 @@ namespace md5 {
                 unsigned const k = (nl >> 3u) & 0x3f;
                 input[14] = nl;
                 input[15] = nh;
+                MD5_USDT_PROBE(final, this, ((static_cast<unsigned long long>(nh) << 32u) | (nl & 0xfffffffful)) >> 3u);
 
-                append(padding, k < 56u ? 56u - k : 120u - k);
+                absorb(padding, k < 56u ? 56u - k : 120u - k);
 
                 unsigned j = 0u;
                 for ( unsigned i = 0u; i < 14u; ++i )
@@ -257,6 +554,7 @@ namespace md5 {
                 }
 
                 transform(input);
+                MD5_METRICS_ADD(digests, 1u);
                 return make_digest(state);
             }
         };
@@ -280,6 +578,33 @@ namespace md5 {
     }
 #endif //__cpp_lib_string_view
 
+    constexpr Digest compute(char const *const data, std::size_t const len) noexcept
+    {
+        details::Context ctx;
+        ctx.append(data, len);
+        return ctx.final();
+    }
+
+    constexpr Digest compute(char unsigned const *const data, std::size_t const len) noexcept
+    {
+        details::Context ctx;
+        ctx.append(data, len);
+        return ctx.final();
+    }
+
+    // For binary resources, e.g. "static constexpr char unsigned blob[] = { #embed "fw.bin" };"
+    template <std::size_t N>
+    constexpr Digest compute( char unsigned const (&data)[N] ) noexcept
+    {
+        return (details::Context() << data).final();
+    }
+
+    template <std::size_t N>
+    constexpr Digest compute( std::array<char unsigned, N> const &data ) noexcept
+    {
+        return (details::Context() << data).final();
+    }
+
 /*
     constexpr __uint128_t to_uint128(Digest const &arr)
     {
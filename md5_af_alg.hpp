@@ -0,0 +1,278 @@
+#ifndef HEADER_INCLUSION_GUARD_61180943357219086672455130498217043969528
+#define HEADER_INCLUSION_GUARD_61180943357219086672455130498217043969528
+
+// MD5 computed by the Linux kernel through an AF_ALG socket, for hosts
+// where the kernel has a faster implementation (e.g. a crypto
+// accelerator) than the one in md5.hpp.
+//
+// File pages are spliced into the socket, so they are hashed without
+// ever being copied to user space. Whether that's a win depends on the
+// host, so calibrate() times both engines on the same data, and
+// Engine::automatic uses the faster one as measured once per process.
+// When the kernel has no AF_ALG or no "md5" (it's often left out of
+// kernel configurations, or blocked by seccomp in containers) all of
+// this falls back to md5::details::Context.
+//
+// af_alg::Context throws std::system_error if the kernel engine isn't
+// there; compute() only does so if Engine::kernel was asked for
+// explicitly.
+
+#include <cerrno>        // errno
+#include <chrono>        // steady_clock
+#include <cstdint>       // uint64_t
+#include <cstdio>        // tmpfile, fileno, fclose
+#include <cstring>       // strcpy
+#include <system_error>  // system_error
+#include <vector>        // vector
+#include <unistd.h>      // read, close
+#ifdef __linux__
+#   include <linux/if_alg.h>  // sockaddr_alg
+#   include <sys/socket.h>    // socket, bind, accept4, send
+#endif
+#include "md5.hpp"
+#include "md5_file.hpp"
+
+namespace md5 {
+    namespace af_alg {
+
+        namespace details {
+
+            // A socket bound to the kernel's "md5", or -1 with errno set
+            inline int open_md5(void) noexcept
+            {
+#ifdef __linux__
+                int const s = ::socket(AF_ALG, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+                if ( -1 == s ) return -1;
+                sockaddr_alg sa = {};
+                sa.salg_family = AF_ALG;
+                std::strcpy(reinterpret_cast<char *>(sa.salg_type), "hash");
+                std::strcpy(reinterpret_cast<char *>(sa.salg_name), "md5");
+                if ( 0 != ::bind(s, reinterpret_cast<sockaddr *>(&sa), sizeof sa) )
+                {
+                    int const error = errno;
+                    ::close(s);
+                    errno = error;
+                    return -1;
+                }
+                return s;
+#else
+                errno = ENOSYS;
+                return -1;
+#endif
+            }
+        }
+
+        inline bool available(void) noexcept
+        {
+            int const s = details::open_md5();
+            if ( -1 == s ) return false;
+            ::close(s);
+            return true;
+        }
+
+#ifdef __linux__
+        // The same interface as md5::details::Context, computed by the kernel.
+        // After final() it starts over with the next append().
+        class Context {
+        public:
+            Context(void) : tfm_(details::open_md5())
+            {
+                if ( -1 == tfm_.get() ) throw std::system_error(errno, std::generic_category(), "AF_ALG md5");
+                int const op = ::accept4(tfm_.get(), nullptr, nullptr, SOCK_CLOEXEC);
+                if ( -1 == op ) throw std::system_error(errno, std::generic_category(), "AF_ALG accept");
+                op_ = file::Fd(op);
+            }
+
+            void append(void const *const data, std::size_t len)
+            {
+                char const *p = static_cast<char const *>(data);
+                while ( 0u != len )
+                {
+                    ssize_t const n = ::send(op_.get(), p, len, MSG_MORE);
+                    if ( n < 0 && EINTR == errno ) continue;
+                    if ( n <= 0 ) throw std::system_error((n < 0) ? errno : EIO, std::generic_category(), "AF_ALG send");
+                    p += n;
+                    len -= static_cast<std::size_t>(n);
+                }
+            }
+
+            Digest final(void)
+            {
+                // Everything so far went with MSG_MORE; a send without it ends the message
+                while ( ::send(op_.get(), nullptr, 0u, 0) < 0 )
+                {
+                    if ( EINTR != errno ) throw std::system_error(errno, std::generic_category(), "AF_ALG send");
+                }
+                Digest d;
+                for ( std::size_t got = 0u; got < Digest::count; )
+                {
+                    ssize_t const n = ::read(op_.get(), d.b + got, Digest::count - got);
+                    if ( n < 0 && EINTR == errno ) continue;
+                    if ( n <= 0 ) throw std::system_error((n < 0) ? errno : EIO, std::generic_category(), "AF_ALG read");
+                    got += static_cast<std::size_t>(n);
+                }
+                return d;
+            }
+
+            // The operation socket, for splicing into
+            int socket(void) const noexcept { return op_.get(); }
+
+        private:
+            file::Fd tfm_, op_;
+        };
+
+        // The kernel's MD5 of 'len' bytes at 'offset' (or up to the end of
+        // the file), moved into the socket with splice() where the file
+        // allows it and with pread() and send() where it doesn't
+        inline Digest compute_range(int const fd, std::uint64_t const offset, std::uint64_t const len)
+        {
+            Context ctx;
+            std::uint64_t done = 0u;
+#ifdef SPLICE_F_MOVE
+            file::Pipe pipe;
+            while ( done < len )
+            {
+                loff_t at = static_cast<loff_t>(offset + done);
+                std::uint64_t const want = (len - done < file::buffer_size) ? len - done : file::buffer_size;
+                ssize_t const n = ::splice(fd, &at, pipe.write.get(), nullptr, static_cast<std::size_t>(want), SPLICE_F_MORE);
+                if ( n < 0 && EINTR == errno ) continue;
+                if ( n < 0 && 0u == done && file::splice_unsupported(errno) ) break;
+                if ( n < 0 ) throw std::system_error(errno, std::generic_category(), "splice");
+                if ( 0 == n ) return ctx.final();
+
+                bool copied = false;
+                for ( std::size_t moved = 0u; moved < static_cast<std::size_t>(n); )
+                {
+                    ssize_t const m = ::splice(pipe.read.get(), nullptr, ctx.socket(), nullptr, static_cast<std::size_t>(n) - moved, SPLICE_F_MORE);
+                    if ( m < 0 && EINTR == errno ) continue;
+                    if ( m < 0 && 0u == done && 0u == moved && file::splice_unsupported(errno) )
+                    {
+                        // The socket won't take pages: hand over what's in the pipe by
+                        // copy, and the rest of the file with pread() below
+                        std::vector<char unsigned> buffer(static_cast<std::size_t>(n));
+                        for ( std::size_t got = 0u; got < buffer.size(); )
+                        {
+                            got += file::read_some(pipe.read.get(), buffer.data() + got, buffer.size() - got);
+                        }
+                        ctx.append(buffer.data(), buffer.size());
+                        copied = true;
+                        break;
+                    }
+                    if ( m <= 0 ) throw std::system_error((m < 0) ? errno : EIO, std::generic_category(), "splice");
+                    moved += static_cast<std::size_t>(m);
+                }
+                done += static_cast<std::uint64_t>(n);
+                if ( copied ) break;
+            }
+#endif
+            std::vector<char unsigned> buffer(file::buffer_size);
+            while ( done < len )
+            {
+                std::size_t const want = static_cast<std::size_t>((len - done < buffer.size()) ? len - done : buffer.size());
+                std::size_t const n = file::read_at(fd, buffer.data(), want, offset + done);
+                ctx.append(buffer.data(), n);
+                done += n;
+                if ( n < want ) break;
+            }
+            return ctx.final();
+        }
+#endif
+
+        enum class Engine { automatic, kernel, user };
+
+        struct Calibration {
+            bool kernel_available = false;
+            double kernel = 0.0, user = 0.0;  // bytes per second
+        };
+
+        // Times both engines hashing the same 'bytes' of file data, the
+        // best of two runs each, so the file is in the page cache for both
+        inline Calibration calibrate(std::size_t const bytes = 16u * 1024u * 1024u)
+        {
+            Calibration c;
+#ifdef __linux__
+            c.kernel_available = available();
+            if ( !c.kernel_available ) return c;
+
+            std::FILE *const f = std::tmpfile();
+            if ( nullptr == f ) throw std::system_error(errno, std::generic_category(), "tmpfile");
+            int const fd = ::fileno(f);
+            try
+            {
+                std::vector<char unsigned> block(file::buffer_size);
+                std::uint64_t x = 0x9E3779B97F4A7C15u;
+                for ( char unsigned &b : block ) { x ^= x << 13u; x ^= x >> 7u; x ^= x << 17u; b = static_cast<char unsigned>(x); }
+                for ( std::size_t done = 0u; done < bytes; done += block.size() )
+                {
+                    std::size_t const n = (bytes - done < block.size()) ? bytes - done : block.size();
+                    if ( static_cast<ssize_t>(n) != ::pwrite(fd, block.data(), n, static_cast<off_t>(done)) ) throw std::system_error(errno, std::generic_category(), "pwrite");
+                }
+
+                using Clock = std::chrono::steady_clock;
+                auto const time = [&](auto const &fn) {
+                    double best = 0.0;
+                    for ( int run = 0; run < 2; ++run )
+                    {
+                        Clock::time_point const start = Clock::now();
+                        fn();
+                        double const seconds = std::chrono::duration<double>(Clock::now() - start).count();
+                        if ( 0 == run || seconds < best ) best = seconds;
+                    }
+                    return (best > 0.0) ? static_cast<double>(bytes) / best : 0.0;
+                };
+                c.kernel = time([&]() { compute_range(fd, 0u, bytes); });
+                c.user = time([&]() { file::compute_range(fd, 0u, bytes); });
+            }
+            catch ( std::system_error const & )
+            {
+                c.kernel_available = false;  // e.g. the socket works but refuses data
+            }
+            std::fclose(f);
+#else
+            (void)bytes;
+#endif
+            return c;
+        }
+
+        // The faster engine on this host, calibrated on first use
+        inline Engine preferred(void)
+        {
+            static Engine const engine = []() {
+                Calibration const c = calibrate();
+                return (c.kernel_available && c.kernel > c.user) ? Engine::kernel : Engine::user;
+            }();
+            return engine;
+        }
+
+        inline Digest compute(int const fd, Engine engine = Engine::automatic)
+        {
+            bool const fall_back = (Engine::automatic == engine);
+            if ( fall_back ) engine = preferred();
+#ifdef __linux__
+            if ( Engine::kernel == engine )
+            {
+                try
+                {
+                    return compute_range(fd, 0u, ~std::uint64_t(0u));
+                }
+                catch ( std::system_error const & )
+                {
+                    if ( !fall_back ) throw;
+                }
+            }
+#else
+            if ( Engine::kernel == engine && !fall_back ) throw std::system_error(ENOSYS, std::generic_category(), "AF_ALG md5");
+#endif
+            return file::compute(fd);
+        }
+
+        inline Digest compute(char const *const path, Engine const engine = Engine::automatic)
+        {
+            file::Fd const fd = file::open_read(path);
+            return compute(fd.get(), engine);
+        }
+
+    }  // close namespace 'af_alg'
+}  // close namespace 'md5'
+
+#endif  // HEADER_INCLUSION_GUARD
@@ -0,0 +1,440 @@
+#ifndef HEADER_INCLUSION_GUARD_28850179306146637512269408181739450276613
+#define HEADER_INCLUSION_GUARD_28850179306146637512269408181739450276613
+
+// The MD5 of every file in a tar or zip archive, read as a stream (e.g.
+// from a pipe) without extracting anything.
+//
+// Headers are parsed as they come and each member's bytes are hashed
+// straight out of the read buffer, so no member is ever held in memory
+// or written anywhere, and the archive is read exactly once.
+//
+//   tar: ustar, pax ('x' records for path and size) and GNU long names,
+//        with base-256 sizes. Only regular files are reported.
+//   zip: the local headers, in order, including Zip64 sizes and data
+//        descriptors. Members may be stored, or deflated when built with
+//        MD5_ENABLE_ZLIB (link with -lz). Encrypted members and other
+//        methods are reported as skipped.
+//
+// Malformed archives throw std::runtime_error, read errors
+// std::system_error.
+
+#include <cerrno>        // errno
+#include <cstdint>       // uint64_t
+#include <cstdlib>       // strtoull
+#include <cstring>       // memcmp, memcpy, memmove
+#include <functional>    // function
+#include <stdexcept>     // runtime_error
+#include <string>        // string, to_string
+#include <system_error>  // system_error
+#include <utility>       // move
+#include <vector>        // vector
+#include <unistd.h>      // read
+#include "md5.hpp"
+#include "md5_file.hpp"
+
+#ifdef MD5_ENABLE_ZLIB
+#   if defined(__has_include)
+#       if !__has_include(<zlib.h>)
+#           error "MD5_ENABLE_ZLIB needs zlib.h"
+#       endif
+#   endif
+#   include <zlib.h>  // inflate
+#endif
+
+namespace md5 {
+    namespace archive {
+
+        struct Member {
+            std::string name;
+            std::uint64_t size = 0u;  // uncompressed bytes hashed
+            Digest digest = {};
+            bool hashed = false;      // false for members skipped, see 'note'
+            std::string note;
+        };
+
+        using Callback = std::function<void(Member const &)>;
+
+        // Fills the buffer with up to 'len' bytes and returns how many, 0 at the end
+        using Source = std::function<std::size_t(char unsigned *, std::size_t)>;
+
+        // Buffered reading from a Source, with direct access to what's
+        // buffered so that payloads can be hashed in place
+        class Reader {
+        public:
+            explicit Reader(Source source) : source_(std::move(source)), buffer_(file::buffer_size) {}
+
+            explicit Reader(int const fd) : Reader(Source([fd](char unsigned *const buf, std::size_t const len) {
+                for ( ;; )
+                {
+                    ssize_t const n = ::read(fd, buf, len);
+                    if ( n < 0 && EINTR == errno ) continue;
+                    if ( n < 0 ) throw std::system_error(errno, std::generic_category(), "read");
+                    return static_cast<std::size_t>(n);
+                }
+            })) {}
+
+            // Makes at least 'n' bytes (n <= buffer size) available and
+            // returns how many are, fewer only at the end of the stream
+            std::size_t fill(std::size_t const n)
+            {
+                if ( end_ - begin_ >= n || eof_ ) return end_ - begin_;
+                if ( 0u != begin_ )
+                {
+                    std::memmove(buffer_.data(), buffer_.data() + begin_, end_ - begin_);
+                    end_ -= begin_;
+                    begin_ = 0u;
+                }
+                while ( end_ < n && !eof_ )
+                {
+                    std::size_t const got = source_(buffer_.data() + end_, buffer_.size() - end_);
+                    if ( 0u == got ) eof_ = true;
+                    end_ += got;
+                }
+                return end_ - begin_;
+            }
+
+            char unsigned const *data(void) const noexcept { return buffer_.data() + begin_; }
+            std::size_t available(void) const noexcept { return end_ - begin_; }
+            void consume(std::size_t const n) noexcept { begin_ += n; offset_ += n; }
+            std::uint64_t offset(void) const noexcept { return offset_; }
+
+            void read(void *const out, std::size_t const n)
+            {
+                if ( fill(n) < n ) throw std::runtime_error("md5::archive: truncated archive");
+                std::memcpy(out, data(), n);
+                consume(n);
+            }
+
+            // Passes the next 'n' bytes to fn(data, len) in pieces as they're buffered
+            template <typename Fn>
+            void stream(std::uint64_t n, Fn const &fn)
+            {
+                while ( 0u != n )
+                {
+                    if ( 0u == fill(1u) ) throw std::runtime_error("md5::archive: truncated archive");
+                    std::size_t const piece = (n < available()) ? static_cast<std::size_t>(n) : available();
+                    fn(data(), piece);
+                    consume(piece);
+                    n -= piece;
+                }
+            }
+
+            void skip(std::uint64_t const n)
+            {
+                stream(n, [](char unsigned const *, std::size_t) {});
+            }
+
+        private:
+            Source source_;
+            std::vector<char unsigned> buffer_;
+            std::size_t begin_ = 0u, end_ = 0u;
+            std::uint64_t offset_ = 0u;
+            bool eof_ = false;
+        };
+
+        namespace details {
+
+            inline std::uint64_t le(char unsigned const *const p, unsigned const bytes) noexcept
+            {
+                std::uint64_t v = 0u;
+                for ( unsigned i = bytes; i-- > 0u; ) v = (v << 8u) | p[i];
+                return v;
+            }
+
+            // A numeric tar field: octal, or base-256 when the top bit is set
+            inline std::uint64_t tar_number(char unsigned const *const p, std::size_t const len)
+            {
+                std::uint64_t v = 0u;
+                if ( 0u != (p[0] & 0x80u) )
+                {
+                    if ( 0u != (p[0] & 0x40u) ) throw std::runtime_error("md5::archive: negative size in tar header");
+                    v = p[0] & 0x3fu;
+                    for ( std::size_t i = 1u; i < len; ++i ) v = (v << 8u) | p[i];
+                    return v;
+                }
+                std::size_t i = 0u;
+                while ( i < len && ' ' == p[i] ) ++i;
+                for ( ; i < len && p[i] >= '0' && p[i] <= '7'; ++i ) v = (v << 3u) | (p[i] - '0');
+                return v;
+            }
+
+            inline std::string tar_string(char unsigned const *const p, std::size_t const len)
+            {
+                std::size_t n = 0u;
+                while ( n < len && '\0' != p[n] ) ++n;
+                return std::string(reinterpret_cast<char const *>(p), n);
+            }
+
+            // Applies the "path" and "size" records of a pax header
+            inline void pax_records(std::string const &records, std::string &path, std::uint64_t &size, bool &has_size)
+            {
+                for ( std::size_t at = 0u; at < records.size(); )
+                {
+                    std::size_t const space = records.find(' ', at);
+                    if ( std::string::npos == space ) break;
+                    std::uint64_t const length = std::strtoull(records.c_str() + at, nullptr, 10);
+                    if ( 0u == length || at + length > records.size() ) throw std::runtime_error("md5::archive: bad pax record");
+                    std::string const record = records.substr(space + 1u, static_cast<std::size_t>(at + length - space - 2u));  // without the newline
+                    std::size_t const equals = record.find('=');
+                    if ( std::string::npos != equals )
+                    {
+                        std::string const key = record.substr(0u, equals);
+                        if ( "path" == key ) path = record.substr(equals + 1u);
+                        if ( "size" == key ) { size = std::strtoull(record.c_str() + equals + 1u, nullptr, 10); has_size = true; }
+                    }
+                    at += static_cast<std::size_t>(length);
+                }
+            }
+
+            inline bool zip_header(std::uint64_t const signature) noexcept
+            {
+                return 0x04034b50u == signature || 0x02014b50u == signature || 0x06054b50u == signature;
+            }
+
+            // Whether a stored member with its sizes in a data descriptor is
+            // empty, i.e. the descriptor follows right away: CRC-32 and sizes
+            // all 0, with or without the signature, then the next header
+            inline bool empty_stored(Reader &in, bool const zip64)
+            {
+                std::size_t const fields = zip64 ? 20u : 12u;
+                std::size_t const have = in.fill(4u + fields + 4u);
+                char unsigned const *const p = in.data();
+                std::size_t const at = (have >= 4u && 0x08074b50u == le(p, 4u)) ? 4u : 0u;
+                if ( have < at + fields ) return false;
+                for ( std::size_t i = 0u; i < fields; ++i ) if ( 0u != p[at + i] ) return false;
+                return have >= at + fields + 4u && zip_header(le(p + at + fields, 4u));
+            }
+
+            // Skips a stored member whose size is only in the data descriptor
+            // after it, up to a descriptor signature with that size followed
+            // by the next header
+            inline std::uint64_t skip_stored(Reader &in, bool const zip64)
+            {
+                std::size_t const fields = zip64 ? 20u : 12u;
+                std::size_t const need = 4u + fields + 4u;
+                for ( std::uint64_t passed = 0u;; )
+                {
+                    if ( in.fill(need) < need ) throw std::runtime_error("md5::archive: truncated zip");
+                    char unsigned const *const p = in.data();
+                    std::size_t const last = in.available() - need;
+                    std::size_t i = 0u;
+                    for ( ; i <= last; ++i )
+                    {
+                        if ( 0x08074b50u == le(p + i, 4u) && passed + i == le(p + i + 8u, zip64 ? 8u : 4u) && zip_header(le(p + i + 4u + fields, 4u)) ) break;
+                    }
+                    in.consume(i);
+                    passed += i;
+                    if ( i <= last ) return passed;
+                }
+            }
+
+            inline void skip_descriptor(Reader &in, bool const zip64)
+            {
+                if ( in.fill(4u) >= 4u && 0x08074b50u == le(in.data(), 4u) ) in.consume(4u);  // the signature is optional
+                in.skip(zip64 ? 20u : 12u);  // CRC-32 and both sizes
+            }
+
+            inline std::string read_string(Reader &in, std::uint64_t const n)
+            {
+                if ( n > 16u * 1024u * 1024u ) throw std::runtime_error("md5::archive: header too large");
+                std::string s;
+                in.stream(n, [&](char unsigned const *const p, std::size_t const len) { s.append(reinterpret_cast<char const *>(p), len); });
+                return s;
+            }
+        }
+
+        inline void hash_tar(Reader &in, Callback const &callback)
+        {
+            std::string long_name, pax_path;
+            std::uint64_t pax_size = 0u;
+            bool has_pax_size = false;
+
+            for ( ;; )
+            {
+                char unsigned header[512];
+                if ( 0u == in.fill(sizeof header) ) return;  // no end blocks, but nothing cut short either
+                in.read(header, sizeof header);
+
+                static char unsigned const zero_block[512] = {};
+                if ( 0 == std::memcmp(header, zero_block, sizeof header) ) return;  // end of archive
+
+                std::uint64_t sum = 0u;
+                for ( std::size_t i = 0u; i < sizeof header; ++i ) sum += (i >= 148u && i < 156u) ? ' ' : header[i];
+                if ( sum != details::tar_number(header + 148u, 8u) ) throw std::runtime_error("md5::archive: bad tar header checksum at offset " + std::to_string(in.offset() - sizeof header));
+
+                std::uint64_t size = details::tar_number(header + 124u, 12u);
+                char const type = static_cast<char>(header[156]);
+                std::uint64_t const padding = (512u - size % 512u) % 512u;
+
+                if ( 'x' == type || 'L' == type )  // applies to the next member
+                {
+                    std::string const data = details::read_string(in, size);
+                    in.skip(padding);
+                    if ( 'x' == type ) details::pax_records(data, pax_path, pax_size, has_pax_size);
+                    else long_name = details::tar_string(reinterpret_cast<char unsigned const *>(data.data()), data.size());
+                    continue;
+                }
+
+                std::string name = details::tar_string(header, 100u);
+                if ( 0 == std::memcmp(header + 257u, "ustar", 6u) && '\0' != header[345] ) name = details::tar_string(header + 345u, 155u) + '/' + name;
+                if ( !long_name.empty() ) name = long_name;
+                if ( !pax_path.empty() ) name = pax_path;
+                if ( has_pax_size ) size = pax_size;
+                long_name.clear();
+                pax_path.clear();
+                has_pax_size = false;
+
+                std::uint64_t const pad = (512u - size % 512u) % 512u;
+                if ( '0' == type || '\0' == type || '7' == type )
+                {
+                    Member m;
+                    m.name = std::move(name);
+                    m.size = size;
+                    ::md5::details::Context ctx;
+                    in.stream(size, [&](char unsigned const *const p, std::size_t const len) { ctx.append(p, len); });
+                    m.digest = ctx.final();
+                    m.hashed = true;
+                    callback(m);
+                }
+                else
+                {
+                    in.skip(size);  // directories, links, global pax headers, ...
+                }
+                in.skip(pad);
+            }
+        }
+
+        inline void hash_zip(Reader &in, Callback const &callback)
+        {
+            for ( ;; )
+            {
+                char unsigned h[30];
+                if ( in.fill(4u) < 4u ) throw std::runtime_error("md5::archive: truncated zip");
+                std::uint64_t const signature = details::le(in.data(), 4u);
+                if ( 0x02014b50u == signature || 0x06054b50u == signature ) return;  // central directory: no more members
+                if ( 0x04034b50u != signature ) throw std::runtime_error("md5::archive: bad zip header at offset " + std::to_string(in.offset()));
+                in.read(h, sizeof h);
+
+                unsigned const flags = static_cast<unsigned>(details::le(h + 6u, 2u));
+                unsigned const method = static_cast<unsigned>(details::le(h + 8u, 2u));
+                std::uint64_t csize = details::le(h + 18u, 4u);
+                std::uint64_t usize = details::le(h + 22u, 4u);
+                std::string const name = details::read_string(in, details::le(h + 26u, 2u));
+                std::string const extra = details::read_string(in, details::le(h + 28u, 2u));
+
+                bool zip64 = false;
+                for ( std::size_t at = 0u; at + 4u <= extra.size(); )
+                {
+                    char unsigned const *const e = reinterpret_cast<char unsigned const *>(extra.data()) + at;
+                    std::size_t const len = static_cast<std::size_t>(details::le(e + 2u, 2u));
+                    if ( 0x0001u == details::le(e, 2u) )
+                    {
+                        zip64 = true;
+                        std::size_t i = 4u;  // only the fields that overflowed are there, in this order
+                        if ( 0xffffffffu == usize && i + 8u <= 4u + len ) { usize = details::le(e + i, 8u); i += 8u; }
+                        if ( 0xffffffffu == csize && i + 8u <= 4u + len ) { csize = details::le(e + i, 8u); i += 8u; }
+                    }
+                    at += 4u + len;
+                }
+
+                bool const descriptor = (0u != (flags & 0x08u));
+                bool const directory = !name.empty() && '/' == name.back();
+                Member m;
+                m.name = name;
+
+                if ( 0u != (flags & 0x01u) || (8u != method && 0u != method)
+#ifndef MD5_ENABLE_ZLIB
+                     || 8u == method
+#endif
+                   )
+                {
+                    if ( descriptor ) throw std::runtime_error("md5::archive: can't find the end of " + name + " without decompressing it");
+                    in.skip(csize);
+                    m.note = (0u != (flags & 0x01u)) ? "encrypted" : "compression method " + std::to_string(method) + " not supported";
+                    if ( !directory ) callback(m);
+                    continue;
+                }
+
+                ::md5::details::Context ctx;
+                if ( 0u == method )
+                {
+                    // Without the size up front a stored member has no end
+                    // marker but its data descriptor. Empty ones (e.g. every
+                    // empty file from "zip -r -") are easy to tell; others are
+                    // skipped by looking for the descriptor.
+                    if ( descriptor && 0u == csize && !details::empty_stored(in, zip64) )
+                    {
+                        m.size = details::skip_stored(in, zip64);
+                        details::skip_descriptor(in, zip64);
+                        m.note = "stored without its size up front";
+                        if ( !directory ) callback(m);
+                        continue;
+                    }
+                    in.stream(csize, [&](char unsigned const *const p, std::size_t const len) { ctx.append(p, len); });
+                    m.size = csize;
+                }
+#ifdef MD5_ENABLE_ZLIB
+                else
+                {
+                    z_stream z = {};
+                    if ( Z_OK != ::inflateInit2(&z, -MAX_WBITS) ) throw std::runtime_error("md5::archive: inflateInit2 failed");
+                    std::vector<char unsigned> out(file::buffer_size);
+                    std::uint64_t consumed = 0u;
+                    int result = Z_OK;
+                    while ( Z_STREAM_END != result )
+                    {
+                        // Without a descriptor, stop at the compressed size whatever the stream says
+                        std::size_t const have = in.fill(1u);
+                        std::size_t const limit = descriptor ? have : static_cast<std::size_t>((csize - consumed < have) ? csize - consumed : have);
+                        if ( 0u == limit ) { ::inflateEnd(&z); throw std::runtime_error("md5::archive: truncated deflate data in " + name); }
+                        z.next_in = const_cast<Bytef *>(in.data());
+                        z.avail_in = static_cast<uInt>(limit < 0x40000000u ? limit : 0x40000000u);
+                        uInt const offered = z.avail_in;
+                        do
+                        {
+                            z.next_out = out.data();
+                            z.avail_out = static_cast<uInt>(out.size());
+                            result = ::inflate(&z, Z_NO_FLUSH);
+                            if ( Z_OK != result && Z_STREAM_END != result && Z_BUF_ERROR != result )
+                            {
+                                ::inflateEnd(&z);
+                                throw std::runtime_error("md5::archive: bad deflate data in " + name);
+                            }
+                            std::size_t const produced = out.size() - z.avail_out;
+                            ctx.append(out.data(), produced);
+                            m.size += produced;
+                        } while ( 0u == z.avail_out && Z_STREAM_END != result );
+                        std::size_t const used = offered - z.avail_in;
+                        in.consume(used);
+                        consumed += used;
+                    }
+                    ::inflateEnd(&z);
+                    if ( !descriptor && consumed < csize ) in.skip(csize - consumed);
+                }
+#endif
+                if ( descriptor ) details::skip_descriptor(in, zip64);
+                m.digest = ctx.final();
+                m.hashed = true;
+                if ( !directory ) callback(m);
+            }
+        }
+
+        // Tells zip from tar by the first bytes of the stream
+        inline void hash_archive(Reader &in, Callback const &callback)
+        {
+            std::size_t const n = in.fill(512u);
+            if ( n >= 4u && 0 == std::memcmp(in.data(), "PK\x03\x04", 4u) ) return hash_zip(in, callback);
+            if ( n >= 4u && 0 == std::memcmp(in.data(), "PK\x05\x06", 4u) ) return;  // an empty zip
+            return hash_tar(in, callback);  // also old tar without the ustar magic; the checksum decides
+        }
+
+        inline void hash_archive(int const fd, Callback const &callback)
+        {
+            Reader in(fd);
+            hash_archive(in, callback);
+        }
+
+    }  // close namespace 'archive'
+}  // close namespace 'md5'
+
+#endif  // HEADER_INCLUSION_GUARD
@@ -0,0 +1,518 @@
+#ifndef HEADER_INCLUSION_GUARD_60271938845510372946617203588150942266017
+#define HEADER_INCLUSION_GUARD_60271938845510372946617203588150942266017
+
+// A local content-addressed object store keyed by md5::Digest (POSIX only).
+//
+// New objects are written "loose", one file each, and hashed in the same
+// pass that writes them: the data goes to a temporary file and into the
+// MD5 context together, and the file is renamed to its digest at the end.
+// Writing an object that is already stored, loose or packed, just drops
+// the temporary file, and several processes can write into one store at
+// the same time.
+//
+// 'repack' moves all loose objects into one pack file, copying them on
+// several threads, and writes a sorted index for it. Pack indexes are
+// memory-mapped, and a lookup is a binary search within one of 256
+// buckets chosen by the first byte of the digest.
+//
+// Layout under the root directory:
+//     objects/ab/cdef...      loose objects, named by their hex digest
+//     packs/pack-<hex>.pack   "MD5PACK1", then the objects back to back
+//     packs/pack-<hex>.idx    the index of the pack with the same name
+//     tmp/                    files being written
+//     repack.lock             locked by the one 'repack' running
+//
+// Index layout (all integers little-endian):
+//     offset 0    char[8]     magic "MD5PIDX1"
+//     offset 8    uint64      number of objects
+//     offset 16   char[48]    reserved (0)
+//     offset 64   uint64      fanout[257], the index of the first entry
+//                             whose digest starts with each byte, and the count
+//     then        entries of 32 bytes, sorted by digest:
+//                 char[16] digest, uint64 offset in the pack, uint64 length
+//
+// Errors are reported by throwing std::system_error or std::runtime_error.
+
+#include <algorithm>     // sort
+#include <atomic>        // atomic
+#include <cerrno>        // errno
+#include <cstdint>       // uint64_t
+#include <cstdio>        // rename, remove, snprintf
+#include <cstring>       // memcmp, memcpy, strlen
+#include <memory>        // shared_ptr, make_shared
+#include <mutex>         // mutex, lock_guard
+#include <random>        // random_device
+#include <stdexcept>     // runtime_error
+#include <string>        // string
+#include <system_error>  // system_error
+#include <thread>        // hardware_concurrency
+#include <utility>       // move
+#include <vector>        // vector
+#include <dirent.h>      // opendir, readdir
+#include <fcntl.h>       // open
+#include <sys/file.h>    // flock
+#include <sys/mman.h>    // mmap
+#include <sys/stat.h>    // stat, fstat
+#include <unistd.h>      // write, fsync, unlink, getpid
+#include "md5.hpp"
+#include "md5_file.hpp"
+#include "md5_util.hpp"
+
+namespace md5 {
+    namespace blob {
+
+        namespace details {
+
+            constexpr char pack_magic[8]  = { 'M', 'D', '5', 'P', 'A', 'C', 'K', '1' };
+            constexpr char index_magic[8] = { 'M', 'D', '5', 'P', 'I', 'D', 'X', '1' };
+            constexpr std::size_t index_header_size = 64u;
+            constexpr std::size_t fanout_size = 257u * 8u;
+            constexpr std::size_t entry_size = 32u;
+
+            using util::load_le64;
+            using util::store_le64;
+
+            inline void sync_dir(std::string const &path)
+            {
+                file::Fd const fd(::open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+                if ( -1 == fd.get() || 0 != ::fsync(fd.get()) ) throw std::system_error(errno, std::generic_category(), path);
+            }
+
+            // Creates a file under 'dir' with a name no other thread or
+            // process will pick, and sets 'path' to it
+            inline file::Fd create_temp(std::string const &dir, char const *const suffix, std::string &path)
+            {
+                static std::atomic<unsigned> counter{ 0u };
+                for ( ;; )
+                {
+                    char name[96];
+                    std::snprintf(name, sizeof name, "/%ld-%u-%08x%s", static_cast<long>(::getpid()), counter++,
+                                  static_cast<unsigned>(std::random_device()()), suffix);
+                    path = dir + name;
+                    int const fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+                    if ( -1 != fd ) return file::Fd(fd);
+                    if ( EEXIST != errno ) throw std::system_error(errno, std::generic_category(), path);
+                }
+            }
+
+            // Removes a temporary file unless it was renamed into place
+            struct TempPath {
+                std::string path;
+                ~TempPath(void) { if ( !path.empty() ) ::unlink(path.c_str()); }
+            };
+
+            // A read-only view of one pack and its memory-mapped index
+            class Pack {
+            public:
+
+                explicit Pack(std::string const &base)
+                    : pack_(file::open_read((base + ".pack").c_str()))
+                {
+                    file::Fd const fd = file::open_read((base + ".idx").c_str());
+                    struct stat st;
+                    if ( 0 != ::fstat(fd.get(), &st) ) throw std::system_error(errno, std::generic_category(), base + ".idx");
+                    size_ = static_cast<std::size_t>(st.st_size);
+                    void *const p = (size_ < index_header_size + fanout_size) ? MAP_FAILED : ::mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd.get(), 0);
+                    if ( MAP_FAILED == p ) throw std::runtime_error("md5::blob: bad pack index " + base + ".idx");
+                    base_ = static_cast<char unsigned const *>(p);
+                    count_ = load_le64(base_ + 8u);
+                    if ( 0 != std::memcmp(base_, index_magic, sizeof index_magic)
+                         || index_header_size + fanout_size + count_ * entry_size != size_
+                         || load_le64(base_ + index_header_size + 256u * 8u) != count_ )
+                    {
+                        ::munmap(const_cast<char unsigned *>(base_), size_);
+                        throw std::runtime_error("md5::blob: bad pack index " + base + ".idx");
+                    }
+                    ::madvise(const_cast<char unsigned *>(base_), size_, MADV_RANDOM);
+                }
+
+                ~Pack(void)
+                {
+                    ::munmap(const_cast<char unsigned *>(base_), size_);
+                }
+
+                Pack(Pack const &) = delete;
+                Pack &operator=(Pack const &) = delete;
+
+                // Sets the offset and length of 'd' in the pack if it's there
+                bool find(Digest const &d, std::uint64_t &offset, std::uint64_t &length) const noexcept
+                {
+                    char unsigned const *const fanout = base_ + index_header_size;
+                    std::uint64_t lo = load_le64(fanout + d.b[0] * 8u), hi = load_le64(fanout + (d.b[0] + 1u) * 8u);
+                    if ( hi > count_ || lo > hi ) return false;
+                    while ( lo < hi )
+                    {
+                        std::uint64_t const mid = lo + (hi - lo) / 2u;
+                        char unsigned const *const e = entry(mid);
+                        int const cmp = std::memcmp(d.b, e, Digest::count);
+                        if ( 0 == cmp )
+                        {
+                            offset = load_le64(e + 16u);
+                            length = load_le64(e + 24u);
+                            return true;
+                        }
+                        if ( cmp < 0 ) hi = mid; else lo = mid + 1u;
+                    }
+                    return false;
+                }
+
+                int fd(void) const noexcept { return pack_.get(); }
+
+            private:
+                file::Fd pack_;
+                char unsigned const *base_ = nullptr;
+                std::size_t size_ = 0u;
+                std::uint64_t count_ = 0u;
+
+                char unsigned const *entry(std::uint64_t const i) const noexcept
+                {
+                    return base_ + index_header_size + fanout_size + i * entry_size;
+                }
+            };
+        }
+
+        class Store;
+
+        // Writes one object, hashing it as it goes. Nothing is visible in the
+        // store until 'commit'; an uncommitted writer removes its temporary file.
+        // A writer must not outlive its store.
+        class Writer {
+        public:
+
+            Writer(Writer &&other) noexcept
+                : store_(other.store_), temp_(std::move(other.temp_)), fd_(std::move(other.fd_)),
+                  ctx_(other.ctx_), size_(other.size_)
+            {
+                other.temp_.clear();
+            }
+
+            ~Writer(void)
+            {
+                if ( !temp_.empty() ) ::unlink(temp_.c_str());
+            }
+
+            Writer(Writer const &) = delete;
+            Writer &operator=(Writer const &) = delete;
+            Writer &operator=(Writer &&) = delete;
+
+            void write(void const *const data, std::size_t const len)
+            {
+                file::write_all(fd_.get(), data, len, size_, temp_);
+                ctx_.append(static_cast<char unsigned const *>(data), len);
+                size_ += len;
+            }
+
+            // Makes the object durable and visible, and returns its digest
+            Digest commit(void);
+
+        private:
+            friend class Store;
+
+            Writer(Store &store, std::string temp, file::Fd fd)
+                : store_(&store), temp_(std::move(temp)), fd_(std::move(fd)) {}
+
+            Store *store_;
+            std::string temp_;
+            file::Fd fd_;
+            ::md5::details::Context ctx_;
+            std::uint64_t size_ = 0u;
+        };
+
+        class Store {
+        public:
+
+            // Opens the store at 'root', creating its directories if needed
+            explicit Store(std::string root)
+                : root_(std::move(root))
+            {
+                file::make_dir(root_);
+                file::make_dir(root_ + "/objects");
+                file::make_dir(root_ + "/packs");
+                file::make_dir(root_ + "/tmp");
+                refresh();
+            }
+
+            Store(Store const &) = delete;
+            Store &operator=(Store const &) = delete;
+
+            Writer writer(void)
+            {
+                std::string temp;
+                file::Fd fd = details::create_temp(root_ + "/tmp", "", temp);
+                return Writer(*this, std::move(temp), std::move(fd));
+            }
+
+            Digest put(void const *const data, std::size_t const len)
+            {
+                Writer w = writer();
+                w.write(data, len);
+                return w.commit();
+            }
+
+            // Copies the rest of 'fd' into the store, reading it once
+            Digest put_fd(int const fd)
+            {
+                Writer w = writer();
+                std::vector<char unsigned> buffer(file::buffer_size);
+                for ( std::size_t n; 0u != (n = file::read_some(fd, buffer.data(), buffer.size())); ) w.write(buffer.data(), n);
+                return w.commit();
+            }
+
+            bool contains(Digest const &d)
+            {
+                struct stat st;
+                if ( 0 == ::stat(loose_path(d).c_str(), &st) ) return true;
+                std::uint64_t offset, length;
+                return nullptr != find_packed(d, offset, length);
+            }
+
+            // Reads object 'd' into 'out'. Returns false if it isn't stored.
+            bool get(Digest const &d, std::vector<char unsigned> &out)
+            {
+                int const fd = ::open(loose_path(d).c_str(), O_RDONLY | O_CLOEXEC);
+                if ( -1 != fd )
+                {
+                    file::Fd const loose(fd);
+                    struct stat st;
+                    if ( 0 != ::fstat(fd, &st) ) throw std::system_error(errno, std::generic_category(), loose_path(d));
+                    out.resize(static_cast<std::size_t>(st.st_size));
+                    out.resize(file::read_at(fd, out.data(), out.size(), 0u));
+                    return true;
+                }
+                if ( ENOENT != errno ) throw std::system_error(errno, std::generic_category(), loose_path(d));
+
+                std::uint64_t offset, length;
+                std::shared_ptr<details::Pack> const pack = find_packed(d, offset, length);
+                if ( !pack ) return false;
+                out.resize(static_cast<std::size_t>(length));
+                if ( file::read_at(pack->fd(), out.data(), out.size(), offset) != length ) throw std::runtime_error("md5::blob: truncated pack");
+                return true;
+            }
+
+            // Re-reads the list of packs, e.g. after another process repacked
+            void refresh(void)
+            {
+                std::int64_t const stamp = packs_stamp();
+                std::vector<std::shared_ptr<details::Pack>> packs;
+                for ( std::string const &name : list(root_ + "/packs") )
+                {
+                    if ( name.size() < 4u || 0 != name.compare(name.size() - 4u, 4u, ".idx") ) continue;
+                    packs.push_back(std::make_shared<details::Pack>(root_ + "/packs/" + name.substr(0u, name.size() - 4u)));
+                }
+                std::lock_guard<std::mutex> const lock(mutex_);
+                packs_.swap(packs);
+                stamp_ = stamp;
+            }
+
+            // Moves every loose object into a new pack, copying on 'threads'
+            // threads, and returns the number of objects packed. Each object
+            // is hashed while it's copied, and one whose contents don't match
+            // its name is left loose and makes this throw afterwards. Only one
+            // repack runs at a time per store; others wait for it.
+            std::uint64_t repack(unsigned const threads = std::thread::hardware_concurrency())
+            {
+                std::string const lock_path = root_ + "/repack.lock";
+                file::Fd const lock(::open(lock_path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644));
+                if ( -1 == lock.get() ) throw std::system_error(errno, std::generic_category(), lock_path);
+                while ( 0 != ::flock(lock.get(), LOCK_EX) ) if ( EINTR != errno ) throw std::system_error(errno, std::generic_category(), lock_path);
+
+                struct Item {
+                    Digest digest;
+                    std::uint64_t length, offset;
+                    bool ok;
+                };
+                std::vector<Item> items;
+                for ( std::string const &dir : list(root_ + "/objects") )
+                {
+                    if ( 2u != dir.size() ) continue;
+                    for ( std::string const &name : list(root_ + "/objects/" + dir) )
+                    {
+                        Digest d;
+                        struct stat st;
+                        if ( !util::from_hex((dir + name).c_str(), d) || 0 != ::stat(loose_path(d).c_str(), &st) ) continue;
+                        std::uint64_t offset, length;
+                        if ( nullptr != find_packed(d, offset, length) ) { ::unlink(loose_path(d).c_str()); continue; }
+                        items.push_back(Item{ d, static_cast<std::uint64_t>(st.st_size), 0u, false });
+                    }
+                }
+                if ( items.empty() ) return 0u;
+
+                std::sort(items.begin(), items.end(), [](Item const &a, Item const &b) { return std::memcmp(a.digest.b, b.digest.b, Digest::count) < 0; });
+                std::uint64_t size = sizeof details::pack_magic;
+                for ( Item &item : items ) { item.offset = size; size += item.length; }
+
+                // The pack is named after the digest of its list of objects
+                ::md5::details::Context name_ctx;
+                for ( Item const &item : items ) name_ctx.append(item.digest.b, Digest::count);
+                std::string const base = root_ + "/packs/pack-" + util::hex(name_ctx.final());
+                details::TempPath temp_pack, temp_idx;
+
+                {
+                    file::Fd const pack = details::create_temp(root_ + "/tmp", ".pack", temp_pack.path);
+                    if ( 0 != ::ftruncate(pack.get(), static_cast<off_t>(size)) ) throw std::system_error(errno, std::generic_category(), temp_pack.path);
+                    file::write_all(pack.get(), details::pack_magic, sizeof details::pack_magic, 0u, temp_pack.path);
+
+                    util::parallel_for(items.size(), threads, [&](std::size_t const i) {
+                        Item &item = items[i];
+                        try
+                        {
+                            file::Fd const in = file::open_read(loose_path(item.digest).c_str());
+                            std::vector<char unsigned> buffer(static_cast<std::size_t>(item.length < file::buffer_size ? item.length : file::buffer_size));
+                            ::md5::details::Context ctx;
+                            std::uint64_t done = 0u;
+                            while ( done < item.length )
+                            {
+                                std::size_t const want = static_cast<std::size_t>((item.length - done < buffer.size()) ? item.length - done : buffer.size());
+                                if ( file::read_at(in.get(), buffer.data(), want, done) != want ) return;
+                                ctx.append(buffer.data(), want);
+                                file::write_all(pack.get(), buffer.data(), want, item.offset + done, temp_pack.path);
+                                done += want;
+                            }
+                            Digest const d = ctx.final();
+                            item.ok = (0 == std::memcmp(d.b, item.digest.b, Digest::count));
+                        }
+                        catch ( std::system_error const & )
+                        {
+                            // Left loose
+                        }
+                    });
+                    if ( 0 != ::fsync(pack.get()) ) throw std::system_error(errno, std::generic_category(), temp_pack.path);
+                }
+
+                // Objects that couldn't be copied stay loose; their bytes in the
+                // pack are simply never referenced
+                std::vector<char unsigned> index(details::index_header_size + details::fanout_size);
+                std::memcpy(index.data(), details::index_magic, sizeof details::index_magic);
+                std::uint64_t count = 0u, fanout[257] = {};
+                for ( Item const &item : items )
+                {
+                    if ( !item.ok ) continue;
+                    char unsigned entry[details::entry_size];
+                    std::memcpy(entry, item.digest.b, Digest::count);
+                    details::store_le64(entry + 16u, item.offset);
+                    details::store_le64(entry + 24u, item.length);
+                    index.insert(index.end(), entry, entry + sizeof entry);
+                    ++fanout[item.digest.b[0] + 1u];
+                    ++count;
+                }
+                if ( 0u == count )
+                {
+                    throw std::runtime_error("md5::blob: " + std::to_string(items.size()) + " loose objects couldn't be packed");
+                }
+                for ( unsigned i = 1u; i < 257u; ++i ) fanout[i] += fanout[i - 1u];
+                details::store_le64(&index[8], count);
+                for ( unsigned i = 0u; i < 257u; ++i ) details::store_le64(&index[details::index_header_size + i * 8u], fanout[i]);
+                {
+                    file::Fd const idx = details::create_temp(root_ + "/tmp", ".idx", temp_idx.path);
+                    file::write_all(idx.get(), index.data(), index.size(), 0u, temp_idx.path);
+                    if ( 0 != ::fsync(idx.get()) ) throw std::system_error(errno, std::generic_category(), temp_idx.path);
+                }
+
+                // Readers find packs by their index, so it's renamed last. The
+                // renames must be durable before the loose copies go away.
+                if ( 0 != std::rename(temp_pack.path.c_str(), (base + ".pack").c_str()) ) throw std::system_error(errno, std::generic_category(), base + ".pack");
+                temp_pack.path.clear();
+                if ( 0 != std::rename(temp_idx.path.c_str(), (base + ".idx").c_str()) ) throw std::system_error(errno, std::generic_category(), base + ".idx");
+                temp_idx.path.clear();
+                details::sync_dir(root_ + "/packs");
+                refresh();
+
+                std::uint64_t bad = 0u;
+                for ( Item const &item : items )
+                {
+                    if ( item.ok ) ::unlink(loose_path(item.digest).c_str());
+                    else ++bad;
+                }
+                if ( 0u != bad ) throw std::runtime_error("md5::blob: " + std::to_string(bad) + " loose objects couldn't be packed");
+                return count;
+            }
+
+        private:
+            friend class Writer;
+
+            std::string root_;
+            std::mutex mutex_;
+            std::vector<std::shared_ptr<details::Pack>> packs_;
+            std::int64_t stamp_ = 0;  // modification time of packs/ when they were listed
+
+            std::string loose_path(Digest const &d) const
+            {
+                std::string const hex = util::hex(d);
+                return root_ + "/objects/" + hex.substr(0u, 2u) + '/' + hex.substr(2u);
+            }
+
+            std::int64_t packs_stamp(void) const
+            {
+                struct stat st;
+                if ( 0 != ::stat((root_ + "/packs").c_str(), &st) ) return 0;
+#ifdef __APPLE__
+                return static_cast<std::int64_t>(st.st_mtimespec.tv_sec) * 1000000000 + st.st_mtimespec.tv_nsec;
+#else
+                return static_cast<std::int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+            }
+
+            static std::vector<std::string> list(std::string const &dir)
+            {
+                std::vector<std::string> names;
+                DIR *const d = ::opendir(dir.c_str());
+                if ( nullptr == d ) return names;
+                while ( dirent const *const e = ::readdir(d) )
+                {
+                    if ( '.' != e->d_name[0] ) names.push_back(e->d_name);
+                }
+                ::closedir(d);
+                return names;
+            }
+
+            std::shared_ptr<details::Pack> find_packed(Digest const &d, std::uint64_t &offset, std::uint64_t &length)
+            {
+                for ( int attempt = 0; attempt < 2; ++attempt )
+                {
+                    std::int64_t stamp;
+                    {
+                        std::lock_guard<std::mutex> const lock(mutex_);
+                        for ( std::shared_ptr<details::Pack> const &pack : packs_ ) if ( pack->find(d, offset, length) ) return pack;
+                        stamp = stamp_;
+                    }
+                    // It may have been packed by another process since we looked
+                    if ( 0 != attempt || packs_stamp() == stamp ) break;
+                    refresh();
+                }
+                return nullptr;
+            }
+        };
+
+        inline Digest Writer::commit(void)
+        {
+            Digest const d = ctx_.final();
+            if ( store_->contains(d) )
+            {
+                fd_ = file::Fd();
+                ::unlink(temp_.c_str());
+                temp_.clear();
+                return d;
+            }
+            if ( 0 != ::fsync(fd_.get()) ) throw std::system_error(errno, std::generic_category(), temp_);
+            fd_ = file::Fd();
+
+            // A new fan-out directory and the rename must both be durable
+            // before the object counts as stored
+            std::string const path = store_->loose_path(d);
+            std::string const dir = path.substr(0u, path.rfind('/'));
+            struct stat st;
+            if ( 0 != ::stat(dir.c_str(), &st) )
+            {
+                file::make_dir(dir);
+                details::sync_dir(store_->root_ + "/objects");
+            }
+            if ( 0 != std::rename(temp_.c_str(), path.c_str()) ) throw std::system_error(errno, std::generic_category(), path);
+            temp_.clear();
+            details::sync_dir(dir);
+            return d;
+        }
+
+    }  // close namespace 'blob'
+}  // close namespace 'md5'
+
+#endif  // HEADER_INCLUSION_GUARD
@@ -0,0 +1,314 @@
+#ifndef HEADER_INCLUSION_GUARD_81347266019432865190377451123987654108823
+#define HEADER_INCLUSION_GUARD_81347266019432865190377451123987654108823
+
+// A blocked Bloom filter of md5::Digest, for a cheap "definitely not
+// present" test before a lookup in a larger set (e.g. md5_digestdb.hpp).
+//
+// The filter is an array of 512-Bit blocks, one cache line each. A digest
+// is already a uniformly distributed 128-Bit number, so nothing is hashed
+// again: the top 32 bits of the first 64-Bit word choose the block, and
+// the remaining 96 bits are cut into up to ten 9-Bit positions inside it.
+// A query therefore touches exactly one cache line.
+//
+// Filters with the same number of blocks and probes can be built in
+// parallel and combined with 'merge'. A filter can be saved to a file and
+// later memory-mapped read-only with MappedBloomFilter (POSIX only).
+//
+// File layout: char[8] magic "MD5BLOOM", uint32 probes, uint32 byte order
+// mark (0x01020304 written natively), uint64 number of blocks, char[40]
+// reserved, then the blocks as native 64-Bit words. A file is only
+// readable on hosts with the same byte order as the one that wrote it.
+
+#include <cerrno>        // errno
+#include <climits>       // CHAR_BIT
+#include <cstdint>       // uint64_t, uint32_t
+#include <cstdio>        // FILE, fopen, fwrite
+#include <cstring>       // memcpy, memcmp
+#include <stdexcept>     // invalid_argument, runtime_error
+#include <system_error>  // system_error
+#include <utility>       // move
+#include <vector>        // vector
+#include <fcntl.h>       // open
+#include <sys/mman.h>    // mmap
+#include <sys/stat.h>    // fstat
+#include <unistd.h>      // close
+#include "md5.hpp"
+#include "md5_util.hpp"
+
+namespace md5 {
+    namespace bloom {
+
+        static_assert( 8 == CHAR_BIT && 16u == Digest::count, "Probe positions assume 8-Bit bytes" );
+
+        constexpr unsigned words_per_block = 8u;  // 512 bits
+        constexpr unsigned max_probes = 10u;      // 96 spare bits / 9 bits per probe
+        constexpr char magic[8] = { 'M', 'D', '5', 'B', 'L', 'O', 'O', 'M' };
+        constexpr std::size_t header_size = 64u;
+        constexpr std::uint32_t byte_order_mark = 0x01020304u;
+
+        namespace details {
+
+            using util::load_le64;
+
+            struct Probe {
+                std::uint64_t block;
+                std::uint64_t mask[words_per_block];
+            };
+
+            // Maps the digest onto a block, using a multiply rather than a
+            // modulo so that any number of blocks is allowed, and builds the
+            // mask of the bits to set or test inside that block
+            inline void make_probe(Digest const &d, std::uint64_t const blocks, unsigned const probes, Probe &p) noexcept
+            {
+                std::uint64_t const w0 = load_le64(d.b);
+                std::uint64_t bits[2] = { w0 & 0xffffffffu, load_le64(d.b + 8u) };  // 32 + 64 spare bits
+
+                p.block = ((w0 >> 32u) * blocks) >> 32u;
+                for ( auto &m : p.mask ) m = 0u;
+                for ( unsigned i = 0u; i < probes; ++i )
+                {
+                    // Three probes from the 32-Bit word, the rest from the 64-Bit word
+                    std::uint64_t &src = bits[(i < 3u) ? 0u : 1u];
+                    unsigned const bit = static_cast<unsigned>(src & 0x1ffu);
+                    src >>= 9u;
+                    p.mask[bit / 64u] |= std::uint64_t(1u) << (bit % 64u);
+                }
+            }
+
+            inline bool test(std::uint64_t const *const block, Probe const &p) noexcept
+            {
+                // Written without early exit so that it vectorises
+                std::uint64_t missing = 0u;
+                for ( unsigned i = 0u; i < words_per_block; ++i ) missing |= p.mask[i] & ~block[i];
+                return 0u == missing;
+            }
+
+            inline void prefetch(void const *const p) noexcept
+            {
+#if defined(__GNUC__) || defined(__clang__)
+                __builtin_prefetch(p);
+#else
+                (void)p;
+#endif
+            }
+
+            // Batched queries: the blocks of a group of digests are all
+            // prefetched before any of them is tested
+            inline void contains(std::uint64_t const *const words, std::uint64_t const blocks, unsigned const probes,
+                                 Digest const *const queries, std::size_t const n, bool *const results) noexcept
+            {
+                constexpr std::size_t group = 16u;
+                Probe p[group];
+                for ( std::size_t base = 0u; base < n; base += group )
+                {
+                    std::size_t const m = (n - base < group) ? n - base : group;
+                    for ( std::size_t i = 0u; i < m; ++i )
+                    {
+                        make_probe(queries[base + i], blocks, probes, p[i]);
+                        prefetch(words + p[i].block * words_per_block);
+                    }
+                    for ( std::size_t i = 0u; i < m; ++i ) results[base + i] = test(words + p[i].block * words_per_block, p[i]);
+                }
+            }
+
+            // Number of blocks for a wanted false positive rate.
+            // A blocked filter needs a little more space than a classic one
+            // for the same rate, hence the 1.2 factor.
+            inline std::uint64_t blocks_for(std::uint64_t const expected, double const fp_rate) noexcept
+            {
+                double const ln2 = 0.6931471805599453;
+                double bits = 1.0;
+                for ( double r = 1.0; r > fp_rate && bits < 64.0; r /= 2.0 ) bits += 1.0 / ln2;
+                std::uint64_t const total = static_cast<std::uint64_t>(bits * 1.2 * static_cast<double>(expected));
+                return (total / 512u) + 1u;
+            }
+        }
+
+        class BloomFilter {
+        public:
+
+            BloomFilter(std::uint64_t const blocks, unsigned const probes)
+                : blocks_(blocks), probes_(probes), words_(blocks * words_per_block + words_per_block, 0u)
+            {
+                if ( 0u == blocks || blocks > 0xffffffffu ) throw std::invalid_argument("md5::bloom: number of blocks must be 1 to 2^32-1");
+                if ( 0u == probes || probes > max_probes ) throw std::invalid_argument("md5::bloom: number of probes must be 1 to 10");
+            }
+
+            // The blocks start at a different offset into each vector's
+            // buffer, so copying the vector itself would misplace them
+            BloomFilter(BloomFilter const &other)
+                : blocks_(other.blocks_), probes_(other.probes_), words_(other.words_.size(), 0u)
+            {
+                std::memcpy(data(), other.data(), static_cast<std::size_t>(blocks_) * 64u);
+            }
+
+            BloomFilter &operator=(BloomFilter const &other)
+            {
+                BloomFilter copy(other);
+                return *this = std::move(copy);
+            }
+
+            BloomFilter(BloomFilter &&) = default;
+            BloomFilter &operator=(BloomFilter &&) = default;
+
+            // Sized for 'expected' digests at roughly 'fp_rate' false positives
+            static BloomFilter for_capacity(std::uint64_t const expected, double const fp_rate = 0.01)
+            {
+                unsigned probes = 1u;
+                for ( double r = 0.5; r > fp_rate && probes < 7u; r /= 2.0 ) ++probes;
+                return BloomFilter(details::blocks_for(expected, fp_rate), probes);
+            }
+
+            std::uint64_t blocks(void) const noexcept { return blocks_; }
+            unsigned probes(void) const noexcept { return probes_; }
+
+            void insert(Digest const &d) noexcept
+            {
+                details::Probe p;
+                details::make_probe(d, blocks_, probes_, p);
+                std::uint64_t *const block = data() + p.block * words_per_block;
+                for ( unsigned i = 0u; i < words_per_block; ++i ) block[i] |= p.mask[i];
+            }
+
+            bool contains(Digest const &d) const noexcept
+            {
+                details::Probe p;
+                details::make_probe(d, blocks_, probes_, p);
+                return details::test(data() + p.block * words_per_block, p);
+            }
+
+            void contains(Digest const *const queries, std::size_t const n, bool *const results) const noexcept
+            {
+                details::contains(data(), blocks_, probes_, queries, n, results);
+            }
+
+            // Adds every digest of 'other', which must have the same shape
+            void merge(BloomFilter const &other)
+            {
+                if ( other.blocks_ != blocks_ || other.probes_ != probes_ ) throw std::invalid_argument("md5::bloom: merging filters of different shape");
+                std::uint64_t *const dst = data();
+                std::uint64_t const *const src = other.data();
+                for ( std::uint64_t i = 0u; i < blocks_ * words_per_block; ++i ) dst[i] |= src[i];
+            }
+
+            void save(char const *const path) const
+            {
+                char unsigned header[header_size] = {};
+                std::uint32_t const probes = probes_;
+                std::memcpy(header, magic, sizeof magic);
+                std::memcpy(header + 8u, &probes, 4u);
+                std::memcpy(header + 12u, &byte_order_mark, 4u);
+                std::memcpy(header + 16u, &blocks_, 8u);
+
+                std::FILE *const f = std::fopen(path, "wb");
+                if ( nullptr == f ) throw std::system_error(errno, std::generic_category(), path);
+                bool ok = (1u == std::fwrite(header, sizeof header, 1u, f))
+                       && (blocks_ == std::fwrite(data(), 64u, static_cast<std::size_t>(blocks_), f));
+                int const error = errno;
+                ok = (0 == std::fclose(f)) && ok;
+                if ( !ok ) throw std::system_error(error, std::generic_category(), path);
+            }
+
+        private:
+
+            std::uint64_t blocks_;
+            unsigned probes_;
+            std::vector<std::uint64_t> words_;  // one spare block so that the blocks can start on a cache line
+
+            std::uint64_t *data(void) noexcept
+            {
+                return const_cast<std::uint64_t *>(static_cast<BloomFilter const *>(this)->data());
+            }
+
+            std::uint64_t const *data(void) const noexcept
+            {
+                std::uintptr_t const p = reinterpret_cast<std::uintptr_t>(words_.data());
+                return reinterpret_cast<std::uint64_t const *>((p + 63u) & ~std::uintptr_t(63u));
+            }
+        };
+
+        // A saved filter, mapped read-only rather than loaded
+        class MappedBloomFilter {
+        public:
+
+            explicit MappedBloomFilter(char const *const path)
+            {
+                int const fd = ::open(path, O_RDONLY | O_CLOEXEC);
+                if ( -1 == fd ) throw std::system_error(errno, std::generic_category(), path);
+
+                struct stat st;
+                if ( 0 != ::fstat(fd, &st) )
+                {
+                    int const error = errno;
+                    ::close(fd);
+                    throw std::system_error(error, std::generic_category(), path);
+                }
+                size_ = static_cast<std::size_t>(st.st_size);
+
+                void *const p = (size_ < header_size) ? MAP_FAILED : ::mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+                int const error = errno;
+                ::close(fd);
+                if ( MAP_FAILED == p )
+                {
+                    if ( size_ < header_size ) throw std::runtime_error("md5::bloom: file too small");
+                    throw std::system_error(error, std::generic_category(), path);
+                }
+                base_ = static_cast<char unsigned const *>(p);
+
+                std::uint32_t probes, bom;
+                std::memcpy(&probes, base_ + 8u, 4u);
+                std::memcpy(&bom, base_ + 12u, 4u);
+                std::memcpy(&blocks_, base_ + 16u, 8u);
+                probes_ = probes;
+
+                if ( 0 != std::memcmp(base_, magic, sizeof magic) || byte_order_mark != bom
+                     || 0u == probes_ || probes_ > max_probes || 0u == blocks_ || blocks_ > 0xffffffffu
+                     || header_size + blocks_ * 64u != size_ )
+                {
+                    ::munmap(const_cast<char unsigned *>(base_), size_);
+                    throw std::runtime_error("md5::bloom: not a valid filter for this host");
+                }
+            }
+
+            ~MappedBloomFilter(void)
+            {
+                ::munmap(const_cast<char unsigned *>(base_), size_);
+            }
+
+            MappedBloomFilter(MappedBloomFilter const &) = delete;
+            MappedBloomFilter &operator=(MappedBloomFilter const &) = delete;
+
+            std::uint64_t blocks(void) const noexcept { return blocks_; }
+            unsigned probes(void) const noexcept { return probes_; }
+
+            bool contains(Digest const &d) const noexcept
+            {
+                details::Probe p;
+                details::make_probe(d, blocks_, probes_, p);
+                return details::test(words() + p.block * words_per_block, p);
+            }
+
+            void contains(Digest const *const queries, std::size_t const n, bool *const results) const noexcept
+            {
+                details::contains(words(), blocks_, probes_, queries, n, results);
+            }
+
+        private:
+
+            char unsigned const *base_ = nullptr;
+            std::size_t size_ = 0u;
+            std::uint64_t blocks_ = 0u;
+            unsigned probes_ = 0u;
+
+            // The header is 64 bytes and mmap is page aligned, so the blocks
+            // start on a cache line
+            std::uint64_t const *words(void) const noexcept
+            {
+                return reinterpret_cast<std::uint64_t const *>(base_ + header_size);
+            }
+        };
+
+    }  // close namespace 'bloom'
+}  // close namespace 'md5'
+
+#endif  // HEADER_INCLUSION_GUARD
@@ -0,0 +1,285 @@
+#ifndef HEADER_INCLUSION_GUARD_81950263374416068029142353678129005468271
+#define HEADER_INCLUSION_GUARD_81950263374416068029142353678129005468271
+
+// Splits a byte stream into chunks and gives the MD5 of each one, for
+// deduplicating storage.
+//
+// In content-defined mode the cut points follow FastCDC (Xia et al., 2016):
+// a gear hash 'fp = (fp << 1) + gear[byte]' is rolled over each chunk,
+// starting 'min_size' bytes in, and the chunk ends after the first byte at
+// which the masked bits of 'fp' are all zero. Before 'avg_size' the mask
+// has two more bits than log2(avg_size) and after it two fewer
+// (normalized chunking, level 2), which keeps sizes close to the average.
+// No chunk is longer than 'max_size'. Because cut points depend only on
+// nearby content, an insertion only changes the chunks around it.
+//
+// The gear table is generated at compile time from a fixed seed, so the
+// same input is always cut the same way.
+//
+// In fixed mode ('Params::fixed') every chunk is 'max_size' bytes, except
+// possibly the last.
+//
+// 'Chunker' works on a stream given in pieces of any size. Each piece is
+// fed into the MD5 of the current chunk as it arrives, so nothing is
+// copied or buffered. 'chunk_memory' instead finds the cut points in a
+// buffer on the calling thread while other threads hash the chunks
+// already found.
+
+#include <condition_variable>  // condition_variable
+#include <cstdint>    // uint64_t
+#include <mutex>      // mutex, lock_guard, unique_lock
+#include <stdexcept>  // invalid_argument
+#include <thread>     // thread, hardware_concurrency
+#include <vector>     // vector
+#include "md5.hpp"
+
+namespace md5 {
+    namespace chunker {
+
+        struct Params {
+            std::uint64_t min_size = 2u * 1024u;
+            std::uint64_t avg_size = 8u * 1024u;
+            std::uint64_t max_size = 64u * 1024u;
+            bool content_defined = true;
+
+            static Params fixed(std::uint64_t const size) noexcept
+            {
+                Params p;
+                p.min_size = p.avg_size = p.max_size = size;
+                p.content_defined = false;
+                return p;
+            }
+        };
+
+        struct Record {
+            std::uint64_t offset;
+            std::uint64_t length;
+            Digest digest;
+        };
+
+        namespace details {
+
+            struct GearTable {
+                std::uint64_t v[256];
+            };
+
+            // splitmix64, so that the table needs no storage in the source
+            constexpr GearTable make_gear_table(void) noexcept
+            {
+                GearTable t = {};
+                std::uint64_t state = 0x6d6435676561722eu;  // "md5gear."
+                for ( unsigned i = 0u; i < 256u; ++i )
+                {
+                    std::uint64_t z = (state += 0x9e3779b97f4a7c15u);
+                    z = (z ^ (z >> 30u)) * 0xbf58476d1ce4e5b9u;
+                    z = (z ^ (z >> 27u)) * 0x94d049bb133111ebu;
+                    t.v[i] = z ^ (z >> 31u);
+                }
+                return t;
+            }
+
+            // A function-local table, so that no translation unit has to
+            // define it
+            inline std::uint64_t const *gear(void) noexcept
+            {
+                static constexpr GearTable t = make_gear_table();
+                return t.v;
+            }
+
+            // The top 'bits' bits, which the gear hash has mixed the most
+            constexpr std::uint64_t top_mask(unsigned const bits) noexcept
+            {
+                return (0u == bits) ? 0u : ~std::uint64_t(0u) << (64u - bits);
+            }
+
+            inline unsigned log2_floor(std::uint64_t n) noexcept
+            {
+                unsigned bits = 0u;
+                while ( n >>= 1u ) ++bits;
+                return bits;
+            }
+
+            inline void check(Params const &p)
+            {
+                if ( 0u == p.max_size || p.min_size > p.avg_size || p.avg_size > p.max_size || (p.content_defined && p.avg_size < 64u) )
+                {
+                    throw std::invalid_argument("md5::chunker: need 0 < min_size <= avg_size <= max_size (avg_size >= 64)");
+                }
+            }
+
+            // Finds the end of a chunk. 'pos' and 'fp' carry the scan over
+            // from previous pieces of the same chunk; returns the number of
+            // bytes of 'data' that belong to it, and sets 'cut' if it ends there.
+            class Scanner {
+            public:
+                explicit Scanner(Params const &p) noexcept
+                    : p_(p), mask_s_(top_mask(log2_floor(p.avg_size) + 2u)), mask_l_(top_mask(log2_floor(p.avg_size) - 2u)) {}
+
+                std::size_t scan(char unsigned const *const data, std::size_t const len, bool &cut) noexcept
+                {
+                    cut = false;
+                    std::size_t i = 0u;
+
+                    // Nothing before min_size can be a cut point
+                    if ( pos_ < p_.min_size )
+                    {
+                        std::uint64_t const skip = p_.min_size - pos_;
+                        if ( skip > len ) { pos_ += len; return len; }
+                        i = static_cast<std::size_t>(skip);
+                        pos_ = p_.min_size;
+                    }
+
+                    if ( p_.content_defined )
+                    {
+                        std::uint64_t const *const gear = details::gear();
+                        std::uint64_t fp = fp_;
+                        for ( ; i < len && pos_ < p_.max_size; ++i, ++pos_ )
+                        {
+                            fp = (fp << 1u) + gear[data[i]];
+                            if ( 0u == (fp & (pos_ < p_.avg_size ? mask_s_ : mask_l_)) )
+                            {
+                                reset();
+                                cut = true;
+                                return i + 1u;
+                            }
+                        }
+                        fp_ = fp;
+                    }
+                    else
+                    {
+                        std::uint64_t const room = p_.max_size - pos_;
+                        std::size_t const n = static_cast<std::size_t>((len - i < room) ? len - i : room);
+                        i += n;
+                        pos_ += n;
+                    }
+
+                    if ( pos_ == p_.max_size )
+                    {
+                        reset();
+                        cut = true;
+                    }
+                    return i;
+                }
+
+                void reset(void) noexcept { pos_ = 0u; fp_ = 0u; }
+
+            private:
+                Params p_;
+                std::uint64_t mask_s_, mask_l_;
+                std::uint64_t pos_ = 0u, fp_ = 0u;
+            };
+        }
+
+        class Chunker {
+        public:
+
+            explicit Chunker(Params const &params = Params())
+                : scanner_((details::check(params), params)) {}
+
+            // Calls emit(Record const &) for every chunk completed by 'data'
+            template <typename Emit>
+            void feed(char unsigned const *data, std::size_t len, Emit &&emit)
+            {
+                while ( 0u != len )
+                {
+                    bool cut;
+                    std::size_t const n = scanner_.scan(data, len, cut);
+                    ctx_.append(data, n);
+                    length_ += n;
+                    data += n;
+                    len -= n;
+                    if ( cut ) finish_chunk(emit);
+                }
+            }
+
+            // Emits the last, possibly short, chunk. The chunker can then be
+            // used for a new stream.
+            template <typename Emit>
+            void finish(Emit &&emit)
+            {
+                if ( 0u != length_ ) finish_chunk(emit);
+                scanner_.reset();
+                offset_ = 0u;
+            }
+
+        private:
+            details::Scanner scanner_;
+            ::md5::details::Context ctx_;
+            std::uint64_t offset_ = 0u, length_ = 0u;
+
+            template <typename Emit>
+            void finish_chunk(Emit &emit)
+            {
+                emit(Record{ offset_, length_, ctx_.final() });
+                ctx_ = ::md5::details::Context();
+                offset_ += length_;
+                length_ = 0u;
+            }
+        };
+
+        // Chunks and hashes a whole buffer, finding cut points on this thread
+        // while up to 'threads' - 1 others hash the chunks found so far
+        inline std::vector<Record> chunk_memory(char unsigned const *const data, std::size_t const len,
+                                                Params const &params = Params(),
+                                                unsigned const threads = std::thread::hardware_concurrency())
+        {
+            details::check(params);
+            std::vector<Record> records(static_cast<std::size_t>(len / (0u != params.min_size ? params.min_size : 1u) + 1u));
+            std::mutex mutex;
+            std::condition_variable ready;
+            std::size_t found = 0u, next = 0u;
+            bool done = false;
+
+            // Hashes the chunks found so far, sleeping while there are none,
+            // until the scan is done
+            auto const hash = [&](void) {
+                std::unique_lock<std::mutex> lock(mutex);
+                for ( ;; )
+                {
+                    ready.wait(lock, [&] { return next < found || done; });
+                    if ( next >= found ) return;
+                    std::size_t const i = next++;
+                    lock.unlock();
+                    records[i].digest = ::md5::compute(data + records[i].offset, static_cast<std::size_t>(records[i].length));
+                    lock.lock();
+                }
+            };
+
+            std::vector<std::thread> pool;
+            for ( unsigned t = 1u; t < threads; ++t ) pool.emplace_back(hash);
+
+            details::Scanner scanner(params);
+            std::size_t count = 0u;
+            for ( std::size_t offset = 0u; offset < len; )
+            {
+                bool cut;
+                std::size_t const n = scanner.scan(data + offset, len - offset, cut);
+                records[count] = Record{ offset, n, Digest{} };
+                if ( pool.empty() )
+                {
+                    records[count].digest = ::md5::compute(data + offset, n);
+                }
+                else
+                {
+                    { std::lock_guard<std::mutex> const lock(mutex); found = count + 1u; }
+                    ready.notify_one();
+                }
+                offset += n;
+                ++count;
+            }
+            {
+                std::lock_guard<std::mutex> const lock(mutex);
+                done = true;
+            }
+            ready.notify_all();
+            if ( !pool.empty() ) hash();
+            for ( std::thread &t : pool ) t.join();
+
+            records.resize(count);
+            return records;
+        }
+
+    }  // close namespace 'chunker'
+}  // close namespace 'md5'
+
+#endif  // HEADER_INCLUSION_GUARD
@@ -0,0 +1,275 @@
+#ifndef HEADER_INCLUSION_GUARD_40687215519930264418057397326602315874109
+#define HEADER_INCLUSION_GUARD_40687215519930264418057397326602315874109
+
+// Verified copies: files are copied and checked against the MD5 of their
+// source, without reading anything more than once (POSIX only).
+//
+//   1. The source is read once, in large aligned blocks. Each block is
+//      hashed and written from the same buffer, the write of one block
+//      overlapping the read of the next.
+//   2. The copy goes to "<destination>.md5copy.tmp" and is synced to disk.
+//   3. It is read back with O_DIRECT (or, where the filesystem doesn't
+//      allow that, after dropping it from the page cache), so the check
+//      sees what's on the device and not the pages just written.
+//   4. Only when both digests agree does it get the mode and times of the
+//      source and is renamed to the destination. Otherwise it's removed.
+//
+// Files are copied on 'threads' threads. Every result carries the digest,
+// so a manifest of the destination comes for free (md5sum format, the
+// same that md5_scrub.hpp checks).
+
+#include <cerrno>        // errno
+#include <cstdint>       // uint64_t
+#include <cstdio>        // FILE, fopen, fprintf, rename, remove
+#include <cstring>       // memcmp, strcmp
+#include <exception>     // exception
+#include <functional>    // function
+#include <future>        // async, future
+#include <mutex>         // mutex, lock_guard
+#include <stdexcept>     // invalid_argument
+#include <string>        // string
+#include <system_error>  // system_error
+#include <thread>        // hardware_concurrency
+#include <vector>        // vector
+#include <dirent.h>      // opendir, readdir
+#include <fcntl.h>       // open, O_DIRECT, posix_fadvise
+#include <sys/stat.h>    // fstat, fchmod, futimens
+#include <unistd.h>      // fsync
+#include "md5.hpp"
+#include "md5_file.hpp"
+#include "md5_util.hpp"
+
+namespace md5 {
+    namespace copy {
+
+        struct Options {
+            unsigned threads = std::thread::hardware_concurrency();  // files copied at once
+            std::size_t block_size = 4u * 1024u * 1024u;             // a multiple of 4096
+            bool verify = true;                                      // read the copy back
+            bool direct = true;                                      // ... with O_DIRECT
+        };
+
+        struct Job {
+            std::string source, destination;
+        };
+
+        enum class Status { ok, mismatch, error };
+
+        struct Result {
+            Job job;
+            Status status = Status::error;
+            Digest digest = {};         // of the source
+            std::uint64_t bytes = 0u;
+            std::string message;        // for errors
+        };
+
+        namespace details {
+
+            inline void drop_cache(int const fd) noexcept
+            {
+#if defined(POSIX_FADV_DONTNEED) && !defined(__APPLE__)
+                ::posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+#else
+                (void)fd;
+#endif
+            }
+
+            // Reads back what 'path' holds on the device
+            inline Digest hash_uncached(std::string const &path, std::size_t const block_size, bool const direct, std::uint64_t &bytes)
+            {
+                int fd = -1;
+#ifdef O_DIRECT
+                if ( direct ) fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC | O_DIRECT);
+#endif
+                if ( -1 == fd ) fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);  // e.g. tmpfs doesn't support O_DIRECT
+                if ( -1 == fd ) throw std::system_error(errno, std::generic_category(), path);
+                file::Fd const owner(fd);
+                drop_cache(fd);  // the copy was synced, so none of its pages are dirty
+
+                file::AlignedBuffer const buffer = file::aligned_buffer(block_size);
+                ::md5::details::Context ctx;
+                bytes = 0u;
+                for ( ;; )
+                {
+                    std::size_t const n = file::read_aligned(fd, buffer.get(), block_size, bytes);
+                    ctx.append(buffer.get(), n);
+                    bytes += n;
+                    if ( n < block_size ) break;
+                }
+                return ctx.final();
+            }
+
+            // Reads, hashes and writes one block after another; the write of a
+            // block runs while the next one is read
+            inline Digest copy_data(int const src, int const dst, std::size_t const block_size, std::string const &what, std::uint64_t &bytes)
+            {
+                file::AlignedBuffer const buffers[2] = { file::aligned_buffer(block_size), file::aligned_buffer(block_size) };
+                ::md5::details::Context ctx;
+                std::future<void> writing;
+                bytes = 0u;
+                for ( unsigned i = 0u;; i ^= 1u )
+                {
+                    char unsigned *const buffer = buffers[i].get();  // not the one being written
+                    std::size_t const n = file::read_at(src, buffer, block_size, bytes);
+                    ctx.append(buffer, n);
+                    if ( writing.valid() ) writing.get();
+                    if ( 0u != n )
+                    {
+                        std::uint64_t const offset = bytes;
+                        writing = std::async(std::launch::async, [=]() { file::write_all(dst, buffer, n, offset, what); });
+                    }
+                    bytes += n;
+                    if ( n < block_size ) break;
+                }
+                if ( writing.valid() ) writing.get();
+                return ctx.final();
+            }
+        }
+
+        namespace details {
+
+            inline void check(Options const &options)
+            {
+                if ( 0u == options.block_size || 0u != options.block_size % file::alignment ) throw std::invalid_argument("md5::copy: block size must be a multiple of 4096");
+            }
+        }
+
+        // Copies one file. Bad options throw std::invalid_argument; anything
+        // that goes wrong with the file itself is reported in the result.
+        inline Result copy_file(Job const &job, Options const &options = Options())
+        {
+            details::check(options);
+            Result result;
+            result.job = job;
+            std::string const temp = job.destination + ".md5copy.tmp";
+            bool created = false;
+            try
+            {
+                file::Fd const src = file::open_read(job.source.c_str());
+                struct stat st;
+                if ( 0 != ::fstat(src.get(), &st) ) throw std::system_error(errno, std::generic_category(), job.source);
+#if defined(POSIX_FADV_SEQUENTIAL) && !defined(__APPLE__)
+                ::posix_fadvise(src.get(), 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+                int const fd = ::open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+                if ( -1 == fd ) throw std::system_error(errno, std::generic_category(), temp);
+                file::Fd const dst(fd);
+                created = true;
+
+                result.digest = details::copy_data(src.get(), dst.get(), options.block_size, temp, result.bytes);
+                if ( 0 != ::fsync(dst.get()) ) throw std::system_error(errno, std::generic_category(), temp);
+                details::drop_cache(src.get());
+
+                if ( options.verify )
+                {
+                    std::uint64_t bytes = 0u;
+                    Digest const check = details::hash_uncached(temp, options.block_size, options.direct, bytes);
+                    if ( bytes != result.bytes || 0 != std::memcmp(check.b, result.digest.b, Digest::count) )
+                    {
+                        std::remove(temp.c_str());
+                        result.status = Status::mismatch;
+                        return result;
+                    }
+                }
+
+#ifdef __APPLE__
+                struct timespec const times[2] = { st.st_atimespec, st.st_mtimespec };
+#else
+                struct timespec const times[2] = { st.st_atim, st.st_mtim };
+#endif
+                if ( 0 != ::fchmod(dst.get(), st.st_mode & 07777) || 0 != ::futimens(dst.get(), times) ) throw std::system_error(errno, std::generic_category(), temp);
+                if ( 0 != std::rename(temp.c_str(), job.destination.c_str()) ) throw std::system_error(errno, std::generic_category(), job.destination);
+                result.status = Status::ok;
+            }
+            catch ( std::exception const &error )  // e.g. also bad_alloc for the buffers
+            {
+                if ( created ) std::remove(temp.c_str());
+                result.status = Status::error;
+                result.message = error.what();
+            }
+            return result;
+        }
+
+        // Called once per file as it's done, one call at a time
+        using Progress = std::function<void(Result const &)>;
+
+        inline std::vector<Result> copy_files(std::vector<Job> const &jobs, Options const &options = Options(), Progress const &progress = Progress())
+        {
+            details::check(options);
+            std::vector<Result> results(jobs.size());
+            std::mutex mutex;
+            util::parallel_for(jobs.size(), options.threads, [&](std::size_t const i) {
+                results[i] = copy_file(jobs[i], options);
+                if ( !progress ) return;
+                std::lock_guard<std::mutex> const lock(mutex);
+                progress(results[i]);
+            });
+            return results;
+        }
+
+        namespace details {
+
+            inline void plan_dir(std::string const &src, std::string const &dst, std::vector<Job> &jobs, std::vector<std::string> &skipped)
+            {
+                file::make_dir(dst);
+                DIR *const d = ::opendir(src.c_str());
+                if ( nullptr == d ) throw std::system_error(errno, std::generic_category(), src);
+                while ( dirent const *const e = ::readdir(d) )
+                {
+                    if ( 0 == std::strcmp(e->d_name, ".") || 0 == std::strcmp(e->d_name, "..") ) continue;
+                    std::string const from = src + '/' + e->d_name, to = dst + '/' + e->d_name;
+                    struct stat st;
+                    if ( 0 != ::lstat(from.c_str(), &st) ) skipped.push_back(from);
+                    else if ( S_ISDIR(st.st_mode) ) plan_dir(from, to, jobs, skipped);
+                    else if ( S_ISREG(st.st_mode) ) jobs.push_back(Job{ from, to });
+                    else skipped.push_back(from);  // links, devices, sockets, ...
+                }
+                ::closedir(d);
+            }
+        }
+
+        // The jobs to copy 'source' to 'destination' the way cp -r would:
+        // a file into a directory keeps its name, and a directory is copied
+        // recursively, creating the directories on the way. Anything that
+        // isn't a regular file or a directory is listed in 'skipped'.
+        inline std::vector<Job> plan(std::string const &source, std::string destination, std::vector<std::string> *const skipped = nullptr)
+        {
+            std::vector<Job> jobs;
+            std::vector<std::string> others;
+            struct stat st, dst_st;
+            if ( 0 != ::stat(source.c_str(), &st) ) throw std::system_error(errno, std::generic_category(), source);
+            bool const into_dir = (0 == ::stat(destination.c_str(), &dst_st) && S_ISDIR(dst_st.st_mode));
+            if ( into_dir )
+            {
+                std::size_t const slash = source.find_last_of('/', source.find_last_not_of('/'));
+                std::string name = (std::string::npos == slash) ? source : source.substr(slash + 1u);
+                while ( !name.empty() && '/' == name.back() ) name.pop_back();
+                destination += '/' + name;
+            }
+            if ( S_ISDIR(st.st_mode) ) details::plan_dir(source, destination, jobs, others);
+            else if ( S_ISREG(st.st_mode) ) jobs.push_back(Job{ source, destination });
+            else others.push_back(source);
+            if ( nullptr != skipped ) skipped->insert(skipped->end(), others.begin(), others.end());
+            return jobs;
+        }
+
+        // Writes the digests of the files copied successfully as md5sum
+        // output, by destination path
+        inline void save_manifest(std::vector<Result> const &results, char const *const path)
+        {
+            std::FILE *const f = std::fopen(path, "w");
+            if ( nullptr == f ) throw std::system_error(errno, std::generic_category(), path);
+            for ( Result const &r : results )
+            {
+                if ( Status::ok == r.status ) std::fprintf(f, "%s  %s\n", util::hex(r.digest).c_str(), r.job.destination.c_str());
+            }
+            int const error = errno;
+            bool const ok = (0 == std::ferror(f));
+            if ( 0 != std::fclose(f) || !ok ) throw std::system_error(error, std::generic_category(), path);
+        }
+
+    }  // close namespace 'copy'
+}  // close namespace 'md5'
+
+#endif  // HEADER_INCLUSION_GUARD
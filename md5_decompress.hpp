@@ -0,0 +1,540 @@
+#ifndef HEADER_INCLUSION_GUARD_83071926544810392157364920847713056201938
+#define HEADER_INCLUSION_GUARD_83071926544810392157364920847713056201938
+
+// The MD5 of the uncompressed contents of gzip and zstd files, computed
+// in process instead of with "zcat | md5sum" (POSIX only).
+//
+// One thread decompresses into a ring of buffers while the calling thread
+// hashes them in order, so both run at once without a pipe in between.
+// zstd files made of many frames (e.g. by pzstd or by appending) are
+// decompressed on several threads, a frame each, when the file can be
+// mapped and every frame states a content size of at most 'max_frame';
+// the hashing still sees the frames in order, and at most threads + 2
+// frames are held at once. Everything else, including pipes, goes through
+// the streaming decoder. gzip files may hold several members, and NUL
+// bytes after the last one are ignored as padding, as zcat does.
+//
+// Decoders are built in on request, as they need linking against their
+// library:
+//     -DMD5_ENABLE_ZLIB   gzip, link with -lz
+//     -DMD5_ENABLE_ZSTD   zstd, link with -lzstd
+// A format whose decoder isn't built in throws std::runtime_error, as do
+// corrupt inputs. Read errors throw std::system_error.
+
+#include <atomic>              // atomic
+#include <cerrno>              // errno
+#include <condition_variable>  // condition_variable
+#include <cstdint>             // uint64_t
+#include <cstring>             // memcmp, memcpy
+#include <exception>           // exception_ptr
+#include <mutex>               // mutex, unique_lock
+#include <new>                 // bad_alloc
+#include <stdexcept>           // runtime_error
+#include <string>              // string
+#include <system_error>        // system_error
+#include <thread>              // thread, hardware_concurrency
+#include <vector>              // vector
+#include <fcntl.h>             // posix_fadvise
+#include <sys/mman.h>          // mmap, munmap, madvise
+#include <sys/stat.h>          // fstat
+#include <unistd.h>            // read, lseek
+#include "md5.hpp"
+#include "md5_file.hpp"
+
+#ifdef MD5_ENABLE_ZLIB
+#   if defined(__has_include)
+#       if !__has_include(<zlib.h>)
+#           error "MD5_ENABLE_ZLIB needs zlib.h"
+#       endif
+#   endif
+#   include <zlib.h>  // inflate
+#endif
+#ifdef MD5_ENABLE_ZSTD
+#   if defined(__has_include)
+#       if !__has_include(<zstd.h>)
+#           error "MD5_ENABLE_ZSTD needs zstd.h"
+#       endif
+#   endif
+#   include <zstd.h>  // ZSTD_decompressStream
+#endif
+
+namespace md5 {
+    namespace decompress {
+
+        enum class Format { automatic, none, gzip, zstd };
+
+        struct Options {
+            Format format = Format::automatic;                       // 'automatic' goes by the magic number
+            unsigned threads = std::thread::hardware_concurrency();  // for zstd frames
+            std::size_t slots = 8u;                                  // buffers between decoding and hashing
+            std::size_t max_frame = 32u * 1024u * 1024u;             // largest frame decoded on its own
+        };
+
+        struct Stats {
+            Format format = Format::none;
+            std::uint64_t bytes = 0u;   // uncompressed
+            std::uint64_t frames = 0u;  // zstd frames decoded in parallel, 0 when streaming
+        };
+
+        // Whether the decoder for 'format' is built in
+        constexpr bool supported(Format const format) noexcept
+        {
+#ifndef MD5_ENABLE_ZLIB
+            if ( Format::gzip == format ) return false;
+#endif
+#ifndef MD5_ENABLE_ZSTD
+            if ( Format::zstd == format ) return false;
+#endif
+            return Format::automatic != format;
+        }
+
+        namespace details {
+
+            // Buffers handed over in order from producers to one consumer.
+            // Buffer 'seq' lives in slot seq % slots, and a producer waits
+            // until the consumer is done with the one before it there.
+            class Ring {
+            public:
+                explicit Ring(std::size_t const slots) : slots_(0u != slots ? slots : 1u)
+                {
+                    for ( std::size_t i = 0u; i < slots_.size(); ++i ) slots_[i].seq = i;
+                }
+
+                // The buffer to fill for 'seq', or nullptr if the ring was stopped
+                std::vector<char unsigned> *acquire(std::uint64_t const seq)
+                {
+                    Slot &slot = slots_[static_cast<std::size_t>(seq % slots_.size())];
+                    std::unique_lock<std::mutex> lock(mutex_);
+                    changed_.wait(lock, [&]() { return stopped_ || slot.seq == seq; });
+                    return stopped_ ? nullptr : &slot.data;
+                }
+
+                void publish(std::uint64_t const seq, std::size_t const length)
+                {
+                    Slot &slot = slots_[static_cast<std::size_t>(seq % slots_.size())];
+                    std::lock_guard<std::mutex> const lock(mutex_);
+                    slot.length = length;
+                    slot.ready = true;
+                    changed_.notify_all();
+                }
+
+                // No buffers from 'count' on
+                void close(std::uint64_t const count)
+                {
+                    std::lock_guard<std::mutex> const lock(mutex_);
+                    count_ = count;
+                    changed_.notify_all();
+                }
+
+                void fail(std::exception_ptr const error)
+                {
+                    std::lock_guard<std::mutex> const lock(mutex_);
+                    if ( !error_ ) error_ = error;
+                    stopped_ = true;
+                    changed_.notify_all();
+                }
+
+                void stop(void)
+                {
+                    std::lock_guard<std::mutex> const lock(mutex_);
+                    stopped_ = true;
+                    changed_.notify_all();
+                }
+
+                // Passes every buffer in order to fn(data, len), then rethrows
+                // the error of a producer if there was one
+                template <typename Fn>
+                void consume(Fn const &fn)
+                {
+                    for ( std::uint64_t seq = 0u;; ++seq )
+                    {
+                        Slot &slot = slots_[static_cast<std::size_t>(seq % slots_.size())];
+                        {
+                            std::unique_lock<std::mutex> lock(mutex_);
+                            changed_.wait(lock, [&]() { return stopped_ || seq >= count_ || (slot.seq == seq && slot.ready); });
+                            if ( error_ ) std::rethrow_exception(error_);
+                            if ( stopped_ || seq >= count_ ) return;
+                        }
+                        fn(slot.data.data(), slot.length);
+                        std::lock_guard<std::mutex> const lock(mutex_);
+                        slot.seq = seq + slots_.size();
+                        slot.ready = false;
+                        changed_.notify_all();
+                    }
+                }
+
+            private:
+                struct Slot {
+                    std::vector<char unsigned> data;
+                    std::size_t length = 0u;
+                    std::uint64_t seq = 0u;
+                    bool ready = false;
+                };
+                std::vector<Slot> slots_;
+                std::mutex mutex_;
+                std::condition_variable changed_;
+                std::uint64_t count_ = ~std::uint64_t(0u);
+                std::exception_ptr error_;
+                bool stopped_ = false;
+            };
+
+            // Sequential reading of the compressed input, which may be a pipe
+            class Input {
+            public:
+                explicit Input(int const fd) : fd_(fd), buffer_(file::buffer_size) {}
+
+                // What's left of the current buffer, refilled when empty; empty at the end
+                std::size_t fill(void)
+                {
+                    if ( pos_ < end_ || eof_ ) return end_ - pos_;
+                    for ( ;; )
+                    {
+                        ssize_t const n = ::read(fd_, buffer_.data(), buffer_.size());
+                        if ( n < 0 && EINTR == errno ) continue;
+                        if ( n < 0 ) throw std::system_error(errno, std::generic_category(), "read");
+                        pos_ = 0u;
+                        end_ = static_cast<std::size_t>(n);
+                        eof_ = (0 == n);
+                        return end_;
+                    }
+                }
+
+                // Reads ahead enough to tell the format, without consuming anything
+                std::size_t peek(char unsigned *const out, std::size_t const n)
+                {
+                    while ( end_ < n && !eof_ )
+                    {
+                        ssize_t const got = ::read(fd_, buffer_.data() + end_, buffer_.size() - end_);
+                        if ( got < 0 && EINTR == errno ) continue;
+                        if ( got < 0 ) throw std::system_error(errno, std::generic_category(), "read");
+                        if ( 0 == got ) { eof_ = true; break; }
+                        end_ += static_cast<std::size_t>(got);
+                    }
+                    std::size_t const have = (end_ < n) ? end_ : n;
+                    std::memcpy(out, buffer_.data(), have);
+                    return have;
+                }
+
+                char unsigned *data(void) noexcept { return buffer_.data() + pos_; }
+                void consume(std::size_t const n) noexcept { pos_ += n; }
+
+            private:
+                int fd_;
+                std::vector<char unsigned> buffer_;
+                std::size_t pos_ = 0u, end_ = 0u;
+                bool eof_ = false;
+            };
+
+            inline Format detect(char unsigned const *const p, std::size_t const n) noexcept
+            {
+                if ( n >= 2u && 0x1fu == p[0] && 0x8bu == p[1] ) return Format::gzip;
+                if ( n >= 4u && 0 == std::memcmp(p, "\x28\xb5\x2f\xfd", 4u) ) return Format::zstd;
+                if ( n >= 4u && 0x50u == (p[0] & 0xf0u) && 0 == std::memcmp(p + 1u, "\x2a\x4d\x18", 3u) ) return Format::zstd;  // skippable frame first
+                return Format::none;
+            }
+
+            // Decodes 'in' into the ring, one full buffer after another
+            template <typename Decode>
+            void produce(Ring &ring, Decode const &decode)
+            {
+                std::uint64_t seq = 0u;
+                try
+                {
+                    std::vector<char unsigned> *buffer = ring.acquire(seq);
+                    if ( nullptr == buffer ) return;
+                    buffer->resize(file::buffer_size);
+                    std::size_t used = 0u;
+                    // decode(out, room) writes up to 'room' bytes and returns how many; 0 at the end
+                    for ( ;; )
+                    {
+                        std::size_t const n = decode(buffer->data() + used, buffer->size() - used);
+                        used += n;
+                        if ( 0u != n && used < buffer->size() ) continue;
+                        if ( 0u != used )
+                        {
+                            ring.publish(seq++, used);
+                            used = 0u;
+                            if ( nullptr == (buffer = ring.acquire(seq)) ) return;
+                            buffer->resize(file::buffer_size);
+                        }
+                        if ( 0u == n ) break;
+                    }
+                    ring.close(seq);
+                }
+                catch ( ... )
+                {
+                    ring.fail(std::current_exception());
+                }
+            }
+
+            template <typename Decode>
+            Digest hash_stream(Decode const &decode, Options const &options, Stats &stats)
+            {
+                Ring ring(options.slots);
+                std::thread decoder([&]() { produce(ring, decode); });
+                ::md5::details::Context ctx;
+                try
+                {
+                    ring.consume([&](char unsigned const *const data, std::size_t const len) {
+                        ctx.append(data, len);
+                        stats.bytes += len;
+                    });
+                }
+                catch ( ... )
+                {
+                    decoder.join();
+                    throw;
+                }
+                decoder.join();
+                return ctx.final();
+            }
+
+#ifdef MD5_ENABLE_ZLIB
+            inline Digest hash_gzip(Input &in, Options const &options, Stats &stats)
+            {
+                z_stream z = {};
+                if ( Z_OK != ::inflateInit2(&z, 16 + MAX_WBITS) ) throw std::runtime_error("md5::decompress: inflateInit2 failed");
+                bool member_ended = false, padding = false;
+                struct End { z_stream &z; ~End(void) { ::inflateEnd(&z); } } const end{ z };
+                return hash_stream([&](char unsigned *const out, std::size_t const room) -> std::size_t {
+                    z.next_out = out;
+                    z.avail_out = static_cast<uInt>(room);
+                    while ( 0u != z.avail_out )
+                    {
+                        std::size_t const have = in.fill();
+                        if ( 0u == have )
+                        {
+                            if ( !member_ended ) throw std::runtime_error("md5::decompress: truncated gzip data");
+                            break;
+                        }
+                        if ( member_ended && (padding || 0u == in.data()[0]) )
+                        {
+                            // NUL bytes after a member are padding (e.g. of a tape or
+                            // block device) up to the end, which zcat ignores as well
+                            padding = true;
+                            for ( std::size_t i = 0u; i < have; ++i ) if ( 0u != in.data()[i] ) throw std::runtime_error("md5::decompress: trailing garbage after gzip data");
+                            in.consume(have);
+                            continue;
+                        }
+                        if ( member_ended )
+                        {
+                            // Another member follows (e.g. concatenated .gz files)
+                            if ( Z_OK != ::inflateReset(&z) ) throw std::runtime_error("md5::decompress: inflateReset failed");
+                            member_ended = false;
+                        }
+                        z.next_in = in.data();
+                        z.avail_in = static_cast<uInt>(have);
+                        int const result = ::inflate(&z, Z_NO_FLUSH);
+                        in.consume(have - z.avail_in);
+                        if ( Z_STREAM_END == result ) member_ended = true;
+                        else if ( Z_OK != result && Z_BUF_ERROR != result ) throw std::runtime_error("md5::decompress: bad gzip data");
+                    }
+                    return room - z.avail_out;
+                }, options, stats);
+            }
+#endif
+
+#ifdef MD5_ENABLE_ZSTD
+            inline std::runtime_error zstd_error(char const *const what, std::size_t const code)
+            {
+                return std::runtime_error(std::string("md5::decompress: ") + what + ": " + ::ZSTD_getErrorName(code));
+            }
+
+            inline Digest hash_zstd_stream(Input &in, Options const &options, Stats &stats)
+            {
+                ZSTD_DStream *const z = ::ZSTD_createDStream();
+                if ( nullptr == z ) throw std::bad_alloc();
+                struct End { ZSTD_DStream *z; ~End(void) { ::ZSTD_freeDStream(z); } } const end{ z };
+                ::ZSTD_initDStream(z);
+                std::size_t pending = 0u;  // nonzero while a frame isn't complete
+                return hash_stream([&](char unsigned *const out, std::size_t const room) -> std::size_t {
+                    ZSTD_outBuffer o = { out, room, 0u };
+                    while ( o.pos < o.size )
+                    {
+                        std::size_t const have = in.fill();
+                        if ( 0u == have )
+                        {
+                            // A last call with no input flushes what the decoder still holds
+                            // (at a frame boundary it asks for the next header, which isn't an error)
+                            ZSTD_inBuffer i = { nullptr, 0u, 0u };
+                            std::size_t const left = o.pos;
+                            std::size_t const result = ::ZSTD_decompressStream(z, &o, &i);
+                            if ( ::ZSTD_isError(result) ) throw zstd_error("bad zstd data", result);
+                            if ( o.pos != left ) { pending = result; continue; }
+                            if ( 0u != pending ) throw std::runtime_error("md5::decompress: truncated zstd data");
+                            break;
+                        }
+                        ZSTD_inBuffer i = { in.data(), have, 0u };
+                        pending = ::ZSTD_decompressStream(z, &o, &i);
+                        if ( ::ZSTD_isError(pending) ) throw zstd_error("bad zstd data", pending);
+                        in.consume(i.pos);
+                    }
+                    return o.pos;
+                }, options, stats);
+            }
+
+            // The frames of a mapped zstd file, or nothing if it can't be
+            // decoded a frame at a time (one frame only, a frame without its
+            // content size or larger than 'max_frame')
+            struct Frame {
+                std::size_t offset, length;  // compressed
+                std::size_t size;            // decompressed, 0 for skippable frames
+            };
+
+            inline std::vector<Frame> split_frames(char unsigned const *const data, std::size_t const len, std::size_t const max_frame)
+            {
+                std::vector<Frame> frames;
+                std::size_t at = 0u, real = 0u;
+                while ( at < len )
+                {
+                    std::size_t const n = ::ZSTD_findFrameCompressedSize(data + at, len - at);
+                    if ( ::ZSTD_isError(n) ) throw zstd_error("bad zstd frame", n);
+                    unsigned long long const size = ::ZSTD_getFrameContentSize(data + at, len - at);
+                    if ( ZSTD_CONTENTSIZE_ERROR == size ) frames.push_back(Frame{ at, n, 0u });  // skippable
+                    else if ( ZSTD_CONTENTSIZE_UNKNOWN == size || size > max_frame ) return {};
+                    else frames.push_back(Frame{ at, n, static_cast<std::size_t>(size) }), ++real;
+                    at += n;
+                }
+                if ( real < 2u ) return {};
+                return frames;
+            }
+
+            inline Digest hash_zstd_frames(char unsigned const *const data, std::vector<Frame> const &frames, Options const &options, Stats &stats)
+            {
+                unsigned const threads = (0u != options.threads) ? options.threads : 1u;
+                Ring ring(static_cast<std::size_t>(threads) + 2u);
+                std::atomic<std::size_t> next{ 0u };
+                auto const worker = [&]() {
+                    ZSTD_DCtx *const z = ::ZSTD_createDCtx();
+                    try
+                    {
+                        if ( nullptr == z ) throw std::bad_alloc();
+                        for ( std::size_t f; (f = next.fetch_add(1u)) < frames.size(); )
+                        {
+                            std::vector<char unsigned> *const buffer = ring.acquire(f);
+                            if ( nullptr == buffer ) break;
+                            Frame const &frame = frames[f];
+                            buffer->resize(frame.size);
+                            std::size_t n = 0u;
+                            if ( 0u != frame.size )
+                            {
+                                n = ::ZSTD_decompressDCtx(z, buffer->data(), buffer->size(), data + frame.offset, frame.length);
+                                if ( ::ZSTD_isError(n) ) throw zstd_error("bad zstd frame", n);
+                                if ( n != frame.size ) throw std::runtime_error("md5::decompress: zstd frame shorter than stated");
+                            }
+                            ring.publish(f, n);
+                        }
+                    }
+                    catch ( ... )
+                    {
+                        ring.fail(std::current_exception());
+                    }
+                    ::ZSTD_freeDCtx(z);
+                };
+                ring.close(frames.size());
+
+                std::vector<std::thread> pool;
+                for ( unsigned t = 0u; t < threads && t < frames.size(); ++t ) pool.emplace_back(worker);
+                ::md5::details::Context ctx;
+                try
+                {
+                    ring.consume([&](char unsigned const *const p, std::size_t const len) {
+                        ctx.append(p, len);
+                        stats.bytes += len;
+                    });
+                }
+                catch ( ... )
+                {
+                    ring.stop();
+                    for ( std::thread &t : pool ) t.join();
+                    throw;
+                }
+                for ( std::thread &t : pool ) t.join();
+                stats.frames = frames.size();
+                return ctx.final();
+            }
+#endif
+        }
+
+        // The MD5 of what 'fd' decompresses to, read from its current offset
+        inline Digest hash(int const fd, Options const &options = Options(), Stats *const stats_out = nullptr)
+        {
+            Stats stats;
+#ifdef MD5_ENABLE_ZSTD
+            off_t const start = ::lseek(fd, 0, SEEK_CUR);  // before anything is read; -1 for pipes
+#endif
+            details::Input in(fd);
+            Format format = options.format;
+            if ( Format::automatic == format )
+            {
+                char unsigned magic[4];
+                format = details::detect(magic, in.peek(magic, sizeof magic));
+            }
+            stats.format = format;
+            if ( !supported(format) )
+            {
+                throw std::runtime_error(Format::gzip == format ? "md5::decompress: gzip input, but built without MD5_ENABLE_ZLIB"
+                                                                : "md5::decompress: zstd input, but built without MD5_ENABLE_ZSTD");
+            }
+
+            Digest digest = {};
+            switch ( format )
+            {
+#ifdef MD5_ENABLE_ZLIB
+            case Format::gzip:
+                digest = details::hash_gzip(in, options, stats);
+                break;
+#endif
+#ifdef MD5_ENABLE_ZSTD
+            case Format::zstd:
+            {
+                struct stat st;
+                if ( 0 == start && 0 == ::fstat(fd, &st) && S_ISREG(st.st_mode) && st.st_size > 0 && options.threads > 1u )
+                {
+                    std::size_t const len = static_cast<std::size_t>(st.st_size);
+                    void *const map = ::mmap(nullptr, len, PROT_READ, MAP_SHARED, fd, 0);
+                    if ( MAP_FAILED != map )
+                    {
+                        struct Unmap { void *p; std::size_t n; ~Unmap(void) { ::munmap(p, n); } } const unmap{ map, len };
+#ifdef MADV_SEQUENTIAL
+                        ::madvise(map, len, MADV_SEQUENTIAL);
+#endif
+                        char unsigned const *const data = static_cast<char unsigned const *>(map);
+                        std::vector<details::Frame> const frames = details::split_frames(data, len, options.max_frame);
+                        if ( !frames.empty() )
+                        {
+                            digest = details::hash_zstd_frames(data, frames, options, stats);
+                            break;
+                        }
+                    }
+                }
+                digest = details::hash_zstd_stream(in, options, stats);
+                break;
+            }
+#endif
+            default:
+                digest = details::hash_stream([&](char unsigned *const out, std::size_t const room) -> std::size_t {
+                    std::size_t const n = (in.fill() < room) ? in.fill() : room;
+                    std::memcpy(out, in.data(), n);
+                    in.consume(n);
+                    return n;
+                }, options, stats);
+                break;
+            }
+            if ( nullptr != stats_out ) *stats_out = stats;
+            return digest;
+        }
+
+        inline Digest hash(char const *const path, Options const &options = Options(), Stats *const stats_out = nullptr)
+        {
+            file::Fd const fd = file::open_read(path);
+#if defined(POSIX_FADV_SEQUENTIAL) && !defined(__APPLE__)
+            ::posix_fadvise(fd.get(), 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+            return hash(fd.get(), options, stats_out);
+        }
+
+    }  // close namespace 'decompress'
+}  // close namespace 'md5'
+
+#endif  // HEADER_INCLUSION_GUARD
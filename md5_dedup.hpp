@@ -0,0 +1,364 @@
+#ifndef HEADER_INCLUSION_GUARD_92005182736406651370091288835529616034577
+#define HEADER_INCLUSION_GUARD_92005182736406651370091288835529616034577
+
+// Finds files with identical contents under a set of directories while
+// reading as little as possible (POSIX only).
+//
+//   1. Files are grouped by size; a file with a unique size can't have a
+//      duplicate and is never opened. Hard links to the same inode count
+//      as one file.
+//   2. For the remaining files only the first and last 'edge' bytes are
+//      hashed. For files no larger than two edges this covers the whole
+//      file and is final.
+//   3. Only files whose size and partial digest still match another file
+//      are hashed in full.
+//
+// Stages 2 and 3 hash files on 'threads' threads. Files that can't be
+// read (e.g. permissions, or removed during the scan) are skipped and
+// counted in Stats::errors.
+//
+// 'reclaim' can then turn a group of duplicates into hard links to the
+// first file, or share their extents with FIDEDUPERANGE (Linux; the
+// kernel compares the contents again before sharing anything). Files it
+// has to leave alone are reported, not thrown about. Hard links are only
+// made while both files still have the size and times they had when
+// they were found; otherwise the file is reported as changed.
+
+#include <algorithm>     // sort, unique, remove_if
+#include <atomic>        // atomic
+#include <cerrno>        // errno
+#include <cstdint>       // uint64_t
+#include <cstdio>        // rename, remove
+#include <cstring>       // memcmp, strcmp
+#include <string>        // string
+#include <system_error>  // system_error
+#include <thread>        // thread, hardware_concurrency
+#include <utility>       // move
+#include <vector>        // vector
+#include <dirent.h>      // opendir, readdir
+#include <fcntl.h>       // open
+#include <sys/stat.h>    // lstat
+#include <unistd.h>      // link
+#ifdef __linux__
+#   include <linux/fs.h>   // FIDEDUPERANGE
+#   include <sys/ioctl.h>  // ioctl
+#endif
+#include "md5_file.hpp"
+#include "md5_util.hpp"
+
+namespace md5 {
+    namespace dedup {
+
+        struct Options {
+            unsigned threads = std::thread::hardware_concurrency();
+            std::uint64_t edge = 64u * 1024u;  // bytes hashed at each end in stage 2
+            bool include_empty = false;        // report empty files as duplicates of each other
+        };
+
+        struct Stats {
+            std::uint64_t files = 0u;       // regular files found
+            std::uint64_t candidates = 0u;  // files that shared their size with another
+            std::uint64_t full_hashes = 0u; // files hashed in full in stage 3
+            std::uint64_t bytes_read = 0u;  // holes of sparse files are hashed without being read
+            std::uint64_t errors = 0u;
+        };
+
+        // A file as it was found, before it was hashed
+        struct File {
+            std::string path;
+            std::uint64_t size;
+            dev_t dev;
+            ino_t ino;
+            std::int64_t mtime_ns, ctime_ns;
+        };
+
+        namespace details {
+
+            struct Entry {
+                std::string path;
+                std::uint64_t size;
+                dev_t dev;
+                ino_t ino;
+                std::int64_t mtime_ns, ctime_ns;
+                Digest digest;  // partial, then full
+                bool ok;
+            };
+
+            inline std::int64_t mtime_ns(struct stat const &st) noexcept
+            {
+#ifdef __APPLE__
+                return static_cast<std::int64_t>(st.st_mtimespec.tv_sec) * 1000000000 + st.st_mtimespec.tv_nsec;
+#else
+                return static_cast<std::int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+            }
+
+            inline std::int64_t ctime_ns(struct stat const &st) noexcept
+            {
+#ifdef __APPLE__
+                return static_cast<std::int64_t>(st.st_ctimespec.tv_sec) * 1000000000 + st.st_ctimespec.tv_nsec;
+#else
+                return static_cast<std::int64_t>(st.st_ctim.tv_sec) * 1000000000 + st.st_ctim.tv_nsec;
+#endif
+            }
+
+            // Whether 'path' is still the file that was found, as far as its
+            // size and times tell; a file linked to since then has a new
+            // ctime, so that one can be ignored
+            inline bool unchanged(File const &f, bool const check_ctime)
+            {
+                struct stat st;
+                if ( 0 != ::lstat(f.path.c_str(), &st) ) throw std::system_error(errno, std::generic_category(), f.path);
+                return S_ISREG(st.st_mode) && st.st_dev == f.dev && st.st_ino == f.ino && static_cast<std::uint64_t>(st.st_size) == f.size
+                       && mtime_ns(st) == f.mtime_ns && (!check_ctime || ctime_ns(st) == f.ctime_ns);
+            }
+
+            inline void walk(std::string const &dir, std::vector<Entry> &out, Stats &stats)
+            {
+                DIR *const d = ::opendir(dir.c_str());
+                if ( nullptr == d ) { ++stats.errors; return; }
+                while ( dirent const *const e = ::readdir(d) )
+                {
+                    if ( 0 == std::strcmp(e->d_name, ".") || 0 == std::strcmp(e->d_name, "..") ) continue;
+                    std::string path = dir + '/' + e->d_name;
+                    struct stat st;
+                    if ( 0 != ::lstat(path.c_str(), &st) ) { ++stats.errors; continue; }
+                    if ( S_ISDIR(st.st_mode) ) walk(path, out, stats);
+                    else if ( S_ISREG(st.st_mode) ) out.push_back(Entry{ std::move(path), static_cast<std::uint64_t>(st.st_size), st.st_dev, st.st_ino, mtime_ns(st), ctime_ns(st), Digest{}, true });
+                }
+                ::closedir(d);
+            }
+
+            using util::parallel_for;
+
+            inline bool same_key(Entry const &a, Entry const &b) noexcept
+            {
+                return a.size == b.size && 0 == std::memcmp(a.digest.b, b.digest.b, Digest::count);
+            }
+
+            // Sorts 'entries' by size and digest, and keeps only the ones that
+            // have at least one other entry with the same size and digest
+            inline void keep_matching(std::vector<Entry> &entries)
+            {
+                std::sort(entries.begin(), entries.end(), [](Entry const &a, Entry const &b) {
+                    if ( a.size != b.size ) return a.size < b.size;
+                    return std::memcmp(a.digest.b, b.digest.b, Digest::count) < 0;
+                });
+                std::vector<Entry> kept;
+                for ( std::size_t i = 0u, j; i < entries.size(); i = j )
+                {
+                    for ( j = i + 1u; j < entries.size() && same_key(entries[i], entries[j]); ++j ) {}
+                    if ( j - i < 2u ) continue;
+                    for ( std::size_t k = i; k < j; ++k ) kept.push_back(std::move(entries[k]));
+                }
+                entries.swap(kept);
+            }
+
+            inline void hash_all(std::vector<Entry> &entries, unsigned const threads, bool const partial,
+                                 std::uint64_t const edge, Stats &stats)
+            {
+                std::atomic<std::uint64_t> bytes{ 0u }, errors{ 0u };
+                parallel_for(entries.size(), threads, [&](std::size_t const i) {
+                    Entry &e = entries[i];
+                    try
+                    {
+                        file::Fd const fd = file::open_read(e.path.c_str());
+                        ::md5::details::Context ctx;
+                        std::uint64_t n, read = 0u;  // holes count towards 'n' but aren't read
+                        if ( partial && e.size > 2u * edge )
+                        {
+                            n  = file::append_range(ctx, fd.get(), 0u, edge, &read);
+                            n += file::append_range(ctx, fd.get(), e.size - edge, edge, &read);
+                        }
+                        else
+                        {
+                            n = file::append_range(ctx, fd.get(), 0u, e.size, &read);
+                        }
+                        e.digest = ctx.final();
+                        e.ok = (n == (partial && e.size > 2u * edge ? 2u * edge : e.size));  // short if the file shrank meanwhile
+                        bytes += read;
+                    }
+                    catch ( std::system_error const & )
+                    {
+                        e.ok = false;
+                    }
+                    if ( !e.ok ) ++errors;
+                });
+                stats.bytes_read += bytes;
+                stats.errors += errors;
+                entries.erase(std::remove_if(entries.begin(), entries.end(), [](Entry const &e) { return !e.ok; }), entries.end());
+            }
+        }
+
+        // Returns groups of two or more files with identical contents
+        inline std::vector<std::vector<File>> find_duplicates(std::vector<std::string> const &roots,
+                                                                     Options const &options = Options(),
+                                                                     Stats *const stats_out = nullptr)
+        {
+            Stats stats;
+            std::vector<details::Entry> entries;
+            for ( std::string const &root : roots ) details::walk(root, entries, stats);
+            stats.files = entries.size();
+
+            // Stage 1: drop other links to an inode already listed, then
+            // keep sizes that occur more than once
+            std::sort(entries.begin(), entries.end(), [](details::Entry const &a, details::Entry const &b) {
+                return (a.dev != b.dev) ? a.dev < b.dev : a.ino < b.ino;
+            });
+            entries.erase(std::unique(entries.begin(), entries.end(), [](details::Entry const &a, details::Entry const &b) {
+                return a.dev == b.dev && a.ino == b.ino;
+            }), entries.end());
+            if ( !options.include_empty )
+            {
+                entries.erase(std::remove_if(entries.begin(), entries.end(), [](details::Entry const &e) { return 0u == e.size; }), entries.end());
+            }
+            details::keep_matching(entries);  // all digests are still zero, so this groups by size
+            stats.candidates = entries.size();
+
+            // Stage 2: the ends of each file
+            details::hash_all(entries, options.threads, true, options.edge, stats);
+            details::keep_matching(entries);
+
+            // Stage 3: whole files, for those not already covered by stage 2
+            std::vector<details::Entry> large;
+            for ( auto it = entries.begin(); it != entries.end(); )
+            {
+                if ( it->size > 2u * options.edge ) { large.push_back(std::move(*it)); it = entries.erase(it); }
+                else ++it;
+            }
+            stats.full_hashes = large.size();
+            details::hash_all(large, options.threads, false, options.edge, stats);
+            details::keep_matching(large);
+            for ( details::Entry &e : large ) entries.push_back(std::move(e));
+            details::keep_matching(entries);
+
+            std::vector<std::vector<File>> groups;
+            for ( std::size_t i = 0u; i < entries.size(); ++i )
+            {
+                details::Entry &e = entries[i];
+                if ( 0u == i || !details::same_key(entries[i - 1u], e) ) groups.emplace_back();
+                groups.back().push_back(File{ std::move(e.path), e.size, e.dev, e.ino, e.mtime_ns, e.ctime_ns });
+            }
+            if ( nullptr != stats_out ) *stats_out = stats;
+            return groups;
+        }
+
+        enum class Reclaim { hardlink, dedupe_range };
+
+        enum class Outcome {
+            shared,            // now shares its storage with the first file
+            other_filesystem,  // left alone, no file before it in the group is on its filesystem
+            changed            // left alone (with 'dedupe_range' from the first differing range on),
+                               // it or the first file changed since they were found
+        };
+
+        struct Reclaimed {
+            std::string path;
+            Outcome outcome;
+        };
+
+        // Makes every file of 'group' after the first share its storage with
+        // the first, and returns what became of each of them. With
+        // 'hardlink' each file is atomically replaced by a link to the
+        // first file of the group on the same filesystem, unless either of
+        // them changed since 'find_duplicates'. Files that can't share with
+        // any file before them are skipped, as are changed files and files
+        // the kernel finds different with 'dedupe_range'; any other
+        // failure throws std::system_error.
+        inline std::vector<Reclaimed> reclaim(std::vector<File> const &group, Reclaim const how)
+        {
+            std::vector<Reclaimed> results;
+            if ( group.size() < 2u ) return results;
+
+            if ( Reclaim::hardlink == how )
+            {
+                // A file is linked to the first one on its own filesystem, so
+                // only the first file of every filesystem is left alone
+                for ( std::size_t i = 1u; i < group.size(); ++i )
+                {
+                    std::string const &path = group[i].path;
+                    std::size_t first = 0u;
+                    while ( group[first].dev != group[i].dev ) ++first;
+                    if ( first == i )
+                    {
+                        results.push_back(Reclaimed{ path, Outcome::other_filesystem });
+                        continue;
+                    }
+
+                    // The checks come after the link, right before the rename,
+                    // to keep the window for a change to go unnoticed short.
+                    // Linking changes the ctime of the first file.
+                    std::string const temp = path + ".md5dedup.tmp";
+                    if ( 0 != ::link(group[first].path.c_str(), temp.c_str()) ) throw std::system_error(errno, std::generic_category(), path);
+                    bool same = false;
+                    try
+                    {
+                        same = details::unchanged(group[first], false) && details::unchanged(group[i], true);
+                    }
+                    catch ( ... )
+                    {
+                        std::remove(temp.c_str());
+                        throw;
+                    }
+                    if ( !same )
+                    {
+                        std::remove(temp.c_str());
+                        results.push_back(Reclaimed{ path, Outcome::changed });
+                        continue;
+                    }
+                    if ( 0 != std::rename(temp.c_str(), path.c_str()) )
+                    {
+                        int const error = errno;
+                        std::remove(temp.c_str());
+                        throw std::system_error(error, std::generic_category(), path);
+                    }
+                    results.push_back(Reclaimed{ path, Outcome::shared });
+                }
+                return results;
+            }
+
+#ifdef FIDEDUPERANGE
+            std::string const &keep = group.front().path;
+            file::Fd const src = file::open_read(keep.c_str());
+            struct stat st;
+            if ( 0 != ::fstat(src.get(), &st) ) throw std::system_error(errno, std::generic_category(), keep);
+
+            for ( std::size_t i = 1u; i < group.size(); ++i )
+            {
+                std::string const &path = group[i].path;
+                int const dst_fd = ::open(path.c_str(), O_RDWR | O_CLOEXEC);
+                if ( -1 == dst_fd ) throw std::system_error(errno, std::generic_category(), path);
+                file::Fd const dst(dst_fd);
+
+                // One request per step, as filesystems may limit the length of one
+                constexpr std::uint64_t step = 16u * 1024u * 1024u;
+                Outcome outcome = Outcome::shared;
+                for ( std::uint64_t offset = 0u; offset < static_cast<std::uint64_t>(st.st_size); )
+                {
+                    // file_dedupe_range ends in a flexible array of one info per destination
+                    alignas(file_dedupe_range) char unsigned request[sizeof(file_dedupe_range) + sizeof(file_dedupe_range_info)] = {};
+                    file_dedupe_range &range = *reinterpret_cast<file_dedupe_range *>(request);
+                    file_dedupe_range_info &info = *reinterpret_cast<file_dedupe_range_info *>(request + sizeof(file_dedupe_range));
+                    range.src_offset = offset;
+                    range.src_length = std::min<std::uint64_t>(step, static_cast<std::uint64_t>(st.st_size) - offset);
+                    range.dest_count = 1u;
+                    info.dest_fd = dst.get();
+                    info.dest_offset = offset;
+                    int const error = (0 != ::ioctl(src.get(), FIDEDUPERANGE, request)) ? errno : (info.status < 0) ? -info.status : 0;
+                    if ( EXDEV == error ) { outcome = Outcome::other_filesystem; break; }
+                    if ( 0 != error ) throw std::system_error(error, std::generic_category(), path);
+                    if ( FILE_DEDUPE_RANGE_DIFFERS == info.status || 0u == info.bytes_deduped ) { outcome = Outcome::changed; break; }
+                    offset += info.bytes_deduped;
+                }
+                results.push_back(Reclaimed{ path, outcome });
+            }
+            return results;
+#else
+            throw std::system_error(ENOTSUP, std::generic_category(), "FIDEDUPERANGE");
+#endif
+        }
+
+    }  // close namespace 'dedup'
+}  // close namespace 'md5'
+
+#endif  // HEADER_INCLUSION_GUARD
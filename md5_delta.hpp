@@ -0,0 +1,340 @@
+#ifndef HEADER_INCLUSION_GUARD_37760125984430158261947002316587093315462
+#define HEADER_INCLUSION_GUARD_37760125984430158261947002316587093315462
+
+// rsync-style deltas between an old and a new version of a file, so that
+// only the parts that changed need copying.
+//
+//   1. 'signature' cuts the old file into blocks and records two sums per
+//      block: rsync's 32-bit rolling checksum and the MD5 of the block.
+//      Blocks are summed on several threads.
+//   2. 'generate' slides a window of one block over the new file. The
+//      rolling checksum moves one byte in O(1), and only when it matches a
+//      block of the signature is the window hashed with MD5 to confirm it.
+//      Matched blocks become "copy" instructions, the rest literal bytes.
+//   3. 'apply' rebuilds the new file from the old one and the delta, and
+//      checks the result against the MD5 of the whole new file, which the
+//      delta carries.
+//
+// Delta layout (all integers little-endian):
+//     char[8]   magic "MD5DLT01"
+//     uint64    block size
+//     uint64    length of the new file
+//     char[16]  MD5 of the new file
+//     then instructions until the end:
+//         'C', uint64 first block, uint64 number of blocks   copy from the old file
+//         'L', uint64 length, bytes                            literal data
+//
+// Errors are reported by throwing std::system_error or std::runtime_error.
+
+#include <cerrno>         // errno
+#include <cstdint>        // uint32_t, uint64_t
+#include <cstring>        // memcmp, memcpy
+#include <stdexcept>      // runtime_error, invalid_argument
+#include <system_error>   // system_error
+#include <thread>         // hardware_concurrency
+#include <unordered_map>  // unordered_multimap
+#include <vector>         // vector
+#include <sys/mman.h>     // mmap
+#include <sys/stat.h>     // fstat
+#include <unistd.h>       // write
+#include "md5.hpp"
+#include "md5_file.hpp"
+#include "md5_util.hpp"
+
+namespace md5 {
+    namespace delta {
+
+        constexpr char magic[8] = { 'M', 'D', '5', 'D', 'L', 'T', '0', '1' };
+        constexpr std::size_t header_size = 8u + 8u + 8u + 16u;
+
+        // rsync's weak checksum: s1 is the sum of the bytes and s2 the sum of
+        // the running values of s1, both modulo 2^16
+        class RollingSum {
+        public:
+            RollingSum(char unsigned const *const data, std::size_t const len) noexcept
+                : len_(static_cast<std::uint32_t>(len))
+            {
+                for ( std::size_t i = 0u; i < len; ++i )
+                {
+                    s1_ += data[i];
+                    s2_ += s1_;
+                }
+            }
+
+            std::uint32_t value(void) const noexcept { return (s1_ & 0xffffu) | (s2_ << 16u); }
+
+            // Slides the window one byte: drops 'out', appends 'in'
+            void roll(char unsigned const out, char unsigned const in) noexcept
+            {
+                s1_ += in - out;
+                s2_ += s1_ - len_ * out;
+            }
+
+        private:
+            std::uint32_t len_, s1_ = 0u, s2_ = 0u;
+        };
+
+        struct Block {
+            std::uint32_t weak;
+            Digest strong;
+        };
+
+        struct Signature {
+            std::uint64_t block_size;
+            std::uint64_t length;       // of the old file
+            std::vector<Block> blocks;  // the last one may be shorter
+        };
+
+        struct Stats {
+            std::uint64_t copied = 0u;   // bytes taken from the old file
+            std::uint64_t literal = 0u;  // bytes carried in the delta
+        };
+
+        namespace details {
+
+            using util::load_le64;
+            using util::store_le64;
+
+            inline void put64(std::vector<char unsigned> &out, std::uint64_t const n)
+            {
+                char unsigned b[8];
+                store_le64(b, n);
+                out.insert(out.end(), b, b + 8);
+            }
+
+            // Maps memory or a file read-only for the duration of a call
+            class Mapping {
+            public:
+                explicit Mapping(int const fd)
+                {
+                    struct stat st;
+                    if ( 0 != ::fstat(fd, &st) ) throw std::system_error(errno, std::generic_category(), "fstat");
+                    size_ = static_cast<std::size_t>(st.st_size);
+                    if ( 0u == size_ ) return;
+                    void *const p = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+                    if ( MAP_FAILED == p ) throw std::system_error(errno, std::generic_category(), "mmap");
+                    data_ = static_cast<char unsigned const *>(p);
+                    ::madvise(const_cast<char unsigned *>(data_), size_, MADV_SEQUENTIAL);
+                }
+                ~Mapping(void) { if ( nullptr != data_ ) ::munmap(const_cast<char unsigned *>(data_), size_); }
+                Mapping(Mapping const &) = delete;
+                Mapping &operator=(Mapping const &) = delete;
+                char unsigned const *data(void) const noexcept { return data_; }
+                std::size_t size(void) const noexcept { return size_; }
+            private:
+                char unsigned const *data_ = nullptr;
+                std::size_t size_ = 0u;
+            };
+        }
+
+        inline Signature signature(char unsigned const *const data, std::size_t const len, std::uint64_t const block_size = 4096u,
+                                   unsigned const threads = std::thread::hardware_concurrency())
+        {
+            if ( 0u == block_size || block_size > 0xffffffffu ) throw std::invalid_argument("md5::delta: block size out of range");
+            Signature sig{ block_size, len, std::vector<Block>(static_cast<std::size_t>((len + block_size - 1u) / block_size)) };
+            util::parallel_for(sig.blocks.size(), threads, [&](std::size_t const i) {
+                std::size_t const offset = static_cast<std::size_t>(i * block_size);
+                std::size_t const n = static_cast<std::size_t>((len - offset < block_size) ? len - offset : block_size);
+                sig.blocks[i] = Block{ RollingSum(data + offset, n).value(), ::md5::compute(data + offset, n) };
+            });
+            return sig;
+        }
+
+        inline Signature signature(int const fd, std::uint64_t const block_size = 4096u,
+                                   unsigned const threads = std::thread::hardware_concurrency())
+        {
+            details::Mapping const old(fd);
+            return signature(old.data(), old.size(), block_size, threads);
+        }
+
+        inline std::vector<char unsigned> generate(Signature const &sig, char unsigned const *const data, std::size_t const len,
+                                                   Stats *const stats = nullptr)
+        {
+            std::size_t const bs = static_cast<std::size_t>(sig.block_size);
+            std::size_t const full = (0u != sig.length % bs) ? sig.blocks.size() - 1u : sig.blocks.size();
+            std::size_t const tail = static_cast<std::size_t>(sig.length % bs);
+
+            // Full blocks by weak sum; the short last block can only match at
+            // the very end of the new file
+            std::unordered_multimap<std::uint32_t, std::uint64_t> index(full);
+            for ( std::size_t i = full; 0u != i--; ) index.emplace(sig.blocks[i].weak, i);
+
+            std::vector<char unsigned> out(magic, magic + sizeof magic);
+            details::put64(out, sig.block_size);
+            details::put64(out, len);
+            Digest const whole = ::md5::compute(data, len);
+            out.insert(out.end(), whole.b, whole.b + Digest::count);
+
+            Stats s;
+            std::uint64_t run_first = 0u, run_count = 0u;  // pending copy
+            std::size_t literal_from = 0u;                 // start of pending literal bytes
+
+            auto const flush_literal = [&](std::size_t const end) {
+                if ( end == literal_from ) return;
+                out.push_back('L');
+                details::put64(out, end - literal_from);
+                out.insert(out.end(), data + literal_from, data + end);
+                s.literal += end - literal_from;
+            };
+            auto const flush_copy = [&]() {
+                if ( 0u == run_count ) return;
+                out.push_back('C');
+                details::put64(out, run_first);
+                details::put64(out, run_count);
+                run_count = 0u;
+            };
+            auto const matched = [&](std::size_t const pos, std::uint64_t const block, std::size_t const n) {
+                if ( pos != literal_from ) { flush_copy(); flush_literal(pos); }
+                if ( 0u != run_count && run_first + run_count == block ) ++run_count;
+                else { flush_copy(); run_first = block; run_count = 1u; }
+                s.copied += n;
+                literal_from = pos + n;
+            };
+
+            std::size_t pos = 0u;
+            if ( len >= bs && 0u != full )
+            {
+                RollingSum sum(data, bs);
+                while ( pos + bs <= len )
+                {
+                    bool found = false;
+                    auto const range = index.equal_range(sum.value());
+                    if ( range.first != range.second )
+                    {
+                        Digest const strong = ::md5::compute(data + pos, bs);
+                        // Prefer the block after the last match, which keeps runs together
+                        std::uint64_t best = ~std::uint64_t(0u);
+                        for ( auto it = range.first; it != range.second; ++it )
+                        {
+                            if ( 0 != std::memcmp(sig.blocks[static_cast<std::size_t>(it->second)].strong.b, strong.b, Digest::count) ) continue;
+                            if ( ~std::uint64_t(0u) == best || it->second == run_first + run_count ) best = it->second;
+                        }
+                        if ( ~std::uint64_t(0u) != best )
+                        {
+                            matched(pos, best, bs);
+                            pos += bs;
+                            found = true;
+                            if ( pos + bs <= len ) sum = RollingSum(data + pos, bs);
+                        }
+                    }
+                    if ( found ) continue;
+                    if ( pos + bs < len ) sum.roll(data[pos], data[pos + bs]);
+                    ++pos;
+                }
+            }
+
+            // The old file's short last block, if the new file ends with it
+            if ( 0u != tail && len - literal_from >= tail )
+            {
+                std::size_t const at = len - tail;
+                Block const &last = sig.blocks.back();
+                if ( RollingSum(data + at, tail).value() == last.weak
+                     && 0 == std::memcmp(::md5::compute(data + at, tail).b, last.strong.b, Digest::count) )
+                {
+                    matched(at, sig.blocks.size() - 1u, tail);
+                }
+            }
+            flush_copy();
+            flush_literal(len);
+
+            if ( nullptr != stats ) *stats = s;
+            return out;
+        }
+
+        inline std::vector<char unsigned> generate(Signature const &sig, int const fd, Stats *const stats = nullptr)
+        {
+            details::Mapping const now(fd);
+            return generate(sig, now.data(), now.size(), stats);
+        }
+
+        // Rebuilds the new file by calling write(data, len) with its pieces
+        // in order, reading copied blocks with read(offset, len, buffer)
+        template <typename Read, typename Write>
+        void apply(std::vector<char unsigned> const &delta, Read &&read, Write &&write)
+        {
+            if ( delta.size() < header_size || 0 != std::memcmp(delta.data(), magic, sizeof magic) ) throw std::runtime_error("md5::delta: not a delta");
+            std::uint64_t const bs = details::load_le64(&delta[8]);
+            std::uint64_t const len = details::load_le64(&delta[16]);
+            Digest expected;
+            std::memcpy(expected.b, &delta[24], Digest::count);
+
+            ::md5::details::Context ctx;
+            std::uint64_t written = 0u;
+            std::vector<char unsigned> buffer;
+            for ( std::size_t at = header_size; at < delta.size(); )
+            {
+                char unsigned const op = delta[at];
+                if ( delta.size() - at < 9u ) throw std::runtime_error("md5::delta: truncated");
+                std::uint64_t const a = details::load_le64(&delta[at + 1u]);
+                if ( 'L' == op )
+                {
+                    at += 9u;
+                    if ( delta.size() - at < a ) throw std::runtime_error("md5::delta: truncated");
+                    write(&delta[at], static_cast<std::size_t>(a));
+                    ctx.append(&delta[at], static_cast<std::size_t>(a));
+                    at += static_cast<std::size_t>(a);
+                    written += a;
+                }
+                else if ( 'C' == op && delta.size() - at >= 17u )
+                {
+                    std::uint64_t const count = details::load_le64(&delta[at + 9u]);
+                    at += 17u;
+                    std::uint64_t offset = a * bs, left = count * bs;
+                    while ( 0u != left )
+                    {
+                        buffer.resize(static_cast<std::size_t>(left < file::buffer_size ? left : file::buffer_size));
+                        std::size_t const n = read(offset, buffer.size(), buffer.data());
+                        if ( 0u == n ) break;  // the short last block
+                        write(buffer.data(), n);
+                        ctx.append(buffer.data(), n);
+                        offset += n;
+                        left -= n;
+                        written += n;
+                        if ( n < buffer.size() ) break;
+                    }
+                }
+                else throw std::runtime_error("md5::delta: bad instruction");
+            }
+
+            Digest const actual = ctx.final();
+            if ( written != len || 0 != std::memcmp(actual.b, expected.b, Digest::count) )
+            {
+                throw std::runtime_error("md5::delta: result doesn't match; wrong old file?");
+            }
+        }
+
+        inline std::vector<char unsigned> apply(char unsigned const *const old, std::size_t const old_len, std::vector<char unsigned> const &delta)
+        {
+            std::vector<char unsigned> out;
+            apply(delta,
+                  [&](std::uint64_t const offset, std::size_t const n, char unsigned *const buf) -> std::size_t {
+                      if ( offset >= old_len ) return 0u;
+                      std::size_t const m = static_cast<std::size_t>((old_len - offset < n) ? old_len - offset : n);
+                      std::memcpy(buf, old + offset, m);
+                      return m;
+                  },
+                  [&](char unsigned const *const data, std::size_t const n) { out.insert(out.end(), data, data + n); });
+            return out;
+        }
+
+        // Writes the new file to 'out_fd' (from its current offset)
+        inline void apply(int const old_fd, std::vector<char unsigned> const &delta, int const out_fd)
+        {
+            apply(delta,
+                  [&](std::uint64_t const offset, std::size_t const n, char unsigned *const buf) { return file::read_at(old_fd, buf, n, offset); },
+                  [&](char unsigned const *data, std::size_t n) {
+                      while ( 0u != n )
+                      {
+                          ssize_t const w = ::write(out_fd, data, n);
+                          if ( w < 0 && EINTR == errno ) continue;
+                          if ( w <= 0 ) throw std::system_error((w < 0) ? errno : EIO, std::generic_category(), "write");
+                          data += w;
+                          n -= static_cast<std::size_t>(w);
+                      }
+                  });
+        }
+
+    }  // close namespace 'delta'
+}  // close namespace 'md5'
+
+#endif  // HEADER_INCLUSION_GUARD
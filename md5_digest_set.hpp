@@ -0,0 +1,282 @@
+#ifndef HEADER_INCLUSION_GUARD_52290816637410998213740076625184903317276
+#define HEADER_INCLUSION_GUARD_52290816637410998213740076625184903317276
+
+// A concurrent set of md5::Digest for many threads asking "have we seen
+// this content before?".
+//
+// This is an open addressing table with linear probing that stores the 16
+// bytes of every digest inline, so inserting never allocates. Digests are
+// uniformly distributed, so the top bits of the digest are used directly
+// as the home slot. 'insert' and 'contains' take no locks, and exactly one
+// of several threads inserting the same digest at the same time gets
+// 'true' back.
+//
+// A slot is two 64-Bit atomics. The first word is 0 while the slot is free
+// and 1 while a thread is writing into it, which is the only time another
+// thread inserting into that slot has to wait (for two stores). The few
+// digests whose first word is itself 0 or 1 (a chance of 1 in 2^63) go to
+// a small side list behind a mutex.
+//
+// The set grows while it's in use, without moving anything: a table takes
+// inserts up to its maximum load factor (0.75 by default, so probe
+// sequences stay short), and then the next insert adds a table twice its
+// size, which takes the inserts from then on. Only the thread that adds a
+// table takes a lock. The price is that a digest that isn't in the set is
+// looked for in every table, so give the first table the expected number
+// of digests divided by the load factor when it's known. Memory is 16
+// bytes per slot, and at most twice the size of the newest table in all.
+// 'rehash' merges everything into one table but is not safe to call while
+// other threads use the set.
+
+#include <atomic>     // atomic
+#include <cstdint>    // uint64_t
+#include <memory>     // unique_ptr
+#include <mutex>      // mutex, lock_guard
+#include <stdexcept>  // length_error, invalid_argument
+#include <vector>     // vector
+#include "md5.hpp"
+
+namespace md5 {
+
+    class DigestSet {
+    public:
+
+        // The capacity of the first table is rounded up to a power of two
+        explicit DigestSet(std::uint64_t const capacity, double const max_load = 0.75) : max_load_(max_load)
+        {
+            if ( !(max_load > 0.0 && max_load < 1.0) ) throw std::invalid_argument("md5::DigestSet: max_load must be between 0 and 1");
+            tables_[0].store(new Table(capacity, max_load_), std::memory_order_relaxed);
+        }
+
+        ~DigestSet(void)
+        {
+            for ( std::atomic<Table*> &t : tables_ ) delete t.load(std::memory_order_relaxed);
+        }
+
+        DigestSet(DigestSet const &) = delete;
+        DigestSet &operator=(DigestSet const &) = delete;
+
+        // Slots in all tables
+        std::uint64_t capacity(void) const noexcept
+        {
+            std::uint64_t n = 0u;
+            for ( std::size_t i = 0u; i < max_tables; ++i )
+            {
+                Table const *const t = tables_[i].load(std::memory_order_acquire);
+                if ( nullptr == t ) break;
+                n += t->mask + 1u;
+            }
+            return n;
+        }
+
+        std::uint64_t size(void) const noexcept
+        {
+            std::uint64_t n = 0u;
+            for ( Counter const &c : counters_ ) n += c.value.load(std::memory_order_relaxed);
+            return n;
+        }
+
+        double load_factor(void) const noexcept
+        {
+            return static_cast<double>(size()) / static_cast<double>(capacity());
+        }
+
+        // Returns true if 'd' was added, false if it was already present.
+        // Throws std::length_error if the set can't grow any more.
+        bool insert(Digest const &d)
+        {
+            std::uint64_t const w0 = word(d, 0u), w1 = word(d, 8u);
+            if ( w0 <= busy ) return side_insert(w0, w1);
+
+            for ( std::size_t i = 0u; i < max_tables; ++i )
+            {
+                Table *t = tables_[i].load(std::memory_order_acquire);
+                if ( nullptr == t ) t = grow(i);
+
+                // Every insert into a table needs one of its 'limit' tickets,
+                // which keeps its load factor in bounds. Without a ticket the
+                // table is sealed: once the inserts holding tickets are done
+                // it never changes again, so looking in it is conclusive.
+                std::uint64_t const ticket = (t->tickets.load(std::memory_order_relaxed) < t->limit)
+                                           ? t->tickets.fetch_add(1u, std::memory_order_relaxed) : t->limit;
+                if ( ticket < t->limit )
+                {
+                    bool const added = insert_into(*t, w0, w1);
+                    t->done.fetch_add(1u, std::memory_order_release);
+                    if ( added ) counters_[w0 % counter_count].value.fetch_add(1u, std::memory_order_relaxed);
+                    return added;
+                }
+                while ( t->done.load(std::memory_order_acquire) < t->limit ) {}  // at most one insert per thread still going
+                if ( find_in(*t, w0, w1) ) return false;
+            }
+            throw std::length_error("md5::DigestSet is full");
+        }
+
+        bool contains(Digest const &d) const
+        {
+            std::uint64_t const w0 = word(d, 0u), w1 = word(d, 8u);
+            if ( w0 <= busy ) return side_contains(w0, w1);
+
+            for ( std::size_t i = 0u; i < max_tables; ++i )
+            {
+                Table const *const t = tables_[i].load(std::memory_order_acquire);
+                if ( nullptr == t ) break;
+                if ( find_in(*t, w0, w1) ) return true;
+            }
+            return false;
+        }
+
+        // Moves every digest into one new table of at least 'capacity'
+        // slots, and more if that's needed for the maximum load factor.
+        // Not thread-safe: no other thread may use the set meanwhile.
+        void rehash(std::uint64_t capacity)
+        {
+            std::uint64_t const needed = static_cast<std::uint64_t>(static_cast<double>(size()) / max_load_) + 1u;
+            if ( capacity < needed ) capacity = needed;
+            std::unique_ptr<Table> fresh(new Table(capacity, max_load_));
+            std::uint64_t moved = 0u;
+            for ( std::atomic<Table*> &slot : tables_ )
+            {
+                std::unique_ptr<Table> const old(slot.exchange(nullptr, std::memory_order_relaxed));
+                for ( std::uint64_t i = 0u; nullptr != old && i <= old->mask; ++i )
+                {
+                    std::uint64_t const a = old->slots[i].a.load(std::memory_order_relaxed);
+                    if ( a > busy ) moved += insert_into(*fresh, a, old->slots[i].b.load(std::memory_order_relaxed));
+                }
+            }
+            fresh->tickets.store(moved, std::memory_order_relaxed);
+            fresh->done.store(moved, std::memory_order_relaxed);
+            tables_[0].store(fresh.release(), std::memory_order_release);
+        }
+
+    private:
+
+        static constexpr std::uint64_t empty = 0u;
+        static constexpr std::uint64_t busy  = 1u;
+        static constexpr unsigned counter_count = 64u;
+        static constexpr std::size_t max_tables = 40u;
+
+        struct Slot {
+            std::atomic<std::uint64_t> a;  // first 8 bytes of the digest, or empty/busy
+            std::atomic<std::uint64_t> b;  // last 8 bytes of the digest
+        };
+
+        struct Table {
+            std::unique_ptr<Slot[]> slots;
+            std::uint64_t mask = 0u;
+            unsigned shift = 63u;                   // the home slot is the top bits of the digest
+            std::uint64_t limit = 0u;               // inserts allowed, always fewer than the slots
+            std::atomic<std::uint64_t> tickets{0u};  // inserts started
+            std::atomic<std::uint64_t> done{0u};     // inserts finished
+
+            Table(std::uint64_t const capacity, double const max_load)
+            {
+                std::uint64_t size = 2u;
+                shift = 63u;
+                while ( size < capacity ) { size <<= 1u; --shift; }
+                slots.reset(new Slot[size]);
+                for ( std::uint64_t i = 0u; i < size; ++i )
+                {
+                    slots[i].a.store(empty, std::memory_order_relaxed);
+                    slots[i].b.store(0u, std::memory_order_relaxed);
+                }
+                mask = size - 1u;
+                limit = static_cast<std::uint64_t>(static_cast<double>(size) * max_load);
+                if ( 0u == limit ) limit = 1u;
+                if ( limit >= size ) limit = size - 1u;
+            }
+        };
+
+        // Spread over cache lines so that counting doesn't become the bottleneck
+        struct Counter {
+            std::atomic<std::uint64_t> value;
+            char padding[64u - sizeof(std::atomic<std::uint64_t>)];
+        };
+
+        double max_load_;
+        std::atomic<Table*> tables_[max_tables] = {};
+        std::mutex grow_mutex_;
+        Counter counters_[counter_count] = {};
+
+        mutable std::mutex side_mutex_;
+        std::vector<std::uint64_t> side_;  // pairs of words
+
+        static std::uint64_t word(Digest const &d, unsigned const offset) noexcept
+        {
+            std::uint64_t n = 0u;
+            for ( unsigned i = 0u; i < 8u; ++i ) n = (n << 8u) | d.b[offset + i];
+            return n;
+        }
+
+        // The table after 'i - 1', added by whichever thread gets here first
+        Table *grow(std::size_t const i)
+        {
+            std::lock_guard<std::mutex> const lock(grow_mutex_);
+            Table *t = tables_[i].load(std::memory_order_acquire);
+            if ( nullptr != t ) return t;
+            Table const *const previous = tables_[i - 1u].load(std::memory_order_relaxed);
+            if ( previous->mask >= (std::uint64_t(1u) << 62u) ) throw std::length_error("md5::DigestSet is full");
+            t = new Table((previous->mask + 1u) * 2u, max_load_);
+            tables_[i].store(t, std::memory_order_release);
+            return t;
+        }
+
+        // Adds the digest unless it's there already; the caller holds a
+        // ticket, so the table has a free slot
+        static bool insert_into(Table &t, std::uint64_t const w0, std::uint64_t const w1)
+        {
+            for ( std::uint64_t n = 0u, i = w0 >> t.shift; n <= t.mask; ++n, i = (i + 1u) & t.mask )
+            {
+                Slot &s = t.slots[i];
+                std::uint64_t a = s.a.load(std::memory_order_acquire);
+                if ( empty == a )
+                {
+                    if ( s.a.compare_exchange_strong(a, busy, std::memory_order_acquire, std::memory_order_acquire) )
+                    {
+                        s.b.store(w1, std::memory_order_relaxed);
+                        s.a.store(w0, std::memory_order_release);
+                        return true;
+                    }
+                    // Another thread took the slot first; 'a' now holds what it wrote
+                }
+                while ( busy == a ) a = s.a.load(std::memory_order_acquire);  // it may be writing this very digest
+                if ( w0 == a && w1 == s.b.load(std::memory_order_relaxed) ) return false;
+            }
+            throw std::length_error("md5::DigestSet is full");
+        }
+
+        static bool find_in(Table const &t, std::uint64_t const w0, std::uint64_t const w1) noexcept
+        {
+            for ( std::uint64_t n = 0u, i = w0 >> t.shift; n <= t.mask; ++n, i = (i + 1u) & t.mask )
+            {
+                Slot const &s = t.slots[i];
+                std::uint64_t const a = s.a.load(std::memory_order_acquire);
+                if ( empty == a ) return false;
+                // A slot still being written holds a digest whose insert hasn't
+                // finished, so it can be treated as not present yet
+                if ( w0 == a && w1 == s.b.load(std::memory_order_relaxed) ) return true;
+            }
+            return false;
+        }
+
+        bool side_insert(std::uint64_t const w0, std::uint64_t const w1)
+        {
+            std::lock_guard<std::mutex> const lock(side_mutex_);
+            for ( std::size_t i = 0u; i < side_.size(); i += 2u ) if ( w0 == side_[i] && w1 == side_[i + 1u] ) return false;
+            side_.push_back(w0);
+            side_.push_back(w1);
+            counters_[0].value.fetch_add(1u, std::memory_order_relaxed);
+            return true;
+        }
+
+        bool side_contains(std::uint64_t const w0, std::uint64_t const w1) const
+        {
+            std::lock_guard<std::mutex> const lock(side_mutex_);
+            for ( std::size_t i = 0u; i < side_.size(); i += 2u ) if ( w0 == side_[i] && w1 == side_[i + 1u] ) return true;
+            return false;
+        }
+    };
+
+}  // close namespace 'md5'
+
+#endif  // HEADER_INCLUSION_GUARD
@@ -0,0 +1,492 @@
+#ifndef HEADER_INCLUSION_GUARD_30982711540266947118305596043288651799420
+#define HEADER_INCLUSION_GUARD_30982711540266947118305596043288651799420
+
+// A sorted set of md5::Digest stored in a file that is memory-mapped
+// rather than loaded, for checking membership in very large sets of
+// known hashes.
+//
+// MD5 digests are uniformly distributed, so the position of a digest in
+// the sorted array can be predicted from its value. A lookup uses the top
+// 'bucket_bits' bits to find its bucket in a directory, then interpolation
+// search inside the bucket, which takes O(log log n) probes on average.
+// Builder writes such a file from any number of digests in bounded
+// memory, by merging sorted runs spilled to disk.
+//
+// File layout (all integers little-endian):
+//     offset 0   char[8]   magic "MD5DGDB1"
+//     offset 8   uint32    bucket_bits
+//     offset 12  uint32    reserved (0)
+//     offset 16  uint64    number of digests
+//     offset 24  char[40]  reserved (0)
+//     offset 64  uint64    directory[(1 << bucket_bits) + 1], the index of
+//                          the first digest of every bucket, and the count
+//     then       char[16]  digests, sorted as big-endian numbers, no duplicates
+//
+// POSIX only (uses mmap). Errors are reported by throwing std::system_error
+// or std::runtime_error.
+
+#include <algorithm>     // sort, unique, make_heap, push_heap, pop_heap
+#include <cerrno>        // errno
+#include <climits>       // CHAR_BIT
+#include <cstdint>       // uint64_t, uint32_t
+#include <cstdio>        // FILE, fopen, fwrite, fread, fseeko, remove
+#include <cstring>       // memcmp, memcpy
+#include <stdexcept>     // runtime_error
+#include <string>        // string, to_string
+#include <system_error>  // system_error
+#include <utility>       // move
+#include <vector>        // vector
+#include <fcntl.h>       // open
+#include <sys/mman.h>    // mmap, madvise
+#include <sys/stat.h>    // fstat
+#include <unistd.h>      // close
+#include "md5.hpp"
+#include "md5_util.hpp"
+
+namespace md5 {
+    namespace digestdb {
+
+        static_assert( 8 == CHAR_BIT && 16u == Digest::count, "The file format assumes 8-Bit bytes" );
+
+        constexpr char magic[8] = { 'M', 'D', '5', 'D', 'G', 'D', 'B', '1' };
+        constexpr std::size_t header_size = 64u;
+
+        namespace details {
+
+            using util::load_le64;
+            using util::store_le64;
+
+            // The first 64 bits of a digest as a big-endian number, so
+            // that it orders the same way as the whole digest
+            inline std::uint64_t prefix64(char unsigned const *const p) noexcept
+            {
+                std::uint64_t n = 0u;
+                for ( unsigned i = 0u; i < 8u; ++i ) n = (n << 8u) | p[i];
+                return n;
+            }
+
+            inline bool less(Digest const &a, Digest const &b) noexcept
+            {
+                return std::memcmp(a.b, b.b, Digest::count) < 0;
+            }
+
+            inline bool equal(Digest const &a, Digest const &b) noexcept
+            {
+                return 0 == std::memcmp(a.b, b.b, Digest::count);
+            }
+
+            inline std::uint64_t bucket_of(char unsigned const *const digest, unsigned const bucket_bits) noexcept
+            {
+                return (0u == bucket_bits) ? 0u : prefix64(digest) >> (64u - bucket_bits);
+            }
+
+            // Sorts and de-duplicates 'digests' with one MSD radix (counting)
+            // pass on the top 16 bits, then a comparison sort of each of the
+            // resulting small buckets. 'scratch' is reused between calls.
+            inline void sort_unique(std::vector<Digest> &digests, std::vector<Digest> &scratch)
+            {
+                constexpr unsigned radix_bits = 16u;
+                std::vector<std::size_t> start((std::size_t(1u) << radix_bits) + 1u, 0u);
+                for ( Digest const &d : digests ) ++start[bucket_of(d.b, radix_bits) + 1u];
+                for ( std::size_t i = 1u; i < start.size(); ++i ) start[i] += start[i - 1u];
+
+                scratch.resize(digests.size());
+                {
+                    std::vector<std::size_t> next(start.begin(), start.end() - 1);
+                    for ( Digest const &d : digests ) scratch[next[bucket_of(d.b, radix_bits)]++] = d;
+                }
+
+                digests.clear();
+                for ( std::size_t i = 0u; i + 1u < start.size(); ++i )
+                {
+                    auto const first = scratch.begin() + static_cast<std::ptrdiff_t>(start[i]);
+                    auto const last  = scratch.begin() + static_cast<std::ptrdiff_t>(start[i + 1u]);
+                    std::sort(first, last, less);
+                    digests.insert(digests.end(), first, std::unique(first, last, equal));
+                }
+            }
+
+            // A sorted run spilled to an unlinked temporary file, read back
+            // in blocks during the merge
+            class Run {
+            public:
+                explicit Run(std::FILE *const f) noexcept : f_(f) {}
+                Run(Run &&other) noexcept : f_(other.f_), buffer_(std::move(other.buffer_)), at_(other.at_) { other.f_ = nullptr; }
+                Run &operator=(Run &&) = delete;
+                ~Run(void) { if ( nullptr != f_ ) std::fclose(f_); }
+
+                // The next digest, or false at the end of the run
+                bool next(Digest &d)
+                {
+                    if ( at_ == buffer_.size() )
+                    {
+                        buffer_.resize(65536u);
+                        std::size_t const n = std::fread(buffer_.data(), sizeof(Digest), buffer_.size(), f_);
+                        if ( n < buffer_.size() && 0 != std::ferror(f_) ) throw std::system_error(errno, std::generic_category(), "md5::digestdb: reading a sorted run");
+                        buffer_.resize(n);
+                        at_ = 0u;
+                        if ( 0u == n ) return false;
+                    }
+                    d = buffer_[at_++];
+                    return true;
+                }
+
+            private:
+                std::FILE *f_;
+                std::vector<Digest> buffer_;
+                std::size_t at_ = 0u;
+            };
+        }
+
+        // Writes a database from digests added one at a time, in any order
+        // and with duplicates, without holding them all in memory: they are
+        // collected into runs of about 'memory' bytes (counting the scratch
+        // space for sorting), each run is sorted and spilled to an
+        // unlinked temporary file next to 'path', and finish() merges the
+        // runs into the database. A set that fits in one run is never
+        // spilled.
+        class Builder {
+        public:
+            explicit Builder(std::string path, unsigned const bucket_bits = 16u, std::size_t const memory = 512u * 1024u * 1024u)
+              : path_(std::move(path)), bucket_bits_(bucket_bits),
+                run_size_((memory / (2u * sizeof(Digest)) > 1024u) ? memory / (2u * sizeof(Digest)) : 1024u)
+            {
+                if ( bucket_bits > 32u ) throw std::runtime_error("md5::digestdb::Builder: bucket_bits must be at most 32");
+            }
+
+            Builder(Builder const &) = delete;
+            Builder &operator=(Builder const &) = delete;
+
+            void add(Digest const &d)
+            {
+                if ( run_.size() == run_size_ ) spill();
+                run_.push_back(d);
+            }
+
+            // Writes the database; nothing can be added afterwards
+            void finish(void)
+            {
+                details::sort_unique(run_, scratch_);
+                std::vector<Digest>().swap(scratch_);
+
+                std::FILE *const f = std::fopen(path_.c_str(), "wb");
+                if ( nullptr == f ) throw std::system_error(errno, std::generic_category(), path_);
+                try
+                {
+                    write(f);
+                }
+                catch ( ... )
+                {
+                    std::fclose(f);
+                    std::remove(path_.c_str());
+                    throw;
+                }
+                if ( 0 != std::fclose(f) ) throw std::system_error(errno, std::generic_category(), path_);
+            }
+
+        private:
+            std::string path_;
+            unsigned bucket_bits_;
+            std::size_t run_size_;
+            std::vector<Digest> run_, scratch_;
+            std::vector<details::Run> spilled_;
+
+            void spill(void)
+            {
+                details::sort_unique(run_, scratch_);
+                std::string const temp = path_ + ".run" + std::to_string(spilled_.size());
+                std::FILE *const f = std::fopen(temp.c_str(), "w+b");
+                if ( nullptr == f ) throw std::system_error(errno, std::generic_category(), temp);
+                std::remove(temp.c_str());  // gone once closed, even if this process dies
+                spilled_.emplace_back(f);
+                if ( run_.size() != std::fwrite(run_.data(), sizeof(Digest), run_.size(), f) || 0 != std::fflush(f) )
+                {
+                    throw std::system_error(errno, std::generic_category(), temp);
+                }
+                std::rewind(f);
+                run_.clear();
+            }
+
+            void write(std::FILE *const f)
+            {
+                std::size_t const buckets = std::size_t(1u) << bucket_bits_;
+                std::vector<std::uint64_t> directory(buckets + 1u, 0u);
+                std::uint64_t const directory_size = directory.size() * 8u;
+
+                // The digests go after the header and the directory, which are
+                // written last, when they're known
+                if ( 0 != ::fseeko(f, static_cast<off_t>(header_size + directory_size), SEEK_SET) ) throw std::system_error(errno, std::generic_category(), path_);
+
+                std::uint64_t count = 0u;
+                Digest last = {};
+                std::vector<Digest> out;
+                out.reserve(65536u);
+                bool ok = true;
+                auto const emit = [&](Digest const &d) {
+                    if ( 0u != count && details::equal(d, last) ) return;  // also in another run
+                    last = d;
+                    ++directory[details::bucket_of(d.b, bucket_bits_) + 1u];
+                    ++count;
+                    out.push_back(d);
+                    if ( out.size() == out.capacity() )
+                    {
+                        ok = ok && (out.size() == std::fwrite(out.data(), sizeof(Digest), out.size(), f));
+                        out.clear();
+                    }
+                };
+
+                if ( spilled_.empty() )
+                {
+                    for ( Digest const &d : run_ ) emit(d);
+                }
+                else
+                {
+                    // A k-way merge of the spilled runs and the one in memory,
+                    // with a heap of the next digest of every run
+                    spilled_.emplace_back(nullptr);  // stands for 'run_'
+                    std::size_t in_memory = 0u;
+                    std::size_t const memory_run = spilled_.size() - 1u;
+                    auto const next = [&](std::size_t const r, Digest &d) {
+                        if ( r != memory_run ) return spilled_[r].next(d);
+                        if ( in_memory == run_.size() ) return false;
+                        d = run_[in_memory++];
+                        return true;
+                    };
+                    struct Head { Digest d; std::size_t run; };
+                    auto const later = [](Head const &a, Head const &b) { return details::less(b.d, a.d); };
+                    std::vector<Head> heap;
+                    for ( std::size_t r = 0u; r < spilled_.size(); ++r )
+                    {
+                        Head h{ {}, r };
+                        if ( next(r, h.d) ) heap.push_back(h);
+                    }
+                    std::make_heap(heap.begin(), heap.end(), later);
+                    while ( !heap.empty() )
+                    {
+                        std::pop_heap(heap.begin(), heap.end(), later);
+                        Head &h = heap.back();
+                        emit(h.d);
+                        if ( next(h.run, h.d) ) std::push_heap(heap.begin(), heap.end(), later);
+                        else heap.pop_back();
+                    }
+                    spilled_.clear();
+                }
+                ok = ok && (out.size() == std::fwrite(out.data(), sizeof(Digest), out.size(), f));
+                for ( std::size_t i = 1u; i <= buckets; ++i ) directory[i] += directory[i - 1u];
+
+                char unsigned header[header_size] = {};
+                std::memcpy(header, magic, sizeof magic);
+                header[8] = static_cast<char unsigned>(bucket_bits_);
+                details::store_le64(header + 16u, count);
+
+                std::vector<char unsigned> dir_bytes(static_cast<std::size_t>(directory_size));
+                for ( std::size_t i = 0u; i < directory.size(); ++i ) details::store_le64(&dir_bytes[i * 8u], directory[i]);
+
+                ok = ok && (0 == ::fseeko(f, 0, SEEK_SET))
+                        && (1u == std::fwrite(header, sizeof header, 1u, f))
+                        && (1u == std::fwrite(dir_bytes.data(), dir_bytes.size(), 1u, f))
+                        && (0 == std::fflush(f));
+                if ( !ok ) throw std::system_error(errno, std::generic_category(), path_);
+            }
+        };
+
+        // Writes the digests of a set that's already in memory to 'path'
+        inline void build(std::vector<Digest> const &digests, char const *const path, unsigned const bucket_bits = 16u)
+        {
+            Builder builder(path, bucket_bits, (digests.size() + 1u) * 2u * sizeof(Digest));
+            for ( Digest const &d : digests ) builder.add(d);
+            builder.finish();
+        }
+
+        class Reader {
+        public:
+
+            explicit Reader(char const *const path)
+            {
+                int const fd = ::open(path, O_RDONLY | O_CLOEXEC);
+                if ( -1 == fd ) throw std::system_error(errno, std::generic_category(), path);
+
+                struct stat st;
+                if ( 0 != ::fstat(fd, &st) )
+                {
+                    int const error = errno;
+                    ::close(fd);
+                    throw std::system_error(error, std::generic_category(), path);
+                }
+                size_ = static_cast<std::size_t>(st.st_size);
+
+                void *const p = (size_ < header_size) ? MAP_FAILED : ::mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+                int const error = errno;
+                ::close(fd);
+                if ( MAP_FAILED == p )
+                {
+                    if ( size_ < header_size ) throw std::runtime_error("md5::digestdb: file too small");
+                    throw std::system_error(error, std::generic_category(), path);
+                }
+                base_ = static_cast<char unsigned const *>(p);
+
+                bucket_bits_ = base_[8];
+                count_ = details::load_le64(base_ + 16u);
+                if ( !valid() )
+                {
+                    ::munmap(const_cast<char unsigned *>(base_), size_);
+                    throw std::runtime_error("md5::digestdb: not a valid digest database");
+                }
+
+                // Lookups are effectively random accesses
+                ::madvise(const_cast<char unsigned *>(base_), size_, MADV_RANDOM);
+            }
+
+            ~Reader(void)
+            {
+                ::munmap(const_cast<char unsigned *>(base_), size_);
+            }
+
+            Reader(Reader const &) = delete;
+            Reader &operator=(Reader const &) = delete;
+
+            std::uint64_t size(void) const noexcept { return count_; }
+
+            bool contains(Digest const &d) const noexcept
+            {
+                std::uint64_t lo, hi;
+                bucket(d, lo, hi);
+                return search(d, lo, hi);
+            }
+
+            // Answers n queries at once. The first probe of every query in
+            // a group is prefetched before any of them is searched, so that
+            // the cache misses (or page faults) of the group overlap.
+            void contains(Digest const *const queries, std::size_t const n, bool *const results) const noexcept
+            {
+                constexpr std::size_t group = 16u;
+                std::uint64_t lo[group], hi[group];
+                for ( std::size_t base = 0u; base < n; base += group )
+                {
+                    std::size_t const m = (n - base < group) ? n - base : group;
+                    for ( std::size_t i = 0u; i < m; ++i )
+                    {
+                        bucket(queries[base + i], lo[i], hi[i]);
+                        if ( lo[i] != hi[i] ) prefetch(digest_at(guess(queries[base + i], lo[i], hi[i])));
+                    }
+                    for ( std::size_t i = 0u; i < m; ++i ) results[base + i] = search(queries[base + i], lo[i], hi[i]);
+                }
+            }
+
+        private:
+
+            char unsigned const *base_ = nullptr;
+            std::size_t size_ = 0u;
+            unsigned bucket_bits_ = 0u;
+            std::uint64_t count_ = 0u;
+            char unsigned const *directory_ = nullptr;
+            char unsigned const *digests_ = nullptr;
+
+            // Checks the header and the directory against the size of the
+            // file, so that no lookup can read outside of it, and sets
+            // 'directory_' and 'digests_'
+            bool valid(void) noexcept
+            {
+                if ( 0 != std::memcmp(base_, magic, sizeof magic) || bucket_bits_ > 32u ) return false;
+                std::uint64_t const entries = (std::uint64_t(1u) << bucket_bits_) + 1u;
+                std::uint64_t const directory_size = entries * 8u;
+                if ( size_ - header_size < directory_size ) return false;
+                std::uint64_t const digest_bytes = size_ - header_size - directory_size;
+                if ( 0u != digest_bytes % sizeof(Digest) || digest_bytes / sizeof(Digest) != count_ ) return false;
+
+                directory_ = base_ + header_size;
+                digests_ = directory_ + directory_size;
+
+                // Bucket boundaries must run from 0 to the count without going back
+                std::uint64_t previous = 0u;
+                for ( std::uint64_t i = 0u; i < entries; ++i )
+                {
+                    std::uint64_t const at = details::load_le64(directory_ + i * 8u);
+                    if ( at < previous || at > count_ || (0u == i && 0u != at) ) return false;
+                    previous = at;
+                }
+                return previous == count_;
+            }
+
+            static void prefetch(void const *const p) noexcept
+            {
+#if defined(__GNUC__) || defined(__clang__)
+                __builtin_prefetch(p);
+#else
+                (void)p;
+#endif
+            }
+
+            char unsigned const *digest_at(std::uint64_t const i) const noexcept
+            {
+                return digests_ + i * sizeof(Digest);
+            }
+
+            // [lo, hi) is the range of indices of the bucket that 'd' belongs to
+            void bucket(Digest const &d, std::uint64_t &lo, std::uint64_t &hi) const noexcept
+            {
+                std::uint64_t const b = details::bucket_of(d.b, bucket_bits_);
+                lo = details::load_le64(directory_ + b * 8u);
+                hi = details::load_le64(directory_ + b * 8u + 8u);
+            }
+
+            // Position of 'key' in [lo, hi) interpolated from the range of
+            // values [lo_key, hi_key] that the digests in [lo, hi) can have
+            static std::uint64_t interpolate(std::uint64_t const key, std::uint64_t const lo_key, std::uint64_t const hi_key,
+                                             std::uint64_t const lo, std::uint64_t const hi) noexcept
+            {
+                double const fraction = static_cast<double>(key - lo_key) / static_cast<double>(hi_key - lo_key);
+                std::uint64_t const mid = lo + static_cast<std::uint64_t>(fraction * static_cast<double>(hi - lo));
+                return (mid < hi) ? mid : hi - 1u;
+            }
+
+            // The range of values of the first 64 bits in the bucket of 'key'
+            void bucket_range(std::uint64_t const key, std::uint64_t &lo_key, std::uint64_t &hi_key) const noexcept
+            {
+                std::uint64_t const low_bits = (0u == bucket_bits_) ? ~std::uint64_t(0u) : (~std::uint64_t(0u) >> bucket_bits_);
+                lo_key = key & ~low_bits;
+                hi_key = key |  low_bits;
+            }
+
+            std::uint64_t guess(Digest const &d, std::uint64_t const lo, std::uint64_t const hi) const noexcept
+            {
+                std::uint64_t const key = details::prefix64(d.b);
+                std::uint64_t lo_key, hi_key;
+                bucket_range(key, lo_key, hi_key);
+                return interpolate(key, lo_key, hi_key, lo, hi);
+            }
+
+            bool search(Digest const &d, std::uint64_t lo, std::uint64_t hi) const noexcept
+            {
+                std::uint64_t const key = details::prefix64(d.b);
+                std::uint64_t lo_key, hi_key;
+                bucket_range(key, lo_key, hi_key);
+
+                // Every probe narrows the range of values as well as the range
+                // of indices. If the data turns out not to be uniform, fall back
+                // to bisection so that a lookup never takes more than O(log n)
+                for ( unsigned probes = 0u; lo < hi; ++probes )
+                {
+                    std::uint64_t const mid = (probes < 4u && hi_key > lo_key) ? interpolate(key, lo_key, hi_key, lo, hi)
+                                                                               : lo + (hi - lo) / 2u;
+                    int const cmp = std::memcmp(d.b, digest_at(mid), sizeof(Digest));
+                    if ( 0 == cmp ) return true;
+                    if ( cmp < 0 )
+                    {
+                        hi = mid;
+                        hi_key = details::prefix64(digest_at(mid));
+                    }
+                    else
+                    {
+                        lo = mid + 1u;
+                        lo_key = details::prefix64(digest_at(mid));
+                    }
+                }
+                return false;
+            }
+        };
+
+    }  // close namespace 'digestdb'
+}  // close namespace 'md5'
+
+#endif  // HEADER_INCLUSION_GUARD
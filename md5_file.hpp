@@ -0,0 +1,275 @@
+#ifndef HEADER_INCLUSION_GUARD_66013958247130872269519804453116780232981
+#define HEADER_INCLUSION_GUARD_66013958247130872269519804453116780232981
+
+// Hashing of files and file descriptors at runtime (POSIX only).
+//
+// Reads go through one large buffer per call with pread. Holes of sparse
+// files are hashed as zeros without reading them; finding them moves the
+// file offset, so a descriptor can only be shared between threads that
+// don't use the offset themselves. Errors are reported by throwing
+// std::system_error. With MD5_ENABLE_METRICS the time spent in read_at
+// is counted as md5::metrics::io_wait_ns.
+//
+// The descriptor helpers the other modules share (writing, directories,
+// aligned buffers for O_DIRECT, pipes for splice) are here as well.
+
+#include <cerrno>        // errno, EINTR
+#include <cstdint>       // uint64_t
+#ifdef MD5_ENABLE_METRICS
+#   include <chrono>     // steady_clock
+#endif
+#include <cstdlib>       // posix_memalign, free
+#include <memory>        // unique_ptr
+#include <new>           // bad_alloc
+#include <string>        // string
+#include <system_error>  // system_error
+#include <utility>       // swap
+#include <vector>        // vector
+#include <fcntl.h>       // open, posix_fadvise, F_SETPIPE_SZ
+#include <sys/stat.h>    // fstat, mkdir
+#include <unistd.h>      // pread, pwrite, read, close, lseek, pipe2
+#include "md5.hpp"
+
+namespace md5 {
+    namespace file {
+
+        constexpr std::size_t buffer_size = 1024u * 1024u;
+
+        // Closes the descriptor when it goes out of scope
+        class Fd {
+        public:
+            explicit Fd(int const fd = -1) noexcept : fd_(fd) {}
+            ~Fd(void) { if ( -1 != fd_ ) ::close(fd_); }
+            Fd(Fd &&other) noexcept : fd_(other.fd_) { other.fd_ = -1; }
+            Fd &operator=(Fd &&other) noexcept { std::swap(fd_, other.fd_); return *this; }
+            Fd(Fd const &) = delete;
+            Fd &operator=(Fd const &) = delete;
+            int get(void) const noexcept { return fd_; }
+        private:
+            int fd_;
+        };
+
+        inline Fd open_read(char const *const path)
+        {
+            int const fd = ::open(path, O_RDONLY | O_CLOEXEC);
+            MD5_USDT_PROBE(file_open, fd, path);
+            if ( -1 == fd ) throw std::system_error(errno, std::generic_category(), path);
+            return Fd(fd);
+        }
+
+        // Reads up to 'len' bytes at 'offset', retrying short reads, and
+        // returns fewer only at the end of the file
+        inline std::size_t read_at(int const fd, void *const buf, std::size_t const len, std::uint64_t const offset)
+        {
+#ifdef MD5_ENABLE_METRICS
+            struct Timer {
+                std::chrono::steady_clock::time_point const start = std::chrono::steady_clock::now();
+                ~Timer(void) { MD5_METRICS_ADD(io_wait_ns, static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count())); }
+            } const timer;
+#endif
+            std::size_t done = 0u;
+            while ( done < len )
+            {
+                ssize_t const n = ::pread(fd, static_cast<char *>(buf) + done, len - done, static_cast<off_t>(offset + done));
+                if ( n < 0 )
+                {
+                    if ( EINTR == errno ) continue;
+                    throw std::system_error(errno, std::generic_category(), "pread");
+                }
+                if ( 0 == n ) break;
+                done += static_cast<std::size_t>(n);
+            }
+            MD5_USDT_PROBE(read_done, fd, offset, done);
+            return done;
+        }
+
+        // One read(), retried only when interrupted; 0 means the end
+        inline std::size_t read_some(int const fd, char unsigned *const buf, std::size_t const len)
+        {
+            for ( ;; )
+            {
+                ssize_t const n = ::read(fd, buf, len);
+                if ( n < 0 && EINTR == errno ) continue;
+                if ( n < 0 ) throw std::system_error(errno, std::generic_category(), "read");
+                return static_cast<std::size_t>(n);
+            }
+        }
+
+        // Writes all of 'len' bytes at 'offset'; 'what' names the file in errors
+        inline void write_all(int const fd, void const *const data, std::size_t const len, std::uint64_t const offset, std::string const &what)
+        {
+            for ( std::size_t done = 0u; done < len; )
+            {
+                ssize_t const n = ::pwrite(fd, static_cast<char const *>(data) + done, len - done, static_cast<off_t>(offset + done));
+                if ( n < 0 && EINTR == errno ) continue;
+                if ( n <= 0 ) throw std::system_error((n < 0) ? errno : EIO, std::generic_category(), what);
+                done += static_cast<std::size_t>(n);
+            }
+        }
+
+        // Creates a directory unless it exists already
+        inline void make_dir(std::string const &path)
+        {
+            if ( 0 != ::mkdir(path.c_str(), 0755) && EEXIST != errno ) throw std::system_error(errno, std::generic_category(), path);
+        }
+
+        // Buffers, offsets and sizes for O_DIRECT are multiples of this
+        constexpr std::uint64_t alignment = 4096u;
+
+        struct AlignedFree {
+            void operator()(char unsigned *const p) const noexcept { std::free(p); }
+        };
+
+        using AlignedBuffer = std::unique_ptr<char unsigned, AlignedFree>;
+
+        inline AlignedBuffer aligned_buffer(std::size_t const size)
+        {
+            void *p = nullptr;
+            if ( 0 != ::posix_memalign(&p, alignment, size) ) throw std::bad_alloc();
+            return AlignedBuffer(static_cast<char unsigned *>(p));
+        }
+
+        // Reads [offset, offset + len) with O_DIRECT rules: only aligned
+        // reads, and a short read means the end of the file or device
+        inline std::size_t read_aligned(int const fd, char unsigned *const buf, std::size_t const len, std::uint64_t const offset)
+        {
+            std::size_t done = 0u;
+            while ( done < len )
+            {
+                ssize_t const n = ::pread(fd, buf + done, len - done, static_cast<off_t>(offset + done));
+                if ( n < 0 && EINTR == errno ) continue;
+                if ( n < 0 ) throw std::system_error(errno, std::generic_category(), "pread");
+                done += static_cast<std::size_t>(n);
+                if ( 0 == n || 0u != done % alignment ) break;
+            }
+            return done;
+        }
+
+#ifdef SPLICE_F_MOVE
+        // Errors with which splice() refuses a descriptor rather than fails
+        inline bool splice_unsupported(int const error) noexcept
+        {
+            return EINVAL == error || ENOSYS == error || EOPNOTSUPP == error || EBADF == error;
+        }
+
+        // A pipe for splice(), as large as the system allows
+        struct Pipe {
+            Fd read, write;
+
+            Pipe(void)
+            {
+                int fds[2];
+                if ( 0 != ::pipe2(fds, O_CLOEXEC) ) throw std::system_error(errno, std::generic_category(), "pipe2");
+                read = Fd(fds[0]);
+                write = Fd(fds[1]);
+                ::fcntl(fds[1], F_SETPIPE_SZ, static_cast<int>(buffer_size));  // larger batches if allowed
+            }
+        };
+#endif
+
+        // Feeds 'len' bytes from 'offset' (or up to the end of the file,
+        // whichever comes first) into 'ctx' and returns the number of bytes
+        // read, reading holes like any other part of the file
+        inline std::uint64_t append_data(details::Context &ctx, int const fd, std::uint64_t const offset, std::uint64_t const len)
+        {
+            std::vector<char unsigned> buffer(static_cast<std::size_t>(len < buffer_size ? len : buffer_size));
+            std::uint64_t done = 0u;
+            while ( done < len )
+            {
+                std::size_t const want = static_cast<std::size_t>((len - done < buffer.size()) ? len - done : buffer.size());
+                std::size_t const n = read_at(fd, buffer.data(), want, offset + done);
+                ctx.append(buffer.data(), n);
+                done += n;
+                if ( n < want ) break;
+            }
+            return done;
+        }
+
+        // As 'append_data', but the holes of a sparse file are found with
+        // SEEK_DATA and SEEK_HOLE and hashed as zeros without being read.
+        // This moves the file offset of 'fd' and doesn't put it back. If
+        // 'read' isn't null the bytes actually read are added to it.
+        inline std::uint64_t append_range(details::Context &ctx, int const fd, std::uint64_t const offset, std::uint64_t const len,
+                                          std::uint64_t *const read = nullptr)
+        {
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+            struct stat st;
+            // Files with as many blocks as bytes have no holes worth looking for
+            if ( 0 != ::fstat(fd, &st) || !S_ISREG(st.st_mode) || static_cast<std::uint64_t>(st.st_blocks) * 512u >= static_cast<std::uint64_t>(st.st_size) )
+            {
+                std::uint64_t const n = append_data(ctx, fd, offset, len);
+                if ( nullptr != read ) *read += n;
+                return n;
+            }
+
+            std::uint64_t const size = static_cast<std::uint64_t>(st.st_size);
+            if ( offset >= size ) return 0u;
+            std::uint64_t end = (len < size - offset) ? offset + len : size;
+            std::uint64_t at = offset, bytes = 0u;
+            while ( at < end )
+            {
+                off_t data = ::lseek(fd, static_cast<off_t>(at), SEEK_DATA);
+                if ( data < 0 && ENXIO == errno )
+                {
+                    // A hole up to the end of the file, which may have shrunk
+                    // since it was measured
+                    if ( 0 == ::fstat(fd, &st) && static_cast<std::uint64_t>(st.st_size) < end )
+                    {
+                        end = (static_cast<std::uint64_t>(st.st_size) > at) ? static_cast<std::uint64_t>(st.st_size) : at;
+                    }
+                    data = static_cast<off_t>(end);
+                }
+                if ( data < 0 )  // e.g. not supported here
+                {
+                    std::uint64_t const n = append_data(ctx, fd, at, end - at);
+                    at += n;
+                    bytes += n;
+                    break;
+                }
+                std::uint64_t const data_at = (static_cast<std::uint64_t>(data) < end) ? static_cast<std::uint64_t>(data) : end;
+                ctx.append_zeros(data_at - at);
+                at = data_at;
+                if ( at == end ) break;
+
+                off_t const hole = ::lseek(fd, static_cast<off_t>(at), SEEK_HOLE);
+                std::uint64_t const hole_at = (hole < 0 || static_cast<std::uint64_t>(hole) > end) ? end : static_cast<std::uint64_t>(hole);
+                std::uint64_t const want = hole_at - at;
+                std::uint64_t const n = append_data(ctx, fd, at, want);
+                at += n;
+                bytes += n;
+                if ( n < want ) break;  // the file shrank
+            }
+            if ( nullptr != read ) *read += bytes;
+            return at - offset;
+#else
+            std::uint64_t const n = append_data(ctx, fd, offset, len);
+            if ( nullptr != read ) *read += n;
+            return n;
+#endif
+        }
+
+        inline Digest compute_range(int const fd, std::uint64_t const offset, std::uint64_t const len)
+        {
+            details::Context ctx;
+            append_range(ctx, fd, offset, len);
+            return ctx.final();
+        }
+
+        inline Digest compute(int const fd)
+        {
+#if defined(POSIX_FADV_SEQUENTIAL) && !defined(__APPLE__)
+            ::posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+            return compute_range(fd, 0u, ~std::uint64_t(0u));
+        }
+
+        inline Digest compute(char const *const path)
+        {
+            Fd const fd = open_read(path);
+            return compute(fd.get());
+        }
+
+    }  // close namespace 'file'
+}  // close namespace 'md5'
+
+#endif  // HEADER_INCLUSION_GUARD
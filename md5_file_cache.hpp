@@ -0,0 +1,381 @@
+#ifndef HEADER_INCLUSION_GUARD_24871096630051458817302654290133771846350
+#define HEADER_INCLUSION_GUARD_24871096630051458817302654290133771846350
+
+// A persistent cache of file digests, so that files which haven't changed
+// since they were last hashed are never read again (POSIX only).
+//
+// An entry is keyed by the device, inode, size and the nanosecond mtime
+// and ctime of the file. Anything that writes to the file changes its
+// mtime and ctime, and even setting the mtime back changes the ctime, so
+// a matching key means the contents are the ones that were hashed.
+//
+// The index is a fixed-size hash table in a memory-mapped file shared by
+// every process that opens it. There are no locks: each slot carries a
+// check word computed from its key and digest, so a slot caught half
+// written (by a concurrent writer, or by a process that crashed) simply
+// reads as a miss. The worst a race can do is lose an entry. When all
+// slots a key may use are taken, the oldest is replaced.
+//
+// A file is only added once its timestamps are older than the moment
+// hashing started by more than 'racy_window' seconds, and only if it
+// didn't change while it was hashed. This avoids caching a digest for a
+// file that is modified again within the same timestamp tick.
+//
+// Optionally the digest is also mirrored in a "user.md5" extended
+// attribute (Linux), as "<hex digest> <dev> <ino> <size> <mtime ns>
+// <ctime ns>", and is trusted only when all of that matches, like an
+// entry of the index. Setting the attribute changes the ctime itself, so
+// it's written a second time with the ctime the first write left behind.
+// That sticks where timestamps are coarse (the second write lands in the
+// same tick), but not on kernels with fine-grained ctimes, which always
+// move the ctime on; there the attribute is just a mirror, and hits come
+// from the index alone. Either way the ctime left by the write is too
+// recent for the index, so a file hashed for the first time is added to
+// it by a later call, which finds the attribute already written. If
+// anything but the ctime changes around the write, nothing is stored.
+
+#include <atomic>        // atomic
+#include <cerrno>        // errno
+#include <cstdint>       // uint64_t
+#include <cstdio>        // snprintf, sscanf
+#include <ctime>         // time
+#include <cstring>       // memcpy
+#include <system_error>  // system_error
+#include <fcntl.h>       // open
+#include <sys/file.h>    // flock
+#include <sys/mman.h>    // mmap
+#include <sys/stat.h>    // fstat
+#include <unistd.h>      // ftruncate
+#ifdef __linux__
+#   include <sys/xattr.h>  // fgetxattr, fsetxattr
+#endif
+#include "md5_file.hpp"
+
+namespace md5 {
+    namespace file {
+
+        class DigestCache {
+        public:
+
+            struct Stats {
+                std::uint64_t hits, misses, stores;
+            };
+
+            // Opens the index at 'path', creating it with 'capacity' slots
+            // (rounded up to a power of two) if it doesn't exist yet. The
+            // capacity of an existing index is kept.
+            explicit DigestCache(char const *const path, std::uint64_t const capacity = 1u << 20u, bool const use_xattr = false)
+                : use_xattr_(use_xattr)
+            {
+                Fd const fd(::open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644));
+                if ( -1 == fd.get() ) throw std::system_error(errno, std::generic_category(), path);
+
+                // Only the first process to open the index sizes it
+                if ( 0 != ::flock(fd.get(), LOCK_EX) ) throw std::system_error(errno, std::generic_category(), path);
+                struct stat st;
+                if ( 0 != ::fstat(fd.get(), &st) ) throw std::system_error(errno, std::generic_category(), path);
+                if ( 0 == st.st_size )
+                {
+                    std::uint64_t slots = 1u;
+                    while ( slots < capacity ) slots <<= 1u;
+                    char unsigned header[header_size] = {};
+                    std::memcpy(header, magic(), magic_size);
+                    std::memcpy(header + 8u, &slots, 8u);
+                    if ( 0 != ::ftruncate(fd.get(), static_cast<off_t>(header_size + slots * sizeof(Slot)))
+                         || static_cast<ssize_t>(header_size) != ::pwrite(fd.get(), header, header_size, 0) )
+                    {
+                        throw std::system_error(errno, std::generic_category(), path);
+                    }
+                    st.st_size = static_cast<off_t>(header_size + slots * sizeof(Slot));
+                }
+                ::flock(fd.get(), LOCK_UN);
+
+                size_ = static_cast<std::size_t>(st.st_size);
+                void *const p = ::mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd.get(), 0);
+                if ( MAP_FAILED == p ) throw std::system_error(errno, std::generic_category(), path);
+                base_ = static_cast<char unsigned *>(p);
+
+                std::memcpy(&mask_, base_ + 8u, 8u);
+                if ( 0 != std::memcmp(base_, magic(), magic_size) || 0u == mask_ || 0u != (mask_ & (mask_ - 1u))
+                     || header_size + mask_ * sizeof(Slot) != size_ )
+                {
+                    ::munmap(base_, size_);
+                    throw std::system_error(EINVAL, std::generic_category(), path);
+                }
+                --mask_;
+                slots_ = reinterpret_cast<Slot *>(base_ + header_size);
+            }
+
+            ~DigestCache(void)
+            {
+                ::munmap(base_, size_);
+            }
+
+            DigestCache(DigestCache const &) = delete;
+            DigestCache &operator=(DigestCache const &) = delete;
+
+            Stats stats(void) const noexcept
+            {
+                return Stats{ hits_.load(), misses_.load(), stores_.load() };
+            }
+
+            Digest compute(char const *const path)
+            {
+                Fd const fd = open_read(path);
+                return compute(fd.get());
+            }
+
+            Digest compute(int const fd)
+            {
+                struct stat before;
+                if ( 0 != ::fstat(fd, &before) ) throw std::system_error(errno, std::generic_category(), "fstat");
+
+                Digest d;
+                if ( lookup(before, d) )
+                {
+                    ++hits_;
+                    return d;
+                }
+                if ( use_xattr_ && xattr_lookup(fd, before, d) )
+                {
+                    ++hits_;
+                    if ( settled(before, static_cast<std::int64_t>(std::time(nullptr))) ) store(before, d);
+                    return d;
+                }
+                ++misses_;
+
+                std::int64_t const started = static_cast<std::int64_t>(std::time(nullptr));
+                d = file::compute(fd);
+
+                struct stat after;
+                if ( 0 != ::fstat(fd, &after) || !same_key(key_of(before), key_of(after)) ) return d;  // changed while hashing
+                if ( !settled(after, started) ) return d;
+
+                // Writing the attribute moves the ctime, and the new one is
+                // too recent to be trusted until a later call finds the
+                // attribute already written
+                if ( use_xattr_ && !xattr_current(fd, after, d) && (!xattr_store(fd, after, d) || !settled(after, started)) ) return d;
+                store(after, d);
+                return d;
+            }
+
+            bool lookup(struct stat const &st, Digest &d) const noexcept
+            {
+                Key const key = key_of(st);
+                std::uint64_t const home = home_of(key);
+                for ( unsigned i = 0u; i < probes; ++i )
+                {
+                    Slot const &s = slots_[(home + i) & mask_];
+                    std::uint64_t w[words];
+                    for ( unsigned j = 0u; j < words; ++j ) w[j] = s.w[j].load(std::memory_order_relaxed);
+                    if ( !same_key(key, w) || check_of(w) != w[8] ) continue;
+                    std::memcpy(d.b, w + 6, Digest::count);
+                    return true;
+                }
+                return false;
+            }
+
+            void store(struct stat const &st, Digest const &d) noexcept
+            {
+                Key const key = key_of(st);
+                std::uint64_t const home = home_of(key);
+
+                // Reuse the slot holding this key, else a free one, else the
+                // one stored longest ago
+                Slot *target = nullptr;
+                std::uint64_t oldest = ~std::uint64_t(0u);
+                for ( unsigned i = 0u; i < probes; ++i )
+                {
+                    Slot &s = slots_[(home + i) & mask_];
+                    std::uint64_t w[words];
+                    for ( unsigned j = 0u; j < words; ++j ) w[j] = s.w[j].load(std::memory_order_relaxed);
+                    bool const valid = (check_of(w) == w[8]);
+                    if ( valid && same_key(key, w) ) { target = &s; break; }
+                    std::uint64_t const age = valid ? w[9] : 0u;  // invalid slots are free
+                    if ( age < oldest ) { oldest = age; target = &s; }
+                }
+
+                std::uint64_t w[words];
+                std::memcpy(w, key.w, sizeof key.w);
+                std::memcpy(w + 6, d.b, Digest::count);
+                w[8] = check_of(w);
+                w[9] = static_cast<std::uint64_t>(std::time(nullptr));
+                for ( unsigned j = 0u; j < words; ++j ) target->w[j].store(w[j], std::memory_order_relaxed);
+                ++stores_;
+            }
+
+            static constexpr std::int64_t racy_window = 2;  // seconds
+
+        private:
+
+            // A function, as a static constexpr array would need a definition
+            // outside the class, and so in one translation unit, until C++17
+            static constexpr char const *magic(void) noexcept { return "MD5CACH1"; }
+            static constexpr std::size_t magic_size = 8u;
+            static constexpr std::size_t header_size = 64u;
+            static constexpr unsigned words = 10u;
+            static constexpr unsigned probes = 8u;
+
+            // Words 0-5 key, 6-7 digest, 8 check word, 9 time of the store
+            struct Slot {
+                std::atomic<std::uint64_t> w[words];
+            };
+            static_assert( sizeof(Slot) == words * 8u, "Slots must be plain words in the mapped file" );
+
+            struct Key {
+                std::uint64_t w[6];  // dev, ino, size, mtime ns, ctime ns, (unused)
+            };
+
+            char unsigned *base_ = nullptr;
+            std::size_t size_ = 0u;
+            std::uint64_t mask_ = 0u;
+            Slot *slots_ = nullptr;
+            bool use_xattr_;
+            std::atomic<std::uint64_t> hits_{ 0u }, misses_{ 0u }, stores_{ 0u };
+
+            static timespec mtime(struct stat const &st) noexcept
+            {
+#ifdef __APPLE__
+                return st.st_mtimespec;
+#else
+                return st.st_mtim;
+#endif
+            }
+
+            static timespec ctime(struct stat const &st) noexcept
+            {
+#ifdef __APPLE__
+                return st.st_ctimespec;
+#else
+                return st.st_ctim;
+#endif
+            }
+
+            static std::int64_t nanoseconds(timespec const &t) noexcept
+            {
+                return static_cast<std::int64_t>(t.tv_sec) * 1000000000 + t.tv_nsec;
+            }
+
+            static Key key_of(struct stat const &st) noexcept
+            {
+                return Key{ { static_cast<std::uint64_t>(st.st_dev), static_cast<std::uint64_t>(st.st_ino),
+                              static_cast<std::uint64_t>(st.st_size),
+                              static_cast<std::uint64_t>(nanoseconds(mtime(st))),
+                              static_cast<std::uint64_t>(nanoseconds(ctime(st))), 0u } };
+            }
+
+            static bool same_key(Key const &key, std::uint64_t const *const w) noexcept
+            {
+                return 0 == std::memcmp(key.w, w, sizeof key.w);
+            }
+
+            static bool same_key(Key const &a, Key const &b) noexcept
+            {
+                return same_key(a, b.w);
+            }
+
+            static std::uint64_t first_word(Digest const &d, unsigned const offset) noexcept
+            {
+                std::uint64_t n = 0u;
+                for ( unsigned i = 0u; i < 8u; ++i ) n = (n << 8u) | d.b[offset + i];
+                return n;
+            }
+
+            std::uint64_t home_of(Key const &key) const noexcept
+            {
+                return first_word(::md5::compute(reinterpret_cast<char unsigned const *>(key.w), sizeof key.w), 0u) & mask_;
+            }
+
+            // Never 0, so that an all-zero (never written) slot is invalid
+            static std::uint64_t check_of(std::uint64_t const *const w) noexcept
+            {
+                return first_word(::md5::compute(reinterpret_cast<char unsigned const *>(w), 8u * 8u), 8u) | 1u;
+            }
+
+            // Whether both timestamps of 'st' are older than 'since' by more
+            // than the racy window, so that a later change can't keep them
+            static bool settled(struct stat const &st, std::int64_t const since) noexcept
+            {
+                return nanoseconds(mtime(st)) / 1000000000 + racy_window < since
+                       && nanoseconds(ctime(st)) / 1000000000 + racy_window < since;
+            }
+
+            // Reads the digest and the five key words the attribute holds
+            static bool xattr_read(int const fd, Digest &d, unsigned long long (&w)[5]) noexcept
+            {
+#ifdef __linux__
+                char value[256];
+                ssize_t const n = ::fgetxattr(fd, "user.md5", value, sizeof value - 1u);
+                if ( n <= 0 ) return false;
+                value[n] = '\0';
+                char hex[33];
+                if ( 6 != std::sscanf(value, "%32s %llu %llu %llu %llu %llu", hex, &w[0], &w[1], &w[2], &w[3], &w[4]) ) return false;
+                for ( unsigned i = 0u; i < Digest::count; ++i )
+                {
+                    unsigned byte;
+                    if ( 1 != std::sscanf(hex + 2u * i, "%2x", &byte) ) return false;
+                    d[i] = static_cast<char unsigned>(byte);
+                }
+                return true;
+#else
+                (void)fd; (void)d; (void)w;
+                return false;
+#endif
+            }
+
+            // The attribute must hold the whole key of 'st', as an index entry would
+            static bool xattr_lookup(int const fd, struct stat const &st, Digest &d) noexcept
+            {
+                unsigned long long w[5];
+                if ( !xattr_read(fd, d, w) ) return false;
+                Key const key = key_of(st);
+                for ( unsigned i = 0u; i < 5u; ++i ) if ( w[i] != key.w[i] ) return false;
+                return true;
+            }
+
+            // Whether the attribute already holds 'd' for these contents,
+            // i.e. for everything in the key of 'st' but the ctime, which its
+            // own write moved on
+            static bool xattr_current(int const fd, struct stat const &st, Digest const &d) noexcept
+            {
+                Digest held;
+                unsigned long long w[5];
+                if ( !xattr_read(fd, held, w) || 0 != std::memcmp(held.b, d.b, Digest::count) ) return false;
+                Key const key = key_of(st);
+                for ( unsigned i = 0u; i < 4u; ++i ) if ( w[i] != key.w[i] ) return false;
+                return true;
+            }
+
+            // Writes the attribute and leaves in 'st' the state of the file
+            // afterwards, as the write changes its ctime. Fails if anything
+            // else changed meanwhile, as then the file may no longer hold 'd'.
+            static bool xattr_store(int const fd, struct stat &st, Digest const &d) noexcept
+            {
+#ifdef __linux__
+                for ( unsigned attempt = 0u; attempt < 2u; ++attempt )
+                {
+                    Key const key = key_of(st);
+                    char value[256];
+                    std::size_t n = 0u;
+                    for ( char unsigned const b : d ) n += static_cast<std::size_t>(std::snprintf(value + n, sizeof value - n, "%02x", b));
+                    n += static_cast<std::size_t>(std::snprintf(value + n, sizeof value - n, " %llu %llu %llu %llu %llu",
+                                       static_cast<unsigned long long>(key.w[0]), static_cast<unsigned long long>(key.w[1]),
+                                       static_cast<unsigned long long>(key.w[2]), static_cast<unsigned long long>(key.w[3]),
+                                       static_cast<unsigned long long>(key.w[4])));
+                    if ( 0 != ::fsetxattr(fd, "user.md5", value, n, 0) || 0 != ::fstat(fd, &st) ) return false;
+                    Key const now = key_of(st);
+                    if ( 0 != std::memcmp(key.w, now.w, 4u * sizeof key.w[0]) ) return false;  // dev, ino, size or mtime
+                    if ( same_key(key, now) ) break;  // the ctime didn't move
+                }
+                return true;
+#else
+                (void)fd; (void)st; (void)d;
+                return false;
+#endif
+            }
+        };
+
+    }  // close namespace 'file'
+}  // close namespace 'md5'
+
+#endif  // HEADER_INCLUSION_GUARD
@@ -0,0 +1,246 @@
+#ifndef HEADER_INCLUSION_GUARD_48125503371938306644170239816602549910733
+#define HEADER_INCLUSION_GUARD_48125503371938306644170239816602549910733
+
+// A Merkle tree over fixed-size chunks of a large object, so that one
+// chunk can be verified, or replaced and the root updated, without hashing
+// the rest of the object.
+//
+// The format is that of RFC 6962 (Certificate Transparency) with MD5 as
+// the hash, so other implementations can reproduce it:
+//
+//     leaf  = MD5(0x00 || chunk)
+//     node  = MD5(0x01 || left || right)
+//
+// The object is cut into chunks of 'chunk_size' bytes, the last one
+// possibly shorter. Leaves are paired from the left on every level, and a
+// node without a partner moves up a level unchanged, which gives the same
+// tree as RFC 6962's split at the largest power of two. An empty object
+// has no chunks and its root is MD5 of nothing.
+//
+// A range proof lets someone who knows only the root check a run of
+// chunks. It holds the digests needed to rebuild the root from those
+// leaves, level by level from the leaves up, and on each level the left
+// neighbour (if needed) before the right one.
+
+#include <cerrno>        // EIO
+#include <cstdint>       // uint64_t
+#include <cstring>       // memcmp
+#include <stdexcept>     // out_of_range, invalid_argument
+#include <system_error>  // system_error
+#include <thread>        // hardware_concurrency
+#include <utility>       // move
+#include <vector>        // vector
+#include "md5.hpp"
+#include "md5_file.hpp"
+#include "md5_util.hpp"
+
+namespace md5 {
+    namespace merkle {
+
+        inline Digest leaf(char unsigned const *const data, std::size_t const len)
+        {
+            char unsigned const prefix = 0x00u;
+            details::Context ctx;
+            ctx.append(&prefix, 1u);
+            ctx.append(data, len);
+            return ctx.final();
+        }
+
+        inline Digest node(Digest const &left, Digest const &right)
+        {
+            char unsigned buffer[1u + 2u * Digest::count];
+            buffer[0] = 0x01u;
+            for ( unsigned i = 0u; i < Digest::count; ++i ) { buffer[1u + i] = left.b[i]; buffer[1u + Digest::count + i] = right.b[i]; }
+            return ::md5::compute(buffer, sizeof buffer);
+        }
+
+        inline bool same(Digest const &a, Digest const &b) noexcept
+        {
+            return 0 == std::memcmp(a.b, b.b, Digest::count);
+        }
+
+        struct RangeProof {
+            std::uint64_t leaf_count;  // leaves in the whole tree
+            std::uint64_t first;       // first leaf covered
+            std::uint64_t count;       // number of leaves covered
+            std::vector<Digest> nodes;
+        };
+
+        class MerkleTree {
+        public:
+
+            static constexpr std::uint64_t default_chunk_size = 4u * 1024u * 1024u;
+
+            // A tree over the 'leaves' of an object of 'length' bytes, already
+            // hashed with 'leaf'
+            MerkleTree(std::vector<Digest> leaves, std::uint64_t const length, std::uint64_t const chunk_size = default_chunk_size)
+                : chunk_size_(chunk_size), length_(length)
+            {
+                if ( 0u == chunk_size ) throw std::invalid_argument("md5::merkle: chunk size of zero");
+                if ( leaves.size() != (length + chunk_size - 1u) / chunk_size ) throw std::invalid_argument("md5::merkle: leaf count doesn't match length");
+                levels_.push_back(std::move(leaves));
+                build();
+            }
+
+            static MerkleTree from_memory(char unsigned const *const data, std::uint64_t const len,
+                                          std::uint64_t const chunk_size = default_chunk_size,
+                                          unsigned const threads = std::thread::hardware_concurrency())
+            {
+                if ( 0u == chunk_size ) throw std::invalid_argument("md5::merkle: chunk size of zero");
+                std::vector<Digest> leaves(static_cast<std::size_t>((len + chunk_size - 1u) / chunk_size));
+                util::parallel_for(leaves.size(), threads, [&](std::size_t const i) {
+                    std::uint64_t const offset = i * chunk_size;
+                    leaves[i] = leaf(data + offset, static_cast<std::size_t>((len - offset < chunk_size) ? len - offset : chunk_size));
+                });
+                return MerkleTree(std::move(leaves), len, chunk_size);
+            }
+
+            // Hashes the first 'len' bytes of 'fd', reading chunks in parallel.
+            // Throws std::system_error if the file is shorter or can't be read.
+            static MerkleTree from_file(int const fd, std::uint64_t const len,
+                                        std::uint64_t const chunk_size = default_chunk_size,
+                                        unsigned const threads = std::thread::hardware_concurrency())
+            {
+                if ( 0u == chunk_size ) throw std::invalid_argument("md5::merkle: chunk size of zero");
+                std::vector<Digest> leaves(static_cast<std::size_t>((len + chunk_size - 1u) / chunk_size));
+                std::vector<int> errors(leaves.size(), 0);
+                util::parallel_for(leaves.size(), threads, [&](std::size_t const i) {
+                    std::uint64_t const offset = i * chunk_size;
+                    try
+                    {
+                        leaves[i] = read_leaf(fd, offset, (len - offset < chunk_size) ? len - offset : chunk_size);
+                    }
+                    catch ( std::system_error const &e )
+                    {
+                        errors[i] = e.code().value();
+                    }
+                });
+                for ( int const error : errors ) if ( 0 != error ) throw std::system_error(error, std::generic_category(), "md5::merkle");
+                return MerkleTree(std::move(leaves), len, chunk_size);
+            }
+
+            std::uint64_t chunk_size(void) const noexcept { return chunk_size_; }
+            std::uint64_t length(void) const noexcept { return length_; }
+            std::uint64_t leaf_count(void) const noexcept { return levels_.front().size(); }
+
+            Digest root(void) const
+            {
+                if ( levels_.back().empty() ) return ::md5::compute("");
+                return levels_.back().front();
+            }
+
+            Digest const &leaf_digest(std::uint64_t const index) const
+            {
+                return levels_.front().at(static_cast<std::size_t>(index));
+            }
+
+            // Replaces one leaf and updates the nodes above it, O(log n)
+            void set_leaf(std::uint64_t const index, Digest const &d)
+            {
+                std::size_t i = static_cast<std::size_t>(index);
+                levels_.front().at(i) = d;
+                for ( std::size_t level = 1u; level < levels_.size(); ++level, i /= 2u ) combine(level, i / 2u);
+            }
+
+            // Hashes chunk 'index' of 'fd' again and updates the tree with it
+            void update_leaf(int const fd, std::uint64_t const index)
+            {
+                set_leaf(index, read_leaf(fd, index * chunk_size_, chunk_length(index)));
+            }
+
+            // True if chunk 'index' of 'fd' still matches the tree
+            bool verify_leaf(int const fd, std::uint64_t const index) const
+            {
+                return same(leaf_digest(index), read_leaf(fd, index * chunk_size_, chunk_length(index)));
+            }
+
+            RangeProof prove(std::uint64_t const first, std::uint64_t const count) const
+            {
+                if ( 0u == count || first + count > leaf_count() || first + count < first ) throw std::out_of_range("md5::merkle: range");
+                RangeProof proof{ leaf_count(), first, count, {} };
+                std::uint64_t a = first, b = first + count;
+                for ( std::size_t level = 0u; level + 1u < levels_.size(); ++level )
+                {
+                    std::uint64_t const n = levels_[level].size();
+                    if ( 0u != (a & 1u) ) proof.nodes.push_back(levels_[level][static_cast<std::size_t>(--a)]);
+                    if ( 0u != (b & 1u) && b < n ) proof.nodes.push_back(levels_[level][static_cast<std::size_t>(b++)]);
+                    a /= 2u;
+                    b = (b + 1u) / 2u;
+                }
+                return proof;
+            }
+
+            // Rebuilds the root from the 'proof.count' leaf digests at 'leaves'
+            // and the proof, and compares it with 'root'
+            static bool verify(Digest const &root, RangeProof const &proof, Digest const *const leaves)
+            {
+                if ( 0u == proof.count || proof.first + proof.count > proof.leaf_count || proof.first + proof.count < proof.first ) return false;
+                std::vector<Digest> level(leaves, leaves + proof.count);
+                std::uint64_t a = proof.first, b = proof.first + proof.count, n = proof.leaf_count;
+                std::size_t used = 0u;
+                while ( n > 1u )
+                {
+                    if ( 0u != (a & 1u) )
+                    {
+                        if ( used == proof.nodes.size() ) return false;
+                        level.insert(level.begin(), proof.nodes[used++]);
+                        --a;
+                    }
+                    if ( 0u != (b & 1u) && b < n )
+                    {
+                        if ( used == proof.nodes.size() ) return false;
+                        level.push_back(proof.nodes[used++]);
+                        ++b;
+                    }
+                    std::vector<Digest> up;
+                    for ( std::size_t i = 0u; i < level.size(); i += 2u ) up.push_back((i + 1u < level.size()) ? node(level[i], level[i + 1u]) : level[i]);
+                    level.swap(up);
+                    a /= 2u;
+                    b = (b + 1u) / 2u;
+                    n = (n + 1u) / 2u;
+                }
+                return used == proof.nodes.size() && 1u == level.size() && same(level.front(), root);
+            }
+
+        private:
+
+            std::uint64_t chunk_size_;
+            std::uint64_t length_;
+            std::vector<std::vector<Digest>> levels_;  // leaves first, root last
+
+            std::uint64_t chunk_length(std::uint64_t const index) const
+            {
+                if ( index >= leaf_count() ) throw std::out_of_range("md5::merkle: leaf index");
+                std::uint64_t const offset = index * chunk_size_;
+                return (length_ - offset < chunk_size_) ? length_ - offset : chunk_size_;
+            }
+
+            static Digest read_leaf(int const fd, std::uint64_t const offset, std::uint64_t const len)
+            {
+                char unsigned const prefix = 0x00u;
+                details::Context ctx;
+                ctx.append(&prefix, 1u);
+                if ( file::append_range(ctx, fd, offset, len) != len ) throw std::system_error(EIO, std::generic_category(), "md5::merkle: file shorter than the tree");
+                return ctx.final();
+            }
+
+            void combine(std::size_t const level, std::size_t const i)
+            {
+                std::vector<Digest> const &below = levels_[level - 1u];
+                levels_[level][i] = (2u * i + 1u < below.size()) ? node(below[2u * i], below[2u * i + 1u]) : below[2u * i];
+            }
+
+            void build(void)
+            {
+                while ( levels_.back().size() > 1u )
+                {
+                    levels_.emplace_back((levels_.back().size() + 1u) / 2u);
+                    for ( std::size_t i = 0u; i < levels_.back().size(); ++i ) combine(levels_.size() - 1u, i);
+                }
+            }
+        };
+
+    }  // close namespace 'merkle'
+}  // close namespace 'md5'
+
+#endif  // HEADER_INCLUSION_GUARD
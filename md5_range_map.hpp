@@ -0,0 +1,273 @@
+#ifndef HEADER_INCLUSION_GUARD_93316260478812530164471125098803643715840
+#define HEADER_INCLUSION_GUARD_93316260478812530164471125098803643715840
+
+// Digest maps of block devices and disk images: the MD5 of the whole
+// image plus one MD5 per fixed-size range, so that when two copies differ
+// the damaged ranges can be found and copied again (POSIX only).
+//
+// The image is read with O_DIRECT where the filesystem allows it, so the
+// page cache isn't flooded, by 'depth' threads keeping that many reads in
+// flight. Chunks go through a ring of aligned buffers to two hashing
+// threads, one for the whole image and one for the ranges, which consume
+// them in order. Both digests thus cost one read of the image and the
+// time of one MD5 pass.
+//
+// The map is saved as text:
+//     md5-range-map 1
+//     length <bytes>
+//     range <bytes>
+//     whole <hex digest>
+//     <offset> <hex digest>      one line per range, the last one possibly shorter
+//
+// Errors are reported by throwing std::system_error or std::runtime_error.
+
+#include <atomic>              // atomic
+#include <cerrno>              // errno
+#include <condition_variable>  // condition_variable
+#include <cstdint>             // uint64_t
+#include <cstdio>              // FILE, fopen, fprintf, fscanf
+#include <cstring>             // memcmp
+#include <exception>           // exception_ptr
+#include <mutex>               // mutex, unique_lock
+#include <stdexcept>           // runtime_error, invalid_argument
+#include <string>              // string
+#include <system_error>        // system_error
+#include <thread>              // thread
+#include <vector>              // vector
+#include <fcntl.h>             // open, O_DIRECT
+#include <unistd.h>            // pread, lseek
+#include "md5.hpp"
+#include "md5_file.hpp"
+#include "md5_util.hpp"
+
+namespace md5 {
+    namespace range_map {
+
+        struct RangeMap {
+            std::uint64_t length = 0u;      // of the image
+            std::uint64_t range_size = 0u;
+            Digest whole = {};
+            std::vector<Digest> ranges;
+        };
+
+        struct Options {
+            std::uint64_t range_size = 64u * 1024u * 1024u;  // a multiple of 4096
+            unsigned depth = 8u;                             // reads in flight
+            bool direct = true;                              // try O_DIRECT
+        };
+
+        namespace details {
+
+            constexpr std::uint64_t max_chunk = 1024u * 1024u;
+
+            // The largest multiple of the alignment no bigger than max_chunk
+            // that divides a range in whole pieces. 'range_size' is a multiple
+            // of the alignment, so the alignment itself always does.
+            inline std::uint64_t chunk_size(std::uint64_t const range_size) noexcept
+            {
+                if ( range_size <= max_chunk ) return range_size;
+                std::uint64_t chunk = max_chunk - max_chunk % file::alignment;
+                while ( 0u != range_size % chunk ) chunk -= file::alignment;
+                return chunk;
+            }
+        }
+
+        // Hashes the image open on 'fd', which may have been opened with
+        // O_DIRECT
+        inline RangeMap hash(int const fd, Options const &options = Options())
+        {
+            if ( 0u == options.range_size || 0u != options.range_size % file::alignment ) throw std::invalid_argument("md5::range_map: range size must be a multiple of 4096");
+            off_t const end = ::lseek(fd, 0, SEEK_END);  // also works for block devices
+            if ( end < 0 ) throw std::system_error(errno, std::generic_category(), "lseek");
+
+            RangeMap map;
+            map.length = static_cast<std::uint64_t>(end);
+            map.range_size = options.range_size;
+            map.ranges.resize(static_cast<std::size_t>((map.length + map.range_size - 1u) / map.range_size));
+
+            std::uint64_t const chunk = details::chunk_size(options.range_size);
+            std::uint64_t const chunks = (map.length + chunk - 1u) / chunk;
+            std::size_t const slots = (0u != options.depth ? options.depth : 1u) + 2u;
+
+            struct Slot {
+                file::AlignedBuffer buffer;
+                std::uint64_t chunk;  // the chunk this slot holds or waits for
+                std::size_t length;
+                bool ready;
+                unsigned consumers;   // hashing threads still to see it
+            };
+            std::vector<Slot> ring(slots);
+            for ( std::size_t i = 0u; i < slots; ++i )
+            {
+                ring[i].buffer = file::aligned_buffer(static_cast<std::size_t>(chunk));
+                ring[i].chunk = i;
+                ring[i].length = 0u;
+                ring[i].ready = false;
+                ring[i].consumers = 2u;
+            }
+
+            std::mutex mutex;
+            std::condition_variable changed;
+            std::atomic<std::uint64_t> next{ 0u };
+            std::exception_ptr error;
+            bool failed = false;
+
+            auto const reader = [&]() {
+                for ( std::uint64_t c; (c = next.fetch_add(1u)) < chunks; )
+                {
+                    Slot &slot = ring[static_cast<std::size_t>(c % slots)];
+                    {
+                        std::unique_lock<std::mutex> lock(mutex);
+                        changed.wait(lock, [&]() { return failed || slot.chunk == c; });
+                        if ( failed ) return;
+                    }
+                    std::size_t n = 0u;
+                    try
+                    {
+                        n = file::read_aligned(fd, slot.buffer.get(), static_cast<std::size_t>(chunk), c * chunk);
+                        std::uint64_t const want = (map.length - c * chunk < chunk) ? map.length - c * chunk : chunk;
+                        if ( n < want ) throw std::runtime_error("md5::range_map: image shrank while reading");
+                        n = static_cast<std::size_t>(want);
+                    }
+                    catch ( ... )
+                    {
+                        std::lock_guard<std::mutex> const lock(mutex);
+                        if ( !failed ) error = std::current_exception();
+                        failed = true;
+                        changed.notify_all();
+                        return;
+                    }
+                    std::lock_guard<std::mutex> const lock(mutex);
+                    slot.length = n;
+                    slot.ready = true;
+                    changed.notify_all();
+                }
+            };
+
+            // Hands every chunk in order to 'fn', then frees its slot once
+            // both hashing threads are done with it
+            auto const consume = [&](auto const &fn) {
+                for ( std::uint64_t c = 0u; c < chunks; ++c )
+                {
+                    Slot &slot = ring[static_cast<std::size_t>(c % slots)];
+                    {
+                        std::unique_lock<std::mutex> lock(mutex);
+                        changed.wait(lock, [&]() { return failed || (slot.chunk == c && slot.ready); });
+                        if ( failed ) return;
+                    }
+                    fn(c, slot.buffer.get(), slot.length);
+                    std::lock_guard<std::mutex> const lock(mutex);
+                    if ( 0u == --slot.consumers )
+                    {
+                        slot.chunk = c + slots;
+                        slot.ready = false;
+                        slot.consumers = 2u;
+                        changed.notify_all();
+                    }
+                }
+            };
+
+            ::md5::details::Context whole;
+            std::thread whole_thread(consume, [&](std::uint64_t, char unsigned const *const data, std::size_t const n) {
+                whole.append(data, n);
+            });
+
+            std::vector<std::thread> readers;
+            for ( unsigned i = 0u; i < options.depth || 0u == i; ++i ) readers.emplace_back(reader);
+
+            std::uint64_t const per_range = options.range_size / chunk;
+            ::md5::details::Context range;
+            consume([&](std::uint64_t const c, char unsigned const *const data, std::size_t const n) {
+                range.append(data, n);
+                if ( (c + 1u) % per_range == 0u || c + 1u == chunks )
+                {
+                    map.ranges[static_cast<std::size_t>(c / per_range)] = range.final();
+                    range = ::md5::details::Context();
+                }
+            });
+
+            whole_thread.join();
+            for ( std::thread &t : readers ) t.join();
+            if ( failed ) std::rethrow_exception(error);
+            map.whole = whole.final();
+            return map;
+        }
+
+        inline RangeMap hash(char const *const path, Options const &options = Options())
+        {
+            int fd = -1;
+#ifdef O_DIRECT
+            if ( options.direct ) fd = ::open(path, O_RDONLY | O_CLOEXEC | O_DIRECT);
+#endif
+            if ( -1 == fd ) fd = ::open(path, O_RDONLY | O_CLOEXEC);  // e.g. tmpfs doesn't support O_DIRECT
+            if ( -1 == fd ) throw std::system_error(errno, std::generic_category(), path);
+            file::Fd const owner(fd);
+#if defined(POSIX_FADV_SEQUENTIAL) && !defined(__APPLE__)
+            ::posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+            return hash(fd, options);
+        }
+
+        inline void save(RangeMap const &map, char const *const path)
+        {
+            std::FILE *const f = std::fopen(path, "w");
+            if ( nullptr == f ) throw std::system_error(errno, std::generic_category(), path);
+            std::fprintf(f, "md5-range-map 1\nlength %llu\nrange %llu\nwhole %s\n", static_cast<unsigned long long>(map.length),
+                         static_cast<unsigned long long>(map.range_size), util::hex(map.whole).c_str());
+            for ( std::size_t i = 0u; i < map.ranges.size(); ++i )
+            {
+                std::fprintf(f, "%llu %s\n", static_cast<unsigned long long>(i * map.range_size), util::hex(map.ranges[i]).c_str());
+            }
+            int const error = errno;
+            bool const ok = (0 == std::ferror(f));
+            if ( 0 != std::fclose(f) || !ok ) throw std::system_error(error, std::generic_category(), path);
+        }
+
+        inline RangeMap load(char const *const path)
+        {
+            std::FILE *const f = std::fopen(path, "r");
+            if ( nullptr == f ) throw std::system_error(errno, std::generic_category(), path);
+            RangeMap map;
+            char hex[33];
+            unsigned long long length = 0u, range_size = 0u, offset;
+            bool ok = (3 == std::fscanf(f, "md5-range-map 1 length %llu range %llu whole %32s", &length, &range_size, hex))
+                   && 0u != range_size && util::from_hex(hex, map.whole);
+            map.length = length;
+            map.range_size = range_size;
+            while ( ok && 2 == std::fscanf(f, "%llu %32s", &offset, hex) )
+            {
+                Digest d;
+                ok = (offset == map.ranges.size() * map.range_size) && util::from_hex(hex, d);
+                map.ranges.push_back(d);
+            }
+            std::fclose(f);
+            if ( !ok || map.ranges.size() != (map.length + map.range_size - 1u) / map.range_size ) throw std::runtime_error(std::string("md5::range_map: not a valid map: ") + path);
+            return map;
+        }
+
+        struct Difference {
+            std::uint64_t offset, length;
+        };
+
+        // The ranges that differ between two maps of the same range size,
+        // merged where adjacent. Bytes only one image has count as different.
+        inline std::vector<Difference> compare(RangeMap const &a, RangeMap const &b)
+        {
+            if ( a.range_size != b.range_size ) throw std::invalid_argument("md5::range_map: maps have different range sizes");
+            std::uint64_t const length = (a.length > b.length) ? a.length : b.length;
+            std::vector<Difference> out;
+            for ( std::size_t i = 0u; i * a.range_size < length; ++i )
+            {
+                std::uint64_t const offset = i * a.range_size;
+                if ( i < a.ranges.size() && i < b.ranges.size() && 0 == std::memcmp(a.ranges[i].b, b.ranges[i].b, Digest::count) ) continue;
+                std::uint64_t const n = (length - offset < a.range_size) ? length - offset : a.range_size;
+                if ( !out.empty() && out.back().offset + out.back().length == offset ) out.back().length += n;
+                else out.push_back(Difference{ offset, n });
+            }
+            return out;
+        }
+
+    }  // close namespace 'range_map'
+}  // close namespace 'md5'
+
+#endif  // HEADER_INCLUSION_GUARD
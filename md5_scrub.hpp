@@ -0,0 +1,308 @@
+#ifndef HEADER_INCLUSION_GUARD_05518829640372713196482270034667129184356
+#define HEADER_INCLUSION_GUARD_05518829640372713196482270034667129184356
+
+// A background scrubber: re-reads the files of a manifest and checks them
+// against their stored digests, while staying out of the way of other
+// I/O (POSIX; I/O priority on Linux only).
+//
+//   - Reads are paced by a token bucket with a budget of bytes per second
+//     and of reads per second, with at most one second of burst.
+//   - The latency of every read is tracked. When its moving average rises
+//     above 'latency_target' the budget is halved, and it recovers slowly
+//     once the device is fast again (down to 1/64 of the configured rate).
+//   - With 'idle_priority' the scrubbing thread moves to the idle I/O
+//     class, so the kernel only serves it when the disk has nothing else
+//     to do. Limits of the cgroup (io.max) apply on top of all of this.
+//   - Pages read are dropped from the page cache again.
+//   - A checkpoint (manifest digest, pass, next entry) is written
+//     atomically every 'checkpoint_interval' and when stopping, so a pass
+//     spread over weeks resumes where it stopped. A checkpoint of a
+//     different manifest is ignored.
+//
+// The manifest is md5sum output: "<hex digest>  <path>" per line.
+
+#include <atomic>        // atomic
+#include <cerrno>        // errno
+#include <chrono>        // steady_clock
+#include <cstdint>       // uint64_t
+#include <cstdio>        // FILE, fopen, fgets, fprintf, rename
+#include <cstring>       // memcmp, strlen
+#include <functional>    // function
+#include <stdexcept>     // runtime_error
+#include <string>        // string
+#include <system_error>  // system_error
+#include <thread>        // sleep_for
+#include <vector>        // vector
+#include <fcntl.h>       // posix_fadvise
+#include <unistd.h>      // syscall
+#ifdef __linux__
+#   include <sys/syscall.h>  // SYS_ioprio_set
+#endif
+#include "md5.hpp"
+#include "md5_file.hpp"
+#include "md5_util.hpp"
+
+namespace md5 {
+    namespace scrub {
+
+        struct Options {
+            double bytes_per_second = 50.0 * 1024.0 * 1024.0;  // 0 for no limit
+            double reads_per_second = 200.0;                   // 0 for no limit
+            std::size_t read_size = 1024u * 1024u;
+            std::chrono::milliseconds latency_target{ 50 };    // 0 to never back off
+            bool idle_priority = true;
+            std::string checkpoint;                            // path, empty for none
+            std::chrono::seconds checkpoint_interval{ 10 };
+        };
+
+        struct Entry {
+            Digest digest;
+            std::string path;
+        };
+
+        enum class Result { ok, mismatch, error };
+
+        struct Stats {
+            std::uint64_t files = 0u, bytes = 0u, mismatches = 0u, errors = 0u;
+        };
+
+        // Takes tokens at 'rate' per second, with a burst of one second. The
+        // balance may go negative, so that a cost only known afterwards can
+        // be charged in full and paid off by the next wait.
+        class TokenBucket {
+        public:
+            explicit TokenBucket(double const rate) noexcept : rate_(rate), tokens_(rate), last_(Clock::now()) {}
+
+            // Sleeps until 'n' tokens are available and takes them. A request
+            // larger than the burst waits until the bucket is full.
+            void take(double const n, double const scale)
+            {
+                if ( rate_ <= 0.0 ) return;
+                double const rate = rate_ * scale;
+                for ( ;; )
+                {
+                    refill(rate);
+                    double const need = (n < rate) ? n : rate;
+                    if ( tokens_ >= need ) { tokens_ -= n; return; }
+                    std::this_thread::sleep_for(std::chrono::duration<double>((need - tokens_) / rate));
+                }
+            }
+
+            // Sleeps while the balance isn't positive
+            void wait(double const scale)
+            {
+                if ( rate_ <= 0.0 ) return;
+                double const rate = rate_ * scale;
+                for ( refill(rate); tokens_ <= 0.0; refill(rate) )
+                {
+                    std::this_thread::sleep_for(std::chrono::duration<double>(-tokens_ / rate));
+                }
+            }
+
+            // Takes 'n' tokens whether or not there are that many
+            void charge(double const n) noexcept
+            {
+                if ( rate_ > 0.0 ) tokens_ -= n;
+            }
+
+        private:
+            using Clock = std::chrono::steady_clock;
+            double rate_, tokens_;
+            Clock::time_point last_;
+
+            void refill(double const rate) noexcept
+            {
+                Clock::time_point const now = Clock::now();
+                tokens_ += std::chrono::duration<double>(now - last_).count() * rate;
+                if ( tokens_ > rate ) tokens_ = rate;
+                last_ = now;
+            }
+        };
+
+        inline std::vector<Entry> load_manifest(char const *const path)
+        {
+            std::FILE *const f = std::fopen(path, "r");
+            if ( nullptr == f ) throw std::system_error(errno, std::generic_category(), path);
+            std::vector<Entry> entries;
+            std::string line;
+            char buffer[4096];
+            while ( nullptr != std::fgets(buffer, sizeof buffer, f) )
+            {
+                line += buffer;
+                if ( '\n' != line.back() && !std::feof(f) ) continue;
+                while ( !line.empty() && ('\n' == line.back() || '\r' == line.back()) ) line.pop_back();
+                Entry e;
+                if ( line.size() > 34u && ' ' == line[32] && util::from_hex(line.substr(0u, 32u).c_str(), e.digest) )
+                {
+                    e.path = line.substr(('*' == line[33] || ' ' == line[33]) ? 34u : 33u);  // md5sum's text or binary marker
+                    entries.push_back(std::move(e));
+                }
+                line.clear();
+            }
+            std::fclose(f);
+            return entries;
+        }
+
+        // Moves the calling thread to the idle I/O class; false if the
+        // platform has no such thing
+        inline bool set_idle_io_priority(void) noexcept
+        {
+#if defined(__linux__) && defined(SYS_ioprio_set)
+            constexpr int who_process = 1, class_idle = 3, class_shift = 13;
+            return 0 == ::syscall(SYS_ioprio_set, who_process, 0, class_idle << class_shift);
+#else
+            return false;
+#endif
+        }
+
+        class Scrubber {
+        public:
+
+            // Called for every file that doesn't match or can't be read, with
+            // the error message for the latter
+            using Report = std::function<void(Entry const &, Result, char const *message)>;
+
+            Scrubber(std::vector<Entry> entries, Options options)
+                : entries_(std::move(entries)), options_(std::move(options)),
+                  bytes_(options_.bytes_per_second), reads_(options_.reads_per_second)
+            {
+                ::md5::details::Context ctx;
+                for ( Entry const &e : entries_ )
+                {
+                    ctx.append(e.digest.b, Digest::count);
+                    ctx.append(e.path.c_str(), e.path.size() + 1u);
+                }
+                manifest_ = ctx.final();
+                load_checkpoint();
+            }
+
+            std::uint64_t pass(void) const noexcept { return pass_; }
+            std::size_t next(void) const noexcept { return next_; }
+            Stats const &stats(void) const noexcept { return stats_; }
+            double scale(void) const noexcept { return scale_; }
+
+            // Checks files until the end of the pass, or until 'stop' is set.
+            // Returns true if the pass was completed; the next call starts
+            // the next pass.
+            bool run(std::atomic<bool> const &stop, Report const &report = Report())
+            {
+                if ( options_.idle_priority ) set_idle_io_priority();
+                while ( next_ < entries_.size() )
+                {
+                    if ( stop.load() ) return save_checkpoint(true), false;
+                    Entry const &e = entries_[next_];
+                    std::string message;
+                    Result const result = check(e, stop, message);
+                    if ( stop.load() && Result::error == result && message.empty() ) return save_checkpoint(true), false;  // interrupted mid-file
+                    ++stats_.files;
+                    if ( Result::mismatch == result ) ++stats_.mismatches;
+                    if ( Result::error == result ) ++stats_.errors;
+                    if ( Result::ok != result && report ) report(e, result, message.c_str());
+                    ++next_;
+                    save_checkpoint(false);
+                }
+                next_ = 0u;
+                ++pass_;
+                save_checkpoint(true);
+                return true;
+            }
+
+        private:
+
+            using Clock = std::chrono::steady_clock;
+
+            std::vector<Entry> entries_;
+            Options options_;
+            Digest manifest_;
+            std::uint64_t pass_ = 0u;
+            std::size_t next_ = 0u;
+            Stats stats_;
+            TokenBucket bytes_, reads_;
+            double scale_ = 1.0;
+            double latency_ = 0.0;  // moving average, seconds
+            Clock::time_point saved_ = Clock::now();
+
+            Result check(Entry const &e, std::atomic<bool> const &stop, std::string &message)
+            {
+                try
+                {
+                    file::Fd const fd = file::open_read(e.path.c_str());
+                    std::vector<char unsigned> buffer(options_.read_size);
+                    ::md5::details::Context ctx;
+                    for ( std::uint64_t offset = 0u;; )
+                    {
+                        if ( stop.load() ) return Result::error;
+                        // Bytes are charged once the read says how many there were
+                        bytes_.wait(scale_);
+                        reads_.take(1.0, scale_);
+
+                        Clock::time_point const start = Clock::now();
+                        std::size_t const n = file::read_at(fd.get(), buffer.data(), buffer.size(), offset);
+                        bytes_.charge(static_cast<double>(n));
+                        observe(std::chrono::duration<double>(Clock::now() - start).count());
+#if defined(POSIX_FADV_DONTNEED) && !defined(__APPLE__)
+                        ::posix_fadvise(fd.get(), static_cast<off_t>(offset), static_cast<off_t>(n), POSIX_FADV_DONTNEED);
+#endif
+                        ctx.append(buffer.data(), n);
+                        offset += n;
+                        stats_.bytes += n;
+                        if ( n < buffer.size() ) break;
+                    }
+                    Digest const d = ctx.final();
+                    return (0 == std::memcmp(d.b, e.digest.b, Digest::count)) ? Result::ok : Result::mismatch;
+                }
+                catch ( std::system_error const &error )
+                {
+                    message = error.what();
+                    return Result::error;
+                }
+            }
+
+            // Multiplicative decrease when reads get slow, slow increase after
+            void observe(double const seconds) noexcept
+            {
+                latency_ = (0.0 == latency_) ? seconds : 0.9 * latency_ + 0.1 * seconds;
+                double const target = std::chrono::duration<double>(options_.latency_target).count();
+                if ( target <= 0.0 ) return;
+                if ( latency_ > target ) { scale_ *= 0.5; if ( scale_ < 1.0 / 64.0 ) scale_ = 1.0 / 64.0; latency_ = target; }
+                else if ( latency_ < 0.5 * target ) { scale_ *= 1.02; if ( scale_ > 1.0 ) scale_ = 1.0; }
+            }
+
+            void load_checkpoint(void)
+            {
+                if ( options_.checkpoint.empty() ) return;
+                std::FILE *const f = std::fopen(options_.checkpoint.c_str(), "r");
+                if ( nullptr == f ) return;
+                char hex[33];
+                unsigned long long pass, next;
+                Digest d;
+                if ( 3 == std::fscanf(f, "md5-scrub-checkpoint 1 manifest %32s pass %llu next %llu", hex, &pass, &next)
+                     && util::from_hex(hex, d) && 0 == std::memcmp(d.b, manifest_.b, Digest::count) && next <= entries_.size() )
+                {
+                    pass_ = pass;
+                    next_ = static_cast<std::size_t>(next);
+                }
+                std::fclose(f);
+            }
+
+            void save_checkpoint(bool const force)
+            {
+                if ( options_.checkpoint.empty() ) return;
+                if ( !force && Clock::now() - saved_ < options_.checkpoint_interval ) return;
+                saved_ = Clock::now();
+                std::string const temp = options_.checkpoint + ".tmp";
+                std::FILE *const f = std::fopen(temp.c_str(), "w");
+                if ( nullptr == f ) throw std::system_error(errno, std::generic_category(), temp);
+                std::fprintf(f, "md5-scrub-checkpoint 1\nmanifest %s\npass %llu\nnext %llu\n", util::hex(manifest_).c_str(),
+                             static_cast<unsigned long long>(pass_), static_cast<unsigned long long>(next_));
+                bool const ok = (0 == std::fflush(f)) && (0 == ::fsync(::fileno(f)));
+                int const error = errno;
+                if ( 0 != std::fclose(f) || !ok ) throw std::system_error(error, std::generic_category(), temp);
+                if ( 0 != std::rename(temp.c_str(), options_.checkpoint.c_str()) ) throw std::system_error(errno, std::generic_category(), options_.checkpoint);
+            }
+        };
+
+    }  // close namespace 'scrub'
+}  // close namespace 'md5'
+
+#endif  // HEADER_INCLUSION_GUARD
@@ -0,0 +1,144 @@
+#ifndef HEADER_INCLUSION_GUARD_72219934061883025711845639972041155376293
+#define HEADER_INCLUSION_GUARD_72219934061883025711845639972041155376293
+
+// Hashing of data passing from one descriptor to another, e.g. stdin to a
+// file or a socket to a pipe (POSIX; zero-copy on Linux only).
+//
+// On Linux the data is moved with splice(): from 'in' into a pipe, and
+// from that pipe to 'out', so the bytes being forwarded never enter user
+// space. tee() duplicates each batch into a second pipe, which only
+// shares the pages, and that copy is read once to be hashed. Compared to
+// read(), hash, write() this saves the copy back into the kernel.
+//
+// Not every descriptor can be spliced (e.g. files opened with O_APPEND on
+// older kernels, or some character devices). When splice() refuses one
+// of them, the transfer carries on from where it is with read() and
+// write(), so the caller never has to know. Elsewhere that's all there is.
+
+#include <cerrno>        // errno
+#include <cstdint>       // uint64_t
+#include <system_error>  // system_error
+#include <vector>        // vector
+#include <fcntl.h>       // splice, tee
+#include <unistd.h>      // write
+#include "md5.hpp"
+#include "md5_file.hpp"
+
+namespace md5 {
+    namespace splice {
+
+        struct Stats {
+            std::uint64_t bytes = 0u;
+            std::uint64_t spliced = 0u;  // of which moved without passing through user space
+        };
+
+        namespace details {
+
+            inline void write_all(int const fd, char unsigned const *data, std::size_t len)
+            {
+                while ( 0u != len )
+                {
+                    ssize_t const n = ::write(fd, data, len);
+                    if ( n < 0 && EINTR == errno ) continue;
+                    if ( n <= 0 ) throw std::system_error((n < 0) ? errno : EIO, std::generic_category(), "write");
+                    data += n;
+                    len -= static_cast<std::size_t>(n);
+                }
+            }
+
+            // The plain way: read, hash, write
+            inline void copy(int const in, int const out, std::uint64_t left, ::md5::details::Context &ctx, Stats &stats)
+            {
+                std::vector<char unsigned> buffer(file::buffer_size);
+                while ( 0u != left )
+                {
+                    std::size_t const n = file::read_some(in, buffer.data(), static_cast<std::size_t>(left < buffer.size() ? left : buffer.size()));
+                    if ( 0u == n ) return;
+                    ctx.append(buffer.data(), n);
+                    write_all(out, buffer.data(), n);
+                    stats.bytes += n;
+                    left -= n;
+                }
+            }
+        }
+
+        // Copies up to 'limit' bytes (or everything until the end) from 'in'
+        // to 'out' and returns their digest
+        inline Digest passthrough(int const in, int const out, std::uint64_t const limit = ~std::uint64_t(0u), Stats *const stats_out = nullptr)
+        {
+            ::md5::details::Context ctx;
+            Stats stats;
+            std::uint64_t left = limit;
+
+#ifdef SPLICE_F_MOVE
+            file::Pipe forward, hashed;
+            std::vector<char unsigned> buffer(file::buffer_size);
+            unsigned const flags = SPLICE_F_MOVE | SPLICE_F_MORE;
+
+            while ( 0u != left )
+            {
+                // 1. in -> forward pipe
+                ssize_t const n = ::splice(in, nullptr, forward.write.get(), nullptr,
+                                           static_cast<std::size_t>(left < buffer.size() ? left : buffer.size()), flags);
+                if ( n < 0 && EINTR == errno ) continue;
+                if ( n < 0 && file::splice_unsupported(errno) ) break;  // 'in' can't be spliced: the rest the plain way
+                if ( n < 0 ) throw std::system_error(errno, std::generic_category(), "splice");
+                if ( 0 == n ) break;
+                left -= static_cast<std::uint64_t>(n);
+
+                // tee() always starts at the front of the pipe, so whatever it
+                // duplicated is hashed and moved on before the next call
+                for ( std::size_t pending = static_cast<std::size_t>(n); 0u != pending; )
+                {
+                    // 2. duplicate the pages into the second pipe and hash them from there
+                    ssize_t const t = ::tee(forward.read.get(), hashed.write.get(), pending, 0u);
+                    if ( t < 0 && EINTR == errno ) continue;
+                    if ( t <= 0 ) throw std::system_error((t < 0) ? errno : EIO, std::generic_category(), "tee");
+                    std::size_t const segment = static_cast<std::size_t>(t);
+                    for ( std::size_t got = 0u; got < segment; )
+                    {
+                        std::size_t const r = file::read_some(hashed.read.get(), buffer.data() + got, segment - got);
+                        if ( 0u == r ) throw std::system_error(EIO, std::generic_category(), "tee");
+                        got += r;
+                    }
+                    ctx.append(buffer.data(), segment);
+
+                    // 3. forward pipe -> out
+                    for ( std::size_t moved = 0u; moved < segment; )
+                    {
+                        ssize_t const m = ::splice(forward.read.get(), nullptr, out, nullptr, segment - moved, flags);
+                        if ( m < 0 && EINTR == errno ) continue;
+                        if ( m < 0 && file::splice_unsupported(errno) && 0u == stats.spliced )
+                        {
+                            // 'out' can't be spliced: write this segment from the copy we
+                            // hashed, drop it from the pipe, then go on the plain way
+                            details::write_all(out, buffer.data() + moved, segment - moved);
+                            for ( std::size_t dropped = 0u; dropped < segment - moved; )
+                            {
+                                dropped += file::read_some(forward.read.get(), buffer.data(), segment - moved - dropped);
+                            }
+                            stats.bytes += segment;
+                            details::copy(forward.read.get(), out, pending - segment, ctx, stats);
+                            details::copy(in, out, left, ctx, stats);
+                            if ( nullptr != stats_out ) *stats_out = stats;
+                            return ctx.final();
+                        }
+                        if ( m <= 0 ) throw std::system_error((m < 0) ? errno : EIO, std::generic_category(), "splice");
+                        moved += static_cast<std::size_t>(m);
+                        stats.spliced += static_cast<std::uint64_t>(m);
+                    }
+                    stats.bytes += segment;
+                    pending -= segment;
+                }
+            }
+#endif
+
+            details::copy(in, out, left, ctx, stats);
+            if ( nullptr != stats_out ) *stats_out = stats;
+            return ctx.final();
+        }
+
+    }  // close namespace 'splice'
+}  // close namespace 'md5'
+
+#endif  // HEADER_INCLUSION_GUARD
@@ -0,0 +1,252 @@
+#ifndef HEADER_INCLUSION_GUARD_13894475020851267389956314601877045829310
+#define HEADER_INCLUSION_GUARD_13894475020851267389956314601877045829310
+
+// One digest for a whole directory tree, for comparing trees across
+// machines (POSIX only).
+//
+// The digest is a Merkle tree over directories. A directory's digest is
+// the MD5 of its entries sorted bytewise by name, each encoded as
+//
+//     type     1 byte: 'f' regular file, 'd' directory, 'l' symbolic link
+//     mode     4 bytes big-endian: permission bits (st_mode & 07777), or
+//              zero if Options::include_mode is false
+//     name     the entry's name followed by one NUL byte
+//     digest   16 bytes: the file's contents, the directory's digest, or
+//              the MD5 of the link's target
+//
+// and the tree digest is the digest of the root directory. It depends only
+// on names, modes and contents, never on the order readdir returns entries
+// in or on how many threads hash the files. Symbolic links are not
+// followed; other file types (devices, sockets, FIFOs) are left out.
+//
+// TreeDigest keeps the tree in memory, so after a change 'update' hashes
+// only the changed file or subtree again and then the directories above it.
+
+#include <cerrno>        // errno
+#include <cstring>       // strcmp
+#include <map>           // map
+#include <memory>        // unique_ptr
+#include <stdexcept>     // out_of_range
+#include <string>        // string
+#include <system_error>  // system_error
+#include <thread>        // hardware_concurrency
+#include <utility>       // move
+#include <vector>        // vector
+#include <dirent.h>      // opendir, readdir
+#include <fcntl.h>       // open
+#include <sys/stat.h>    // lstat
+#include <unistd.h>      // readlink
+#include "md5_file.hpp"
+#include "md5_file_cache.hpp"
+#include "md5_util.hpp"
+
+namespace md5 {
+    namespace tree {
+
+        struct Options {
+            unsigned threads = std::thread::hardware_concurrency();
+            bool include_mode = true;
+            file::DigestCache *cache = nullptr;  // used for hashing files if given
+        };
+
+        class TreeDigest {
+        public:
+
+            // Scans and hashes the tree under 'root'. Throws std::system_error
+            // if 'root' isn't a readable directory.
+            explicit TreeDigest(std::string root, Options const &options = Options())
+                : root_(std::move(root)), options_(options)
+            {
+                struct stat st;
+                if ( 0 != ::lstat(root_.c_str(), &st) ) throw std::system_error(errno, std::generic_category(), root_);
+                if ( !S_ISDIR(st.st_mode) ) throw std::system_error(ENOTDIR, std::generic_category(), root_);
+                top_ = scan(std::string(), st);
+            }
+
+            Digest digest(void) const noexcept { return top_->digest; }
+
+            // The digest of the file, link or subtree at 'rel' (relative to
+            // the root). Throws std::out_of_range if there's no such entry.
+            Digest digest(std::string const &rel) const
+            {
+                Node const *node = top_.get();
+                for ( std::string const &name : split(rel) )
+                {
+                    auto const it = node->children.find(name);
+                    if ( node->children.end() == it ) throw std::out_of_range(rel);
+                    node = it->second.get();
+                }
+                return node->digest;
+            }
+
+            // Reads 'rel' from disk again, whether it was changed, added or
+            // removed, and recomputes the directories above it
+            void update(std::string const &rel)
+            {
+                std::vector<std::string> const names = split(rel);
+                std::vector<Node *> path(1u, top_.get());  // the directories from the root down to the parent
+                std::string prefix;
+                std::size_t depth = 0u;
+                for ( ; depth + 1u < names.size(); ++depth )
+                {
+                    auto const it = path.back()->children.find(names[depth]);
+                    if ( path.back()->children.end() == it || 'd' != it->second->type ) break;  // a new directory: scan all of it
+                    path.push_back(it->second.get());
+                    prefix = join(prefix, names[depth]);
+                }
+
+                if ( names.empty() )
+                {
+                    struct stat st;
+                    if ( 0 != ::lstat(root_.c_str(), &st) ) throw std::system_error(errno, std::generic_category(), root_);
+                    top_ = scan(std::string(), st);
+                    return;
+                }
+
+                std::string const name = names[depth];
+                std::string const changed = join(prefix, name);
+                struct stat st;
+                std::unique_ptr<Node> node;
+                if ( 0 == ::lstat(full(changed).c_str(), &st) ) node = scan(changed, st);
+                if ( node ) path.back()->children[name] = std::move(node);
+                else path.back()->children.erase(name);
+
+                for ( std::size_t i = path.size(); 0u != i--; ) combine(*path[i]);
+            }
+
+        private:
+
+            struct Node {
+                char type;  // 'f', 'd' or 'l'
+                std::uint32_t mode;
+                Digest digest;
+                std::map<std::string, std::unique_ptr<Node>> children;  // sorted bytewise, as std::string compares
+            };
+
+            std::string root_;
+            Options options_;
+            std::unique_ptr<Node> top_;
+
+            static std::string join(std::string const &dir, std::string const &name)
+            {
+                return dir.empty() ? name : dir + '/' + name;
+            }
+
+            std::string full(std::string const &rel) const
+            {
+                return rel.empty() ? root_ : root_ + '/' + rel;
+            }
+
+            static std::vector<std::string> split(std::string const &rel)
+            {
+                std::vector<std::string> names;
+                for ( std::size_t begin = 0u; begin < rel.size(); )
+                {
+                    std::size_t end = rel.find('/', begin);
+                    if ( std::string::npos == end ) end = rel.size();
+                    if ( end > begin && rel.compare(begin, end - begin, ".") ) names.push_back(rel.substr(begin, end - begin));
+                    begin = end + 1u;
+                }
+                return names;
+            }
+
+            // Builds the subtree at 'rel', hashes its files in parallel, then
+            // combines its directories. Returns nullptr for types left out.
+            std::unique_ptr<Node> scan(std::string const &rel, struct stat const &st)
+            {
+                std::vector<std::pair<Node *, std::string>> files;
+                std::vector<Node *> dirs;  // parents before children
+                std::unique_ptr<Node> node = build(rel, st, files, dirs);
+
+                std::vector<int> errors(files.size(), 0);
+                util::parallel_for(files.size(), options_.threads, [&](std::size_t const i) {
+                    try
+                    {
+                        file::Fd const fd(::open(full(files[i].second).c_str(), O_RDONLY | O_CLOEXEC | O_NOFOLLOW));
+                        if ( -1 == fd.get() ) throw std::system_error(errno, std::generic_category(), full(files[i].second));
+                        files[i].first->digest = (nullptr != options_.cache) ? options_.cache->compute(fd.get()) : file::compute(fd.get());
+                    }
+                    catch ( std::system_error const &e )
+                    {
+                        errors[i] = e.code().value();
+                    }
+                });
+                for ( std::size_t i = 0u; i < files.size(); ++i )
+                {
+                    // A tree that can't be read completely has no meaningful digest
+                    if ( 0 != errors[i] ) throw std::system_error(errors[i], std::generic_category(), full(files[i].second));
+                }
+
+                for ( std::size_t i = dirs.size(); 0u != i--; ) combine(*dirs[i]);
+                return node;
+            }
+
+            std::unique_ptr<Node> build(std::string const &rel, struct stat const &st,
+                                        std::vector<std::pair<Node *, std::string>> &files, std::vector<Node *> &dirs)
+            {
+                std::unique_ptr<Node> node(new Node{ '\0', options_.include_mode ? static_cast<std::uint32_t>(st.st_mode & 07777) : 0u, Digest{}, {} });
+                if ( S_ISREG(st.st_mode) )
+                {
+                    node->type = 'f';
+                    files.emplace_back(node.get(), rel);
+                }
+                else if ( S_ISLNK(st.st_mode) )
+                {
+                    node->type = 'l';
+                    char target[4096];
+                    ssize_t const n = ::readlink(full(rel).c_str(), target, sizeof target);
+                    if ( n < 0 ) throw std::system_error(errno, std::generic_category(), full(rel));
+                    node->digest = ::md5::compute(target, static_cast<std::size_t>(n));
+                }
+                else if ( S_ISDIR(st.st_mode) )
+                {
+                    node->type = 'd';
+                    dirs.push_back(node.get());
+                    DIR *const d = ::opendir(full(rel).c_str());
+                    if ( nullptr == d ) throw std::system_error(errno, std::generic_category(), full(rel));
+                    while ( dirent const *const e = ::readdir(d) )
+                    {
+                        if ( 0 == std::strcmp(e->d_name, ".") || 0 == std::strcmp(e->d_name, "..") ) continue;
+                        std::string const path = join(rel, e->d_name);
+                        struct stat child;
+                        if ( 0 != ::lstat(full(path).c_str(), &child) ) continue;  // removed meanwhile
+                        std::unique_ptr<Node> c = build(path, child, files, dirs);
+                        if ( c ) node->children.emplace(e->d_name, std::move(c));
+                    }
+                    ::closedir(d);
+                }
+                else
+                {
+                    node.reset();
+                }
+                return node;
+            }
+
+            static void combine(Node &dir)
+            {
+                details::Context ctx;
+                for ( auto const &child : dir.children )
+                {
+                    Node const &c = *child.second;
+                    char unsigned const header[5] = {
+                        static_cast<char unsigned>(c.type),
+                        static_cast<char unsigned>(c.mode >> 24u), static_cast<char unsigned>(c.mode >> 16u),
+                        static_cast<char unsigned>(c.mode >>  8u), static_cast<char unsigned>(c.mode),
+                    };
+                    ctx.append(header, sizeof header);
+                    ctx.append(reinterpret_cast<char unsigned const *>(child.first.c_str()), child.first.size() + 1u);
+                    ctx.append(c.digest.b, Digest::count);
+                }
+                dir.digest = ctx.final();
+            }
+        };
+
+        inline Digest tree_digest(std::string const &root, Options const &options = Options())
+        {
+            return TreeDigest(root, options).digest();
+        }
+
+    }  // close namespace 'tree'
+}  // close namespace 'md5'
+
+#endif  // HEADER_INCLUSION_GUARD
@@ -0,0 +1,307 @@
+#ifndef HEADER_INCLUSION_GUARD_70318854296157202609813317784025530491123
+#define HEADER_INCLUSION_GUARD_70318854296157202609813317784025530491123
+
+// Keeps the digests of every regular file under a directory up to date
+// as the files change, without rescanning the tree (Linux only).
+//
+// The tree is hashed once when the watcher is made. After that, inotify
+// events mark single files as pending, and 'poll' re-hashes a file once it
+// has been quiet for 'debounce' (or has kept changing for 'max_delay'), so
+// a file written in many small pieces is read once, not once per write.
+// Events for a file that is already pending are merged into one.
+//
+// The manifest maps paths relative to the root to digests, and is read
+// without touching the disk. If the kernel's event queue overflows, every
+// file is re-hashed. Symbolic links are not followed.
+//
+// inotify is used rather than fanotify because it needs no privileges; its
+// cost is one watch per directory (see /proc/sys/fs/inotify/max_user_watches).
+
+#ifdef __linux__
+
+#include <atomic>        // atomic
+#include <cerrno>        // errno
+#include <chrono>        // steady_clock, milliseconds
+#include <cstring>       // strcmp, memcpy
+#include <functional>    // function
+#include <map>           // map
+#include <mutex>         // mutex, lock_guard
+#include <string>        // string
+#include <system_error>  // system_error
+#include <thread>        // hardware_concurrency
+#include <utility>       // move
+#include <vector>        // vector
+#include <dirent.h>      // opendir, readdir
+#include <fcntl.h>       // open
+#include <poll.h>        // poll
+#include <sys/inotify.h> // inotify_init1, inotify_add_watch
+#include <sys/stat.h>    // lstat
+#include <unistd.h>      // read
+#include "md5_file.hpp"
+#include "md5_file_cache.hpp"
+#include "md5_util.hpp"
+
+namespace md5 {
+    namespace watch {
+
+        struct Options {
+            unsigned threads = std::thread::hardware_concurrency();
+            std::chrono::milliseconds debounce{ 200 };    // quiet time before a file is re-hashed
+            std::chrono::milliseconds max_delay{ 5000 };  // longest a file that keeps changing waits
+            file::DigestCache *cache = nullptr;           // used for hashing if given
+        };
+
+        class TreeWatcher {
+        public:
+
+            // Called for every file whose digest changed, with nullptr once
+            // the file is gone
+            using Callback = std::function<void(std::string const &path, Digest const *digest)>;
+
+            explicit TreeWatcher(std::string root, Options const &options = Options())
+                : root_(std::move(root)), options_(options), fd_(::inotify_init1(IN_NONBLOCK | IN_CLOEXEC))
+            {
+                if ( -1 == fd_.get() ) throw std::system_error(errno, std::generic_category(), "inotify_init1");
+                add_tree(std::string());
+                rehash(Clock::time_point::max(), Callback());  // everything found is due now
+            }
+
+            TreeWatcher(TreeWatcher const &) = delete;
+            TreeWatcher &operator=(TreeWatcher const &) = delete;
+
+            bool lookup(std::string const &path, Digest &d) const
+            {
+                std::lock_guard<std::mutex> const lock(mutex_);
+                auto const it = manifest_.find(path);
+                if ( manifest_.end() == it ) return false;
+                d = it->second;
+                return true;
+            }
+
+            std::map<std::string, Digest> manifest(void) const
+            {
+                std::lock_guard<std::mutex> const lock(mutex_);
+                return manifest_;
+            }
+
+            std::size_t pending(void) const noexcept { return pending_.size(); }
+
+            // Waits up to 'timeout' for events, then re-hashes the files that
+            // are due. Not thread-safe: call it from one thread only.
+            void poll(std::chrono::milliseconds timeout, Callback const &on_change = Callback())
+            {
+                // Don't sleep past the moment the next pending file is due
+                Clock::time_point const now = Clock::now();
+                for ( auto const &p : pending_ )
+                {
+                    auto const left = std::chrono::duration_cast<std::chrono::milliseconds>(due(p.second) - now);
+                    if ( left < timeout ) timeout = (left.count() < 0) ? std::chrono::milliseconds(0) : left;
+                }
+
+                pollfd pfd = { fd_.get(), POLLIN, 0 };
+                int const n = ::poll(&pfd, 1u, static_cast<int>(timeout.count()));
+                if ( n < 0 && EINTR != errno ) throw std::system_error(errno, std::generic_category(), "poll");
+                if ( n > 0 ) read_events();
+                rehash(Clock::now(), on_change);
+            }
+
+            // Calls 'poll' until 'stop' becomes true
+            void run(std::atomic<bool> const &stop, Callback const &on_change = Callback())
+            {
+                while ( !stop.load() ) poll(std::chrono::milliseconds(100), on_change);
+            }
+
+        private:
+
+            using Clock = std::chrono::steady_clock;
+
+            struct Pending {
+                Clock::time_point first, last;  // first and latest event since the last hash
+            };
+
+            static constexpr std::uint32_t dir_mask = IN_CLOSE_WRITE | IN_MODIFY | IN_CREATE | IN_DELETE
+                                                    | IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB | IN_ONLYDIR | IN_DONT_FOLLOW;
+
+            std::string root_;
+            Options options_;
+            file::Fd fd_;
+            std::map<int, std::string> dirs_;  // watch descriptor to directory path, relative to the root
+            std::map<std::string, Pending> pending_;
+            mutable std::mutex mutex_;
+            std::map<std::string, Digest> manifest_;
+
+            std::string full(std::string const &rel) const
+            {
+                return rel.empty() ? root_ : root_ + '/' + rel;
+            }
+
+            static std::string join(std::string const &dir, char const *const name)
+            {
+                return dir.empty() ? std::string(name) : dir + '/' + name;
+            }
+
+            Clock::time_point due(Pending const &p) const noexcept
+            {
+                Clock::time_point const quiet = p.last + options_.debounce, limit = p.first + options_.max_delay;
+                return (quiet < limit) ? quiet : limit;
+            }
+
+            void schedule(std::string const &rel)
+            {
+                Clock::time_point const now = Clock::now();
+                auto const it = pending_.find(rel);
+                if ( pending_.end() == it ) pending_.emplace(rel, Pending{ now, now });
+                else it->second.last = now;
+            }
+
+            // Watches 'rel' and every directory below it, and schedules every
+            // file found
+            void add_tree(std::string const &rel)
+            {
+                int const wd = ::inotify_add_watch(fd_.get(), full(rel).c_str(), dir_mask);
+                if ( -1 == wd ) return;  // e.g. removed again already
+                dirs_[wd] = rel;
+
+                DIR *const d = ::opendir(full(rel).c_str());
+                if ( nullptr == d ) return;
+                while ( dirent const *const e = ::readdir(d) )
+                {
+                    if ( 0 == std::strcmp(e->d_name, ".") || 0 == std::strcmp(e->d_name, "..") ) continue;
+                    std::string const path = join(rel, e->d_name);
+                    struct stat st;
+                    if ( 0 != ::lstat(full(path).c_str(), &st) ) continue;
+                    if ( S_ISDIR(st.st_mode) ) add_tree(path);
+                    else if ( S_ISREG(st.st_mode) ) schedule(path);
+                }
+                ::closedir(d);
+            }
+
+            // Stops watching 'rel' and what's below it, and schedules its files
+            // so that they are dropped from the manifest
+            void remove_tree(std::string const &rel)
+            {
+                std::string const prefix = rel + '/';
+                for ( auto it = dirs_.begin(); it != dirs_.end(); )
+                {
+                    if ( it->second == rel || 0 == it->second.compare(0u, prefix.size(), prefix) )
+                    {
+                        ::inotify_rm_watch(fd_.get(), it->first);
+                        it = dirs_.erase(it);
+                    }
+                    else ++it;
+                }
+                std::lock_guard<std::mutex> const lock(mutex_);
+                for ( auto it = manifest_.lower_bound(prefix); it != manifest_.end() && 0 == it->first.compare(0u, prefix.size(), prefix); ++it )
+                {
+                    schedule(it->first);
+                }
+            }
+
+            void rescan(void)
+            {
+                for ( auto const &d : dirs_ ) ::inotify_rm_watch(fd_.get(), d.first);
+                dirs_.clear();
+                {
+                    std::lock_guard<std::mutex> const lock(mutex_);
+                    for ( auto const &m : manifest_ ) schedule(m.first);
+                }
+                add_tree(std::string());
+            }
+
+            void read_events(void)
+            {
+                alignas(inotify_event) char buffer[64u * 1024u];
+                for ( ;; )
+                {
+                    ssize_t const n = ::read(fd_.get(), buffer, sizeof buffer);
+                    if ( n <= 0 )
+                    {
+                        if ( n < 0 && EINTR == errno ) continue;
+                        if ( n < 0 && EAGAIN != errno ) throw std::system_error(errno, std::generic_category(), "inotify");
+                        return;
+                    }
+                    for ( char const *p = buffer; p < buffer + n; )
+                    {
+                        inotify_event e;
+                        std::memcpy(&e, p, sizeof e);
+                        char const *const name = p + sizeof e;
+                        p += sizeof e + e.len;
+
+                        if ( e.mask & IN_Q_OVERFLOW ) { rescan(); continue; }
+                        if ( e.mask & IN_IGNORED ) { dirs_.erase(e.wd); continue; }
+                        auto const dir = dirs_.find(e.wd);
+                        if ( dirs_.end() == dir || 0u == e.len ) continue;  // events on the directory itself
+                        std::string const path = join(dir->second, name);
+
+                        if ( e.mask & IN_ISDIR )
+                        {
+                            if ( e.mask & (IN_CREATE | IN_MOVED_TO) ) add_tree(path);
+                            else if ( e.mask & (IN_DELETE | IN_MOVED_FROM) ) remove_tree(path);
+                        }
+                        else schedule(path);
+                    }
+                }
+            }
+
+            // Hashes every pending file due by 'now' and updates the manifest
+            void rehash(Clock::time_point const now, Callback const &on_change)
+            {
+                struct Job {
+                    std::string path;
+                    Digest digest;
+                    bool present;
+                };
+                std::vector<Job> jobs;
+                for ( auto it = pending_.begin(); it != pending_.end(); )
+                {
+                    if ( due(it->second) > now ) { ++it; continue; }
+                    jobs.push_back(Job{ it->first, Digest{}, false });
+                    it = pending_.erase(it);
+                }
+
+                util::parallel_for(jobs.size(), options_.threads, [this, &jobs](std::size_t const i) {
+                    Job &job = jobs[i];
+                    try
+                    {
+                        file::Fd const fd(::open(full(job.path).c_str(), O_RDONLY | O_CLOEXEC | O_NOFOLLOW));
+                        struct stat st;
+                        if ( -1 == fd.get() || 0 != ::fstat(fd.get(), &st) || !S_ISREG(st.st_mode) ) return;
+                        job.digest = (nullptr != options_.cache) ? options_.cache->compute(fd.get()) : file::compute(fd.get());
+                        job.present = true;
+                    }
+                    catch ( std::system_error const & )
+                    {
+                        // Unreadable files are left out of the manifest
+                    }
+                });
+
+                std::vector<Job const *> changed;
+                {
+                    std::lock_guard<std::mutex> const lock(mutex_);
+                    for ( Job const &job : jobs )
+                    {
+                        auto const it = manifest_.find(job.path);
+                        if ( !job.present )
+                        {
+                            if ( manifest_.end() == it ) continue;
+                            manifest_.erase(it);
+                        }
+                        else if ( manifest_.end() == it ) manifest_.emplace(job.path, job.digest);
+                        else if ( 0 != std::memcmp(it->second.b, job.digest.b, Digest::count) ) it->second = job.digest;
+                        else continue;
+                        changed.push_back(&job);
+                    }
+                }
+                if ( on_change )
+                {
+                    for ( Job const *const job : changed ) on_change(job->path, job->present ? &job->digest : nullptr);
+                }
+            }
+        };
+
+    }  // close namespace 'watch'
+}  // close namespace 'md5'
+
+#endif  // __linux__
+
+#endif  // HEADER_INCLUSION_GUARD
@@ -0,0 +1,90 @@
+#ifndef HEADER_INCLUSION_GUARD_02721417120345638172471689887210262205699
+#define HEADER_INCLUSION_GUARD_02721417120345638172471689887210262205699
+
+// Small helpers shared by the modules and tools: digests as hexadecimal
+// text, little-endian integers in file formats, and a parallel loop.
+// Helpers that do I/O live in md5_file.hpp.
+
+#include <atomic>     // atomic
+#include <cstdint>    // uint64_t
+#include <exception>  // exception_ptr, current_exception, rethrow_exception
+#include <mutex>      // mutex, lock_guard
+#include <string>     // string
+#include <thread>     // thread
+#include <vector>     // vector
+#include "md5.hpp"
+
+namespace md5 {
+    namespace util {
+
+        // 32 lowercase hexadecimal digits
+        inline std::string hex(Digest const &d)
+        {
+            static char const digits[] = "0123456789abcdef";
+            std::string s(2u * Digest::count, '0');
+            for ( unsigned i = 0u; i < Digest::count; ++i )
+            {
+                s[2u * i] = digits[d.b[i] >> 4u];
+                s[2u * i + 1u] = digits[d.b[i] & 0xfu];
+            }
+            return s;
+        }
+
+        // Parses exactly 32 lowercase hexadecimal digits
+        inline bool from_hex(char const *const s, Digest &d) noexcept
+        {
+            for ( unsigned i = 0u; i < 2u * Digest::count; ++i )
+            {
+                char const c = s[i];
+                unsigned const v = ('0' <= c && c <= '9') ? unsigned(c - '0') : ('a' <= c && c <= 'f') ? unsigned(c - 'a' + 10) : 16u;
+                if ( 16u == v ) return false;
+                d.b[i / 2u] = static_cast<char unsigned>((0u == i % 2u) ? (v << 4u) : (d.b[i / 2u] | v));
+            }
+            return '\0' == s[2u * Digest::count];
+        }
+
+        inline std::uint64_t load_le64(char unsigned const *const p) noexcept
+        {
+            std::uint64_t n = 0u;
+            for ( unsigned i = 8u; 0u != i--; ) n = (n << 8u) | p[i];
+            return n;
+        }
+
+        inline void store_le64(char unsigned *const p, std::uint64_t n) noexcept
+        {
+            for ( unsigned i = 0u; i < 8u; ++i, n >>= 8u ) p[i] = static_cast<char unsigned>(n);
+        }
+
+        // Calls fn(i) for every i in [0, n) on up to 'threads' threads. If a
+        // call throws, no new ones start, and the first exception is thrown
+        // again once the others have returned.
+        template <typename Fn>
+        void parallel_for(std::size_t const n, unsigned threads, Fn const &fn)
+        {
+            if ( 0u == threads ) threads = 1u;
+            std::atomic<std::size_t> next{ 0u };
+            std::mutex mutex;
+            std::exception_ptr error;
+            auto const worker = [&]() {
+                try
+                {
+                    for ( std::size_t i; (i = next.fetch_add(1u)) < n; ) fn(i);
+                }
+                catch ( ... )
+                {
+                    next.store(n);
+                    std::lock_guard<std::mutex> const lock(mutex);
+                    if ( !error ) error = std::current_exception();
+                }
+            };
+            std::vector<std::thread> pool;
+            for ( unsigned t = 1u; t < threads && t < n; ++t ) pool.emplace_back(worker);
+            worker();
+            for ( std::thread &t : pool ) t.join();
+            if ( error ) std::rethrow_exception(error);
+        }
+
+    }  // close namespace 'util'
+}  // close namespace 'md5'
+
+#endif  // HEADER_INCLUSION_GUARD
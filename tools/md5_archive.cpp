@@ -0,0 +1,46 @@
+// Prints the MD5 of every file in a tar or zip archive without
+// extracting it, see md5_archive.hpp
+//
+// Build:
+//     g++ -std=c++14 -O2 -I. -o md5_archive tools/md5_archive.cpp
+//     g++ -std=c++14 -O2 -I. -DMD5_ENABLE_ZLIB -o md5_archive tools/md5_archive.cpp -lz   (deflated zip members)
+//
+// Usage:
+//     md5_archive [ARCHIVE]      reads standard input without ARCHIVE
+//
+// Prints md5sum output with the member names, so it can be compared to
+// the output of md5sum over the extracted files. Members that can't be
+// hashed are listed on stderr as "<name>: SKIPPED (reason)", and make the
+// exit status 1.
+
+#include <cstdio>      // printf, fprintf
+#include <exception>   // exception
+#include <fcntl.h>     // open
+#include "md5_archive.hpp"
+#include "md5_util.hpp"
+
+int main(int const argc, char **const argv)
+{
+    if ( argc > 2 )
+    {
+        std::fprintf(stderr, "usage: %s [ARCHIVE]\n", argv[0]);
+        return 2;
+    }
+
+    try
+    {
+        md5::file::Fd fd;
+        if ( 2 == argc ) fd = md5::file::open_read(argv[1]);
+        bool skipped = false;
+        md5::archive::hash_archive((2 == argc) ? fd.get() : STDIN_FILENO, [&](md5::archive::Member const &m) {
+            if ( m.hashed ) std::printf("%s  %s\n", md5::util::hex(m.digest).c_str(), m.name.c_str());
+            else std::fprintf(stderr, "%s: SKIPPED (%s)\n", m.name.c_str(), m.note.c_str()), skipped = true;
+        });
+        return skipped ? 1 : 0;
+    }
+    catch ( std::exception const &e )
+    {
+        std::fprintf(stderr, "md5_archive: %s\n", e.what());
+        return 1;
+    }
+}
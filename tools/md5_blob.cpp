@@ -0,0 +1,72 @@
+// Puts files into and gets them out of the object store of md5_blob_store.hpp
+//
+// Build:
+//     g++ -std=c++14 -O2 -pthread -I. -o md5_blob tools/md5_blob.cpp
+//
+// Usage:
+//     md5_blob STORE put [FILE...]     stores each FILE (or stdin) and prints its digest
+//     md5_blob STORE get DIGEST        writes the object to stdout
+//     md5_blob STORE repack [THREADS]  moves loose objects into a pack
+//
+// 'get' exits with status 1 if the object isn't stored.
+
+#include <cstdio>      // printf, fprintf, fwrite
+#include <cstdlib>     // strtoul
+#include <cstring>     // strcmp
+#include <exception>   // exception
+#include <vector>      // vector
+#include "md5_blob_store.hpp"
+#include "md5_util.hpp"
+
+int main(int const argc, char **const argv)
+{
+    if ( argc < 3 )
+    {
+        std::fprintf(stderr, "usage: %s STORE put [FILE...] | get DIGEST | repack [THREADS]\n", argv[0]);
+        return 2;
+    }
+
+    try
+    {
+        md5::blob::Store store(argv[1]);
+
+        if ( 0 == std::strcmp(argv[2], "put") )
+        {
+            if ( 3 == argc ) std::printf("%s  -\n", md5::util::hex(store.put_fd(0)).c_str());
+            for ( int i = 3; i < argc; ++i )
+            {
+                md5::file::Fd const fd = md5::file::open_read(argv[i]);
+                std::printf("%s  %s\n", md5::util::hex(store.put_fd(fd.get())).c_str(), argv[i]);
+            }
+            return 0;
+        }
+
+        if ( 0 == std::strcmp(argv[2], "get") && 4 == argc )
+        {
+            md5::Digest d;
+            if ( !md5::util::from_hex(argv[3], d) )
+            {
+                std::fprintf(stderr, "md5_blob: not a digest: %s\n", argv[3]);
+                return 2;
+            }
+            std::vector<char unsigned> data;
+            if ( !store.get(d, data) ) return 1;
+            return (data.size() == std::fwrite(data.data(), 1u, data.size(), stdout)) ? 0 : 1;
+        }
+
+        if ( 0 == std::strcmp(argv[2], "repack") )
+        {
+            unsigned const threads = (4 == argc) ? static_cast<unsigned>(std::strtoul(argv[3], nullptr, 10)) : std::thread::hardware_concurrency();
+            std::printf("%llu objects packed\n", static_cast<unsigned long long>(store.repack(threads)));
+            return 0;
+        }
+    }
+    catch ( std::exception const &e )
+    {
+        std::fprintf(stderr, "md5_blob: %s\n", e.what());
+        return 1;
+    }
+
+    std::fprintf(stderr, "usage: %s STORE put [FILE...] | get DIGEST | repack [THREADS]\n", argv[0]);
+    return 2;
+}
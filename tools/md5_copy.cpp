@@ -0,0 +1,82 @@
+// Copies files and directories and verifies the copies, see md5_copy.hpp
+//
+// Build:
+//     g++ -std=c++14 -O2 -pthread -I. -o md5_copy tools/md5_copy.cpp
+//
+// Usage:
+//     md5_copy [--threads N] [--block BYTES] [--no-verify] [--buffered] [--manifest FILE] SRC... DEST
+//
+// Like cp -r: with several sources DEST must be a directory. Prints
+// "<path>: FAILED" for copies that don't match their source and
+// "<path>: ERROR (...)" for files that couldn't be copied, and a summary
+// on stderr. The manifest lists the digests of the copies in md5sum
+// format. Exits with status 1 if anything failed.
+
+#include <cstdio>      // printf, fprintf
+#include <cstdlib>     // strtoul, strtoull
+#include <cstring>     // strcmp
+#include <exception>   // exception
+#include "md5_copy.hpp"
+
+int main(int const argc, char **const argv)
+{
+    md5::copy::Options options;
+    char const *manifest = nullptr;
+    std::vector<std::string> paths;
+
+    for ( int i = 1; i < argc; ++i )
+    {
+        bool const has_value = (i + 1) < argc;
+        if      ( 0 == std::strcmp(argv[i], "--threads" ) && has_value ) options.threads = static_cast<unsigned>(std::strtoul(argv[++i], nullptr, 10));
+        else if ( 0 == std::strcmp(argv[i], "--block"   ) && has_value ) options.block_size = static_cast<std::size_t>(std::strtoull(argv[++i], nullptr, 10));
+        else if ( 0 == std::strcmp(argv[i], "--manifest") && has_value ) manifest = argv[++i];
+        else if ( 0 == std::strcmp(argv[i], "--no-verify") ) options.verify = false;
+        else if ( 0 == std::strcmp(argv[i], "--buffered" ) ) options.direct = false;
+        else if ( '-' != argv[i][0] ) paths.push_back(argv[i]);
+        else paths.clear(), i = argc;
+    }
+    if ( paths.size() < 2u )
+    {
+        std::fprintf(stderr, "usage: %s [--threads N] [--block BYTES] [--no-verify] [--buffered] [--manifest FILE] SRC... DEST\n", argv[0]);
+        return 2;
+    }
+
+    try
+    {
+        std::string const destination = paths.back();
+        paths.pop_back();
+        struct stat st;
+        if ( paths.size() > 1u && !(0 == ::stat(destination.c_str(), &st) && S_ISDIR(st.st_mode)) )
+        {
+            std::fprintf(stderr, "md5_copy: %s is not a directory\n", destination.c_str());
+            return 2;
+        }
+
+        std::vector<md5::copy::Job> jobs;
+        std::vector<std::string> skipped;
+        for ( std::string const &source : paths )
+        {
+            std::vector<md5::copy::Job> const more = md5::copy::plan(source, destination, &skipped);
+            jobs.insert(jobs.end(), more.begin(), more.end());
+        }
+        for ( std::string const &path : skipped ) std::fprintf(stderr, "md5_copy: skipped %s (not a regular file)\n", path.c_str());
+
+        std::uint64_t bytes = 0u, failed = 0u;
+        std::vector<md5::copy::Result> const results = md5::copy::copy_files(jobs, options, [&](md5::copy::Result const &r) {
+            bytes += r.bytes;
+            if ( md5::copy::Status::mismatch == r.status ) std::printf("%s: FAILED\n", r.job.destination.c_str());
+            if ( md5::copy::Status::error == r.status ) std::printf("%s: ERROR (%s)\n", r.job.source.c_str(), r.message.c_str());
+            if ( md5::copy::Status::ok != r.status ) ++failed;
+        });
+        if ( nullptr != manifest ) md5::copy::save_manifest(results, manifest);
+
+        std::fprintf(stderr, "%llu files, %llu bytes, %llu failed\n", static_cast<unsigned long long>(results.size()),
+                     static_cast<unsigned long long>(bytes), static_cast<unsigned long long>(failed));
+        return (0u != failed || !skipped.empty()) ? 1 : 0;
+    }
+    catch ( std::exception const &e )
+    {
+        std::fprintf(stderr, "md5_copy: %s\n", e.what());
+        return 1;
+    }
+}
@@ -0,0 +1,55 @@
+// Prints the MD5 of the uncompressed contents of gzip and zstd files,
+// see md5_decompress.hpp
+//
+// Build:
+//     g++ -std=c++14 -O2 -pthread -I. -DMD5_ENABLE_ZLIB -DMD5_ENABLE_ZSTD -o md5_decompress tools/md5_decompress.cpp -lz -lzstd
+//
+// Usage:
+//     md5_decompress [--threads N] [FILE...]     reads standard input without FILE
+//
+// Prints md5sum output, so "md5_decompress app.log.gz" matches
+// "zcat app.log.gz | md5sum" apart from the name. Files that aren't
+// compressed are hashed as they are.
+
+#include <cstdio>      // printf, fprintf
+#include <cstdlib>     // strtoul
+#include <cstring>     // strcmp
+#include <exception>   // exception
+#include <vector>      // vector
+#include "md5_decompress.hpp"
+#include "md5_util.hpp"
+
+int main(int const argc, char **const argv)
+{
+    md5::decompress::Options options;
+    std::vector<char const *> paths;
+
+    for ( int i = 1; i < argc; ++i )
+    {
+        bool const has_value = (i + 1) < argc;
+        if      ( 0 == std::strcmp(argv[i], "--threads") && has_value ) options.threads = static_cast<unsigned>(std::strtoul(argv[++i], nullptr, 10));
+        else if ( '-' != argv[i][0] ) paths.push_back(argv[i]);
+        else
+        {
+            std::fprintf(stderr, "usage: %s [--threads N] [FILE...]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    int status = 0;
+    if ( paths.empty() ) paths.push_back(nullptr);
+    for ( char const *const path : paths )
+    {
+        try
+        {
+            md5::Digest const d = (nullptr == path) ? md5::decompress::hash(STDIN_FILENO, options) : md5::decompress::hash(path, options);
+            std::printf("%s  %s\n", md5::util::hex(d).c_str(), (nullptr == path) ? "-" : path);
+        }
+        catch ( std::exception const &e )
+        {
+            std::fprintf(stderr, "md5_decompress: %s: %s\n", (nullptr == path) ? "-" : path, e.what());
+            status = 1;
+        }
+    }
+    return status;
+}
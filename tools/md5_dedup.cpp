@@ -0,0 +1,77 @@
+// Lists (and optionally reclaims) duplicate files, see md5_dedup.hpp
+//
+// Build:
+//     g++ -std=c++14 -O2 -pthread -I. -o md5_dedup tools/md5_dedup.cpp
+//
+// Usage:
+//     md5_dedup [--threads N] [--edge BYTES] [--empty] [--hardlink | --dedupe] DIR...
+//
+// Every group of identical files is printed as one line per file, with a
+// blank line between groups. A summary of the I/O done goes to stderr,
+// as do files that reclaiming had to leave alone.
+
+#include <cstdio>      // printf, fprintf
+#include <cstdlib>     // strtoul, strtoull
+#include <cstring>     // strcmp
+#include <exception>   // exception
+#include "md5_dedup.hpp"
+
+namespace {
+
+    int usage(char const *const name)
+    {
+        std::fprintf(stderr, "usage: %s [--threads N] [--edge BYTES] [--empty] [--hardlink | --dedupe] DIR...\n", name);
+        return 2;
+    }
+}
+
+int main(int const argc, char **const argv)
+{
+    md5::dedup::Options options;
+    bool reclaim = false;
+    md5::dedup::Reclaim how = md5::dedup::Reclaim::hardlink;
+    std::vector<std::string> roots;
+
+    for ( int i = 1; i < argc; ++i )
+    {
+        bool const has_value = (i + 1) < argc;
+        if      ( 0 == std::strcmp(argv[i], "--threads") && has_value ) options.threads = static_cast<unsigned>(std::strtoul(argv[++i], nullptr, 10));
+        else if ( 0 == std::strcmp(argv[i], "--edge"   ) && has_value ) options.edge = std::strtoull(argv[++i], nullptr, 10);
+        else if ( 0 == std::strcmp(argv[i], "--empty"   ) ) options.include_empty = true;
+        else if ( 0 == std::strcmp(argv[i], "--hardlink") ) { reclaim = true; how = md5::dedup::Reclaim::hardlink; }
+        else if ( 0 == std::strcmp(argv[i], "--dedupe"  ) ) { reclaim = true; how = md5::dedup::Reclaim::dedupe_range; }
+        else if ( '-' != argv[i][0] ) roots.push_back(argv[i]);
+        else return usage(argv[0]);
+    }
+    if ( roots.empty() || 0u == options.edge ) return usage(argv[0]);
+
+    md5::dedup::Stats stats;
+    auto const groups = md5::dedup::find_duplicates(roots, options, &stats);
+
+    int status = 0;
+    for ( auto const &group : groups )
+    {
+        for ( md5::dedup::File const &f : group ) std::printf("%s\n", f.path.c_str());
+        std::printf("\n");
+        if ( !reclaim ) continue;
+        try
+        {
+            for ( md5::dedup::Reclaimed const &r : md5::dedup::reclaim(group, how) )
+            {
+                if ( md5::dedup::Outcome::other_filesystem == r.outcome ) std::fprintf(stderr, "md5_dedup: skipped %s: no copy before it on its filesystem\n", r.path.c_str());
+                if ( md5::dedup::Outcome::changed == r.outcome ) std::fprintf(stderr, "md5_dedup: skipped %s: it or the first file changed since the scan\n", r.path.c_str());
+            }
+        }
+        catch ( std::exception const &e )
+        {
+            std::fprintf(stderr, "md5_dedup: %s\n", e.what());
+            status = 1;
+        }
+    }
+
+    std::fprintf(stderr, "%llu files, %llu with a shared size, %llu hashed in full, %llu bytes read, %llu errors\n",
+                 static_cast<unsigned long long>(stats.files), static_cast<unsigned long long>(stats.candidates),
+                 static_cast<unsigned long long>(stats.full_hashes), static_cast<unsigned long long>(stats.bytes_read),
+                 static_cast<unsigned long long>(stats.errors));
+    return status;
+}
@@ -0,0 +1,99 @@
+// Makes and applies rsync-style deltas, see md5_delta.hpp
+//
+// Build:
+//     g++ -std=c++14 -O2 -pthread -I. -o md5_delta tools/md5_delta.cpp
+//
+// Usage:
+//     md5_delta diff [--block BYTES] OLD NEW DELTA   writes the delta from OLD to NEW
+//     md5_delta patch OLD DELTA OUT                  rebuilds NEW as OUT
+//
+// 'diff' reports how many bytes the delta copies and carries on stderr.
+// 'patch' fails, and removes OUT, if the result doesn't match the delta.
+
+#include <cstdio>      // fopen, fwrite, fprintf, remove
+#include <cstdlib>     // strtoull
+#include <cstring>     // strcmp
+#include <exception>   // exception
+#include <vector>      // vector
+#include "md5_delta.hpp"
+
+namespace {
+
+    std::vector<char unsigned> read_file(char const *const path)
+    {
+        md5::file::Fd const fd = md5::file::open_read(path);
+        std::vector<char unsigned> data;
+        for ( std::uint64_t offset = 0u;; )
+        {
+            data.resize(static_cast<std::size_t>(offset) + md5::file::buffer_size);
+            std::size_t const n = md5::file::read_at(fd.get(), &data[static_cast<std::size_t>(offset)], md5::file::buffer_size, offset);
+            offset += n;
+            if ( n < md5::file::buffer_size )
+            {
+                data.resize(static_cast<std::size_t>(offset));
+                return data;
+            }
+        }
+    }
+
+    int usage(char const *const name)
+    {
+        std::fprintf(stderr, "usage: %s diff [--block BYTES] OLD NEW DELTA | patch OLD DELTA OUT\n", name);
+        return 2;
+    }
+}
+
+int main(int const argc, char **const argv)
+{
+    if ( argc < 2 ) return usage(argv[0]);
+
+    try
+    {
+        if ( 0 == std::strcmp(argv[1], "diff") )
+        {
+            int i = 2;
+            std::uint64_t block = 4096u;
+            if ( i + 1 < argc && 0 == std::strcmp(argv[i], "--block") ) { block = std::strtoull(argv[i + 1], nullptr, 10); i += 2; }
+            if ( argc - i != 3 ) return usage(argv[0]);
+
+            md5::file::Fd const old_fd = md5::file::open_read(argv[i]);
+            md5::file::Fd const new_fd = md5::file::open_read(argv[i + 1]);
+            md5::delta::Stats stats;
+            std::vector<char unsigned> const delta = md5::delta::generate(md5::delta::signature(old_fd.get(), block), new_fd.get(), &stats);
+
+            std::FILE *const f = std::fopen(argv[i + 2], "wb");
+            if ( nullptr == f ) throw std::system_error(errno, std::generic_category(), argv[i + 2]);
+            bool const ok = (delta.size() == std::fwrite(delta.data(), 1u, delta.size(), f));
+            if ( 0 != std::fclose(f) || !ok ) throw std::system_error(errno, std::generic_category(), argv[i + 2]);
+            std::fprintf(stderr, "copied %llu bytes, literal %llu bytes, delta %llu bytes\n",
+                         static_cast<unsigned long long>(stats.copied), static_cast<unsigned long long>(stats.literal),
+                         static_cast<unsigned long long>(delta.size()));
+            return 0;
+        }
+
+        if ( 0 == std::strcmp(argv[1], "patch") && 5 == argc )
+        {
+            md5::file::Fd const old_fd = md5::file::open_read(argv[2]);
+            std::vector<char unsigned> const delta = read_file(argv[3]);
+            int const out = ::open(argv[4], O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            if ( -1 == out ) throw std::system_error(errno, std::generic_category(), argv[4]);
+            md5::file::Fd const out_fd(out);
+            try
+            {
+                md5::delta::apply(old_fd.get(), delta, out_fd.get());
+            }
+            catch ( ... )
+            {
+                std::remove(argv[4]);
+                throw;
+            }
+            return 0;
+        }
+    }
+    catch ( std::exception const &e )
+    {
+        std::fprintf(stderr, "md5_delta: %s\n", e.what());
+        return 1;
+    }
+    return usage(argv[0]);
+}
@@ -0,0 +1,109 @@
+// Builds and queries the digest databases of md5_digestdb.hpp
+//
+// Build:
+//     g++ -std=c++14 -O2 -I. -o md5_digestdb tools/md5_digestdb.cpp
+//
+// Usage:
+//     md5_digestdb build DATABASE [BUCKET_BITS] < digests.txt
+//     md5_digestdb query DATABASE < digests.txt
+//
+// Digests are read one per line as 32 hexadecimal digits; anything after
+// them on the line (e.g. the file name in md5sum output) is ignored.
+// 'query' prints every input line prefixed with "found " or "missing ",
+// and exits with status 1 if any digest was missing.
+
+#include <cstdio>      // fgets, printf
+#include <cstdlib>     // strtoul
+#include <cstring>     // strcmp
+#include <exception>   // exception
+#include <string>      // string
+#include <vector>      // vector
+#include "md5_digestdb.hpp"
+
+namespace {
+
+    int hex_value(char const c) noexcept
+    {
+        if ( c >= '0' && c <= '9' ) return c - '0';
+        if ( c >= 'a' && c <= 'f' ) return c - 'a' + 10;
+        if ( c >= 'A' && c <= 'F' ) return c - 'A' + 10;
+        return -1;
+    }
+
+    bool parse_digest(char const *const line, md5::Digest &d) noexcept
+    {
+        for ( unsigned i = 0u; i < md5::Digest::count; ++i )
+        {
+            int const hi = hex_value(line[2u * i]);
+            int const lo = (-1 == hi) ? -1 : hex_value(line[2u * i + 1u]);
+            if ( -1 == lo ) return false;
+            d[i] = static_cast<char unsigned>(hi * 16 + lo);
+        }
+        return true;
+    }
+
+    int build(char const *const path, unsigned const bucket_bits)
+    {
+        md5::digestdb::Builder builder(path, bucket_bits);
+        char line[4096];
+        md5::Digest d;
+        while ( std::fgets(line, sizeof line, stdin) ) if ( parse_digest(line, d) ) builder.add(d);
+        builder.finish();
+        return 0;
+    }
+
+    int query(char const *const path)
+    {
+        md5::digestdb::Reader const db(path);
+
+        // Lines are collected in batches so that the lookups can use the
+        // prefetching batch query
+        constexpr std::size_t batch = 4096u;
+        std::vector<std::string> lines;
+        std::vector<md5::Digest> digests;
+        bool found[batch];
+        int status = 0;
+        char line[4096];
+        bool more = true;
+        while ( more )
+        {
+            lines.clear();
+            digests.clear();
+            while ( digests.size() < batch && (more = (nullptr != std::fgets(line, sizeof line, stdin))) )
+            {
+                md5::Digest d;
+                if ( !parse_digest(line, d) ) continue;
+                digests.push_back(d);
+                lines.emplace_back(line);
+            }
+            db.contains(digests.data(), digests.size(), found);
+            for ( std::size_t i = 0u; i < digests.size(); ++i )
+            {
+                std::printf("%s %s", found[i] ? "found" : "missing", lines[i].c_str());
+                if ( !found[i] ) status = 1;
+            }
+        }
+        return status;
+    }
+}
+
+int main(int const argc, char **const argv)
+{
+    try
+    {
+        if ( argc >= 3 && 0 == std::strcmp(argv[1], "build") )
+        {
+            return build(argv[2], (argc >= 4) ? static_cast<unsigned>(std::strtoul(argv[3], nullptr, 10)) : 16u);
+        }
+        if ( 3 == argc && 0 == std::strcmp(argv[1], "query") ) return query(argv[2]);
+    }
+    catch ( std::exception const &e )
+    {
+        std::fprintf(stderr, "md5_digestdb: %s\n", e.what());
+        return 2;
+    }
+
+    std::fprintf(stderr, "usage: %s build DATABASE [BUCKET_BITS] < digests.txt\n"
+                         "       %s query DATABASE < digests.txt\n", argv[0], argv[0]);
+    return 2;
+}
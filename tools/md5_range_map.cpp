@@ -0,0 +1,73 @@
+// Makes and compares per-range digest maps of disks and images, see
+// md5_range_map.hpp
+//
+// Build:
+//     g++ -std=c++14 -O2 -pthread -I. -o md5_range_map tools/md5_range_map.cpp
+//
+// Usage:
+//     md5_range_map hash [--range MIB] [--depth N] [--no-direct] IMAGE MAP
+//     md5_range_map compare MAP_A MAP_B
+//
+// 'hash' also prints the digest of the whole image like md5sum. 'compare'
+// prints "<offset> <length>" for every run of differing ranges, and exits
+// with status 1 if there is any.
+
+#include <cstdio>      // printf, fprintf
+#include <cstdlib>     // strtoull, strtoul
+#include <cstring>     // strcmp
+#include <exception>   // exception
+#include "md5_range_map.hpp"
+#include "md5_util.hpp"
+
+namespace {
+
+    int usage(char const *const name)
+    {
+        std::fprintf(stderr, "usage: %s hash [--range MIB] [--depth N] [--no-direct] IMAGE MAP | compare MAP_A MAP_B\n", name);
+        return 2;
+    }
+}
+
+int main(int const argc, char **const argv)
+{
+    if ( argc < 2 ) return usage(argv[0]);
+
+    try
+    {
+        if ( 0 == std::strcmp(argv[1], "hash") )
+        {
+            md5::range_map::Options options;
+            int i = 2;
+            for ( ; i < argc && '-' == argv[i][0]; ++i )
+            {
+                bool const has_value = (i + 1) < argc;
+                if      ( 0 == std::strcmp(argv[i], "--range") && has_value ) options.range_size = std::strtoull(argv[++i], nullptr, 10) * 1024u * 1024u;
+                else if ( 0 == std::strcmp(argv[i], "--depth") && has_value ) options.depth = static_cast<unsigned>(std::strtoul(argv[++i], nullptr, 10));
+                else if ( 0 == std::strcmp(argv[i], "--no-direct") ) options.direct = false;
+                else return usage(argv[0]);
+            }
+            if ( argc - i != 2 ) return usage(argv[0]);
+
+            md5::range_map::RangeMap const map = md5::range_map::hash(argv[i], options);
+            md5::range_map::save(map, argv[i + 1]);
+            std::printf("%s  %s\n", md5::util::hex(map.whole).c_str(), argv[i]);
+            return 0;
+        }
+
+        if ( 0 == std::strcmp(argv[1], "compare") && 4 == argc )
+        {
+            auto const differences = md5::range_map::compare(md5::range_map::load(argv[2]), md5::range_map::load(argv[3]));
+            for ( auto const &d : differences )
+            {
+                std::printf("%llu %llu\n", static_cast<unsigned long long>(d.offset), static_cast<unsigned long long>(d.length));
+            }
+            return differences.empty() ? 0 : 1;
+        }
+    }
+    catch ( std::exception const &e )
+    {
+        std::fprintf(stderr, "md5_range_map: %s\n", e.what());
+        return 1;
+    }
+    return usage(argv[0]);
+}
@@ -0,0 +1,83 @@
+// Verifies the files of an md5sum manifest in the background, see
+// md5_scrub.hpp
+//
+// Build:
+//     g++ -std=c++14 -O2 -pthread -I. -o md5_scrub tools/md5_scrub.cpp
+//
+// Usage:
+//     md5_scrub [--rate MIB_PER_S] [--iops N] [--latency-ms MS] [--checkpoint FILE]
+//               [--no-idle] [--loop] MANIFEST
+//
+// Prints "<path>: FAILED" for every mismatch and "<path>: ERROR (...)" for
+// files that can't be read, and a summary on stderr. SIGINT and SIGTERM
+// stop after saving the checkpoint. Exits with status 1 if anything
+// failed.
+
+#include <atomic>      // atomic
+#include <csignal>     // signal
+#include <cstdio>      // printf, fprintf
+#include <cstdlib>     // strtod, strtoul
+#include <cstring>     // strcmp
+#include <exception>   // exception
+#include "md5_scrub.hpp"
+
+namespace {
+
+    std::atomic<bool> g_stop{ false };
+
+    extern "C" void on_signal(int)
+    {
+        g_stop = true;
+    }
+}
+
+int main(int const argc, char **const argv)
+{
+    md5::scrub::Options options;
+    bool loop = false;
+    char const *manifest = nullptr;
+
+    for ( int i = 1; i < argc; ++i )
+    {
+        bool const has_value = (i + 1) < argc;
+        if      ( 0 == std::strcmp(argv[i], "--rate"      ) && has_value ) options.bytes_per_second = std::strtod(argv[++i], nullptr) * 1024.0 * 1024.0;
+        else if ( 0 == std::strcmp(argv[i], "--iops"      ) && has_value ) options.reads_per_second = std::strtod(argv[++i], nullptr);
+        else if ( 0 == std::strcmp(argv[i], "--latency-ms") && has_value ) options.latency_target = std::chrono::milliseconds(std::strtoul(argv[++i], nullptr, 10));
+        else if ( 0 == std::strcmp(argv[i], "--checkpoint") && has_value ) options.checkpoint = argv[++i];
+        else if ( 0 == std::strcmp(argv[i], "--no-idle"   ) ) options.idle_priority = false;
+        else if ( 0 == std::strcmp(argv[i], "--loop"      ) ) loop = true;
+        else if ( '-' != argv[i][0] && nullptr == manifest ) manifest = argv[i];
+        else manifest = nullptr, i = argc;
+    }
+    if ( nullptr == manifest )
+    {
+        std::fprintf(stderr, "usage: %s [--rate MIB_PER_S] [--iops N] [--latency-ms MS] [--checkpoint FILE] [--no-idle] [--loop] MANIFEST\n", argv[0]);
+        return 2;
+    }
+
+    std::signal(SIGINT, on_signal);
+    std::signal(SIGTERM, on_signal);
+
+    try
+    {
+        md5::scrub::Scrubber scrubber(md5::scrub::load_manifest(manifest), options);
+        auto const report = [](md5::scrub::Entry const &e, md5::scrub::Result const result, char const *const message) {
+            if ( md5::scrub::Result::mismatch == result ) std::printf("%s: FAILED\n", e.path.c_str());
+            else std::printf("%s: ERROR (%s)\n", e.path.c_str(), message);
+            std::fflush(stdout);
+        };
+        while ( scrubber.run(g_stop, report) && loop ) {}
+
+        md5::scrub::Stats const &s = scrubber.stats();
+        std::fprintf(stderr, "%llu files, %llu bytes, %llu failed, %llu errors; pass %llu, next entry %llu\n",
+                     static_cast<unsigned long long>(s.files), static_cast<unsigned long long>(s.bytes),
+                     static_cast<unsigned long long>(s.mismatches), static_cast<unsigned long long>(s.errors),
+                     static_cast<unsigned long long>(scrubber.pass()), static_cast<unsigned long long>(scrubber.next()));
+        return (0u == s.mismatches && 0u == s.errors) ? 0 : 1;
+    }
+    catch ( std::exception const &e )
+    {
+        std::fprintf(stderr, "md5_scrub: %s\n", e.what());
+        return 1;
+    }
+}
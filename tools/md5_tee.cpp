@@ -0,0 +1,72 @@
+// Copies stdin to a file or to stdout and prints the MD5 of what went
+// through on stderr, see md5_splice.hpp
+//
+// Build:
+//     g++ -std=c++14 -O2 -I. -o md5_tee tools/md5_tee.cpp
+//
+// Usage:
+//     md5_tee [--base64] [OUT]
+//
+// With --base64 the digest is printed as a Content-MD5 header value.
+
+#include <cstdio>      // fprintf
+#include <cstring>     // strcmp
+#include <exception>   // exception
+#include <string>      // string
+#include <fcntl.h>     // open
+#include "md5_splice.hpp"
+#include "md5_util.hpp"
+
+namespace {
+
+    std::string base64(md5::Digest const &d)
+    {
+        static char const alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+        std::string out;
+        for ( std::size_t i = 0u; i < md5::Digest::count; i += 3u )
+        {
+            unsigned const n = static_cast<unsigned>(d.b[i]) << 16u
+                             | (i + 1u < md5::Digest::count ? static_cast<unsigned>(d.b[i + 1u]) << 8u : 0u)
+                             | (i + 2u < md5::Digest::count ? static_cast<unsigned>(d.b[i + 2u]) : 0u);
+            out += alphabet[(n >> 18u) & 63u];
+            out += alphabet[(n >> 12u) & 63u];
+            out += (i + 1u < md5::Digest::count) ? alphabet[(n >> 6u) & 63u] : '=';
+            out += (i + 2u < md5::Digest::count) ? alphabet[n & 63u] : '=';
+        }
+        return out;
+    }
+
+    int usage(char const *const name)
+    {
+        std::fprintf(stderr, "usage: %s [--base64] [OUT]\n", name);
+        return 2;
+    }
+}
+
+int main(int const argc, char **const argv)
+{
+    int i = 1;
+    bool as_base64 = false;
+    if ( i < argc && 0 == std::strcmp(argv[i], "--base64") ) { as_base64 = true; ++i; }
+    if ( argc - i > 1 ) return usage(argv[0]);
+
+    try
+    {
+        md5::file::Fd out_fd;
+        int out = STDOUT_FILENO;
+        if ( i < argc )
+        {
+            out = ::open(argv[i], O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            if ( -1 == out ) throw std::system_error(errno, std::generic_category(), argv[i]);
+            out_fd = md5::file::Fd(out);
+        }
+        md5::Digest const d = md5::splice::passthrough(STDIN_FILENO, out);
+        std::fprintf(stderr, "%s\n", as_base64 ? base64(d).c_str() : md5::util::hex(d).c_str());
+        return 0;
+    }
+    catch ( std::exception const &e )
+    {
+        std::fprintf(stderr, "md5_tee: %s\n", e.what());
+        return 1;
+    }
+}
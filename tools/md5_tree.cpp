@@ -0,0 +1,68 @@
+// Prints one digest per directory tree, see md5_tree_digest.hpp
+//
+// Build:
+//     g++ -std=c++14 -O2 -pthread -I. -o md5_tree tools/md5_tree.cpp
+//
+// Usage:
+//     md5_tree [--threads N] [--no-mode] [--cache INDEX] DIR...
+//
+// Prints "<digest>  <dir>" for every DIR, like md5sum. Two trees with the
+// same names, permissions and contents print the same digest on any host.
+
+#include <cstdio>      // printf, fprintf
+#include <cstdlib>     // strtoul
+#include <cstring>     // strcmp
+#include <exception>   // exception
+#include <memory>      // unique_ptr
+#include <vector>      // vector
+#include "md5_tree_digest.hpp"
+
+int main(int const argc, char **const argv)
+{
+    md5::tree::Options options;
+    char const *index = nullptr;
+    std::vector<char const *> roots;
+
+    for ( int i = 1; i < argc; ++i )
+    {
+        bool const has_value = (i + 1) < argc;
+        if      ( 0 == std::strcmp(argv[i], "--threads") && has_value ) options.threads = static_cast<unsigned>(std::strtoul(argv[++i], nullptr, 10));
+        else if ( 0 == std::strcmp(argv[i], "--cache"  ) && has_value ) index = argv[++i];
+        else if ( 0 == std::strcmp(argv[i], "--no-mode") ) options.include_mode = false;
+        else if ( '-' != argv[i][0] ) roots.push_back(argv[i]);
+        else roots.clear(), i = argc;
+    }
+    if ( roots.empty() )
+    {
+        std::fprintf(stderr, "usage: %s [--threads N] [--no-mode] [--cache INDEX] DIR...\n", argv[0]);
+        return 2;
+    }
+
+    int status = 0;
+    try
+    {
+        std::unique_ptr<md5::file::DigestCache> cache;
+        if ( nullptr != index ) options.cache = (cache.reset(new md5::file::DigestCache(index)), cache.get());
+
+        for ( char const *const root : roots )
+        {
+            try
+            {
+                md5::Digest const d = md5::tree::tree_digest(root, options);
+                for ( char unsigned const b : d ) std::printf("%02x", b);
+                std::printf("  %s\n", root);
+            }
+            catch ( std::system_error const &e )
+            {
+                std::fprintf(stderr, "md5_tree: %s\n", e.what());
+                status = 1;
+            }
+        }
+    }
+    catch ( std::exception const &e )
+    {
+        std::fprintf(stderr, "md5_tree: %s\n", e.what());
+        return 1;
+    }
+    return status;
+}
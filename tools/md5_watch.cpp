@@ -0,0 +1,82 @@
+// Prints the digests of a directory tree and keeps printing them as files
+// change, see md5_tree_watch.hpp (Linux only)
+//
+// Build:
+//     g++ -std=c++14 -O2 -pthread -I. -o md5_watch tools/md5_watch.cpp
+//
+// Usage:
+//     md5_watch [--threads N] [--debounce MS] [--cache INDEX] DIR
+//
+// The initial manifest is printed as "<digest>  <path>" lines like md5sum,
+// followed by a blank line. After that every change is printed the same
+// way, with "-" in place of the digest for a file that is gone. Stops on
+// SIGINT or SIGTERM.
+
+#include <atomic>      // atomic
+#include <csignal>     // signal
+#include <cstdio>      // printf, fprintf
+#include <cstdlib>     // strtoul
+#include <cstring>     // strcmp
+#include <exception>   // exception
+#include <memory>      // unique_ptr
+#include "md5_tree_watch.hpp"
+
+namespace {
+
+    std::atomic<bool> g_stop{ false };
+
+    extern "C" void on_signal(int)
+    {
+        g_stop = true;
+    }
+
+    void print(std::string const &path, md5::Digest const *const digest)
+    {
+        if ( nullptr == digest ) std::printf("%-32s", "-");
+        else for ( char unsigned const b : *digest ) std::printf("%02x", b);
+        std::printf("  %s\n", path.c_str());
+        std::fflush(stdout);
+    }
+}
+
+int main(int const argc, char **const argv)
+{
+    md5::watch::Options options;
+    char const *index = nullptr;
+    char const *root = nullptr;
+
+    for ( int i = 1; i < argc; ++i )
+    {
+        bool const has_value = (i + 1) < argc;
+        if      ( 0 == std::strcmp(argv[i], "--threads" ) && has_value ) options.threads = static_cast<unsigned>(std::strtoul(argv[++i], nullptr, 10));
+        else if ( 0 == std::strcmp(argv[i], "--debounce") && has_value ) options.debounce = std::chrono::milliseconds(std::strtoul(argv[++i], nullptr, 10));
+        else if ( 0 == std::strcmp(argv[i], "--cache"   ) && has_value ) index = argv[++i];
+        else if ( '-' != argv[i][0] && nullptr == root ) root = argv[i];
+        else root = nullptr, i = argc;
+    }
+    if ( nullptr == root )
+    {
+        std::fprintf(stderr, "usage: %s [--threads N] [--debounce MS] [--cache INDEX] DIR\n", argv[0]);
+        return 2;
+    }
+
+    try
+    {
+        std::unique_ptr<md5::file::DigestCache> cache;
+        if ( nullptr != index ) options.cache = (cache.reset(new md5::file::DigestCache(index)), cache.get());
+
+        std::signal(SIGINT, on_signal);
+        std::signal(SIGTERM, on_signal);
+
+        md5::watch::TreeWatcher watcher(root, options);
+        for ( auto const &entry : watcher.manifest() ) print(entry.first, &entry.second);
+        std::printf("\n");
+        watcher.run(g_stop, print);
+    }
+    catch ( std::exception const &e )
+    {
+        std::fprintf(stderr, "md5_watch: %s\n", e.what());
+        return 1;
+    }
+    return 0;
+}